@@ -36,6 +36,7 @@
 #define FB_CMD_GSI "gsi"
 #define FB_CMD_SNAPSHOT_UPDATE "snapshot-update"
 #define FB_CMD_FETCH "fetch"
+#define FB_CMD_STREAM_FLASH "stream-flash"
 
 #define RESPONSE_OKAY "OKAY"
 #define RESPONSE_FAIL "FAIL"
@@ -84,3 +85,4 @@
 #define FB_VAR_DMESG "dmesg"
 #define FB_VAR_BATTERY_SERIAL_NUMBER "battery-serial-number"
 #define FB_VAR_BATTERY_PART_STATUS "battery-part-status"
+#define FB_VAR_FLASH_SPEED "flash-speed"
@@ -109,6 +109,7 @@ FastbootDevice::FastbootDevice()
               {FB_CMD_GSI, GsiHandler},
               {FB_CMD_SNAPSHOT_UPDATE, SnapshotUpdateHandler},
               {FB_CMD_FETCH, FetchHandler},
+              {FB_CMD_STREAM_FLASH, StreamFlashHandler},
       }),
       boot_control_hal_(BootControlClient::WaitForService()),
       health_hal_(get_health_service()),
@@ -186,7 +187,7 @@ bool FastbootDevice::WriteStatus(FastbootResult result, const std::string& messa
     return true;
 }
 
-bool FastbootDevice::HandleData(bool read, std::vector<char>* data) {
+bool FastbootDevice::HandleData(bool read, DownloadBuffer* data) {
     return HandleData(read, data->data(), data->size());
 }
 
@@ -16,12 +16,16 @@
 
 #pragma once
 
+#include <stdlib.h>
+#include <unistd.h>
+
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <android-base/logging.h>
 #include <BootControlClient.h>
 #include <aidl/android/hardware/fastboot/IFastboot.h>
 #include <aidl/android/hardware/health/IHealth.h>
@@ -30,6 +34,37 @@
 #include "transport.h"
 #include "variables.h"
 
+// Keeps downloaded data page aligned, so that it can be written to partitions
+// opened with O_DIRECT straight from the download buffer.
+template <typename T>
+struct PageAlignedAllocator {
+    using value_type = T;
+
+    PageAlignedAllocator() = default;
+    template <typename U>
+    PageAlignedAllocator(const PageAlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p;
+        if (posix_memalign(&p, getpagesize(), n * sizeof(T))) {
+            LOG(FATAL) << "Failed to allocate " << n * sizeof(T) << " bytes";
+        }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+
+    template <typename U>
+    bool operator==(const PageAlignedAllocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const PageAlignedAllocator<U>&) const {
+        return false;
+    }
+};
+
+using DownloadBuffer = std::vector<char, PageAlignedAllocator<char>>;
+
 class FastbootDevice {
   public:
     using BootControlClient = android::hal::BootControlClient;
@@ -39,7 +74,7 @@ class FastbootDevice {
     void CloseDevice();
     void ExecuteCommands();
     bool WriteStatus(FastbootResult result, const std::string& message);
-    bool HandleData(bool read, std::vector<char>* data);
+    bool HandleData(bool read, DownloadBuffer* data);
     bool HandleData(bool read, char* data, uint64_t size);
     std::string GetCurrentSlot();
 
@@ -48,7 +83,7 @@ class FastbootDevice {
     bool WriteFail(const std::string& message);
     bool WriteInfo(const std::string& message);
 
-    std::vector<char>& download_data() { return download_data_; }
+    DownloadBuffer& download_data() { return download_data_; }
     Transport* get_transport() { return transport_.get(); }
     BootControlClient* boot_control_hal() const { return boot_control_hal_.get(); }
     BootControlClient* boot1_1() const;
@@ -59,6 +94,9 @@ class FastbootDevice {
 
     void set_active_slot(const std::string& active_slot) { active_slot_ = active_slot; }
 
+    // Write throughput of the last flash of each partition, in MB/s.
+    std::unordered_map<std::string, double>& flash_speeds() { return flash_speeds_; }
+
   private:
     const std::unordered_map<std::string, CommandHandler> kCommandMap;
 
@@ -66,6 +104,7 @@ class FastbootDevice {
     std::unique_ptr<BootControlClient> boot_control_hal_;
     std::shared_ptr<aidl::android::hardware::health::IHealth> health_hal_;
     std::shared_ptr<aidl::android::hardware::fastboot::IFastboot> fastboot_hal_;
-    std::vector<char> download_data_;
+    DownloadBuffer download_data_;
     std::string active_slot_;
+    std::unordered_map<std::string, double> flash_speeds_;
 };
@@ -21,14 +21,17 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <ext4_utils/ext4_utils.h>
 #include <fs_mgr_overlayfs.h>
@@ -37,6 +40,7 @@
 #include <liblp/builder.h>
 #include <liblp/liblp.h>
 #include <libsnapshot/snapshot.h>
+#include <liburing.h>
 #include <sparse/sparse.h>
 
 #include "fastboot_device.h"
@@ -49,6 +53,17 @@ namespace {
 
 constexpr uint32_t SPARSE_HEADER_MAGIC = 0xed26ff3a;
 
+// The start of the sparse image header, up to the size of the expanded image.
+struct SparseHeaderStart {
+    uint32_t magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+};
+
 void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partition_name) {
     // May be called, in the case of sparse data, multiple times so cache/skip.
     static std::set<std::string> wiped;
@@ -74,64 +89,331 @@ void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partit
     }
 }
 
-}  // namespace
+// Number of writes kept in flight to a partition, and the size of each.
+constexpr unsigned int kWriteQueueDepth = 8;
+constexpr size_t kWriteSize = 1024 * 1024;
+// One more buffer than writes in flight, to gather data into.
+constexpr unsigned int kNumWriteBuffers = kWriteQueueDepth + 1;
+// Required alignment of the memory, offset and length of O_DIRECT writes.
+constexpr size_t kDirectIoAlignment = 4096;
+
+// Writes an image to a partition opened with O_DIRECT. Up to kWriteQueueDepth
+// writes are kept in flight through io_uring when the kernel supports it.
+//
+// Data that stays valid until Finish() and is suitably aligned, such as a raw
+// image in the download buffer, is written in place. Anything else is gathered
+// into a few aligned buffers allocated once per partition. As before, the
+// partition is reopened without O_DIRECT for the rest of the image once an
+// unaligned write is needed.
+class PartitionWriter {
+  public:
+    explicit PartitionWriter(PartitionHandle* handle) : handle_(handle) {}
+    ~PartitionWriter();
+
+    bool Init();
+
+    // Writes |len| bytes at the current offset. If |stable| is set, |data|
+    // must stay valid until Finish(). Otherwise it is copied before returning.
+    int Write(const char* data, size_t len, bool stable);
+    // Leaves the next |len| bytes of the partition untouched.
+    int Skip(uint64_t len);
+    // Returns a kWriteSize buffer for the caller to fill and pass to Submit(),
+    // or nullptr after an error.
+    char* GetBuffer();
+    int Submit(size_t len);
+    // Waits for all queued writes. Returns 0, or the first error.
+    int Finish();
+
+    uint64_t bytes_written() const { return bytes_written_; }
+
+  private:
+    struct Request {
+        int buffer;
+        size_t len;
+    };
+
+    char* BufferData(int buffer) { return buffers_.get() + buffer * kWriteSize; }
+    void ReleaseBuffer(int buffer);
+    bool AcquireBuffer();
+    int FlushBuffer();
+    int Queue(const char* data, size_t len, int buffer);
+    void Reap();
+    int Drain();
+    int Fail(int error);
+
+    PartitionHandle* handle_;
+    std::unique_ptr<char, decltype(&free)> buffers_{nullptr, free};
+    std::vector<int> free_buffers_;
+    // Buffer being filled by Write(), or -1.
+    int buffer_ = -1;
+    size_t buffer_len_ = 0;
+
+    std::unique_ptr<io_uring> ring_;
+    Request requests_[kWriteQueueDepth];
+    std::vector<Request*> free_requests_;
+    unsigned int in_flight_ = 0;
+
+    bool direct_ = true;
+    uint64_t offset_ = 0;
+    uint64_t bytes_written_ = 0;
+    int error_ = 0;
+};
+
+PartitionWriter::~PartitionWriter() {
+    if (ring_) {
+        Drain();
+        io_uring_queue_exit(ring_.get());
+    }
+}
 
-int FlashRawDataChunk(PartitionHandle* handle, const char* data, size_t len) {
-    size_t ret = 0;
-    const size_t max_write_size = 1048576;
-    void* aligned_buffer;
+bool PartitionWriter::Init() {
+    void* buffers;
+    if (posix_memalign(&buffers, kDirectIoAlignment, kNumWriteBuffers * kWriteSize)) {
+        PLOG(ERROR) << "Failed to allocate write buffers";
+        return false;
+    }
+    buffers_.reset(static_cast<char*>(buffers));
+    for (int i = kNumWriteBuffers - 1; i >= 0; i--) {
+        free_buffers_.push_back(i);
+    }
+    for (auto& request : requests_) {
+        free_requests_.push_back(&request);
+    }
 
-    if (posix_memalign(&aligned_buffer, 4096, max_write_size)) {
-        PLOG(ERROR) << "Failed to allocate write buffer";
-        return -ENOMEM;
+    if (DoesKernelSupportIouring()) {
+        ring_ = std::make_unique<io_uring>();
+        int ret = io_uring_queue_init(kWriteQueueDepth, ring_.get(), 0);
+        if (ret) {
+            LOG(WARNING) << "Failed to initialize io_uring, writing synchronously: "
+                         << strerror(-ret);
+            ring_ = nullptr;
+        }
     }
+    return true;
+}
 
-    auto aligned_buffer_unique_ptr = std::unique_ptr<void, decltype(&free)>{aligned_buffer, free};
+int PartitionWriter::Fail(int error) {
+    if (!error_) {
+        error_ = error;
+    }
+    return error_;
+}
 
-    while (ret < len) {
-        int this_len = std::min(max_write_size, len - ret);
-        memcpy(aligned_buffer_unique_ptr.get(), data, this_len);
-        // In case of non 4KB aligned writes, reopen without O_DIRECT flag
-        if (this_len & 0xFFF) {
-            if (handle->Reset(O_WRONLY) != true) {
-                PLOG(ERROR) << "Failed to reset file descriptor";
-                return -1;
-            }
+void PartitionWriter::ReleaseBuffer(int buffer) {
+    if (buffer >= 0) {
+        free_buffers_.push_back(buffer);
+    }
+}
+
+bool PartitionWriter::AcquireBuffer() {
+    // Buffers are only ever missing while they are being written by io_uring.
+    while (free_buffers_.empty() && in_flight_) {
+        Reap();
+    }
+    if (error_ || free_buffers_.empty()) {
+        return false;
+    }
+    buffer_ = free_buffers_.back();
+    free_buffers_.pop_back();
+    buffer_len_ = 0;
+    return true;
+}
+
+int PartitionWriter::FlushBuffer() {
+    if (buffer_ < 0 || !buffer_len_) {
+        return error_;
+    }
+    int buffer = buffer_;
+    size_t len = buffer_len_;
+    buffer_ = -1;
+    buffer_len_ = 0;
+    return Queue(BufferData(buffer), len, buffer);
+}
+
+int PartitionWriter::Queue(const char* data, size_t len, int buffer) {
+    if (error_) {
+        ReleaseBuffer(buffer);
+        return error_;
+    }
+
+    if (direct_ && (len % kDirectIoAlignment || offset_ % kDirectIoAlignment ||
+                    reinterpret_cast<uintptr_t>(data) % kDirectIoAlignment)) {
+        if (Drain() || !handle_->Reset(O_WRONLY)) {
+            PLOG(ERROR) << "Failed to reset file descriptor";
+            ReleaseBuffer(buffer);
+            return Fail(-EIO);
         }
+        direct_ = false;
+    }
 
-        int this_ret = write(handle->fd(), aligned_buffer_unique_ptr.get(), this_len);
-        if (this_ret < 0) {
+    if (!ring_) {
+        if (!android::base::WriteFullyAtOffset(handle_->fd(), data, len, offset_)) {
             PLOG(ERROR) << "Failed to flash data of len " << len;
-            return -1;
+            Fail(-errno);
         }
-        data += this_ret;
-        ret += this_ret;
+        ReleaseBuffer(buffer);
+    } else {
+        while (in_flight_ == kWriteQueueDepth) {
+            Reap();
+        }
+        Request* request = free_requests_.back();
+        *request = {buffer, len};
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+        io_uring_prep_write(sqe, handle_->fd(), data, len, offset_);
+        io_uring_sqe_set_data(sqe, request);
+        int ret = io_uring_submit(ring_.get());
+        if (ret != 1) {
+            LOG(ERROR) << "Failed to submit write of len " << len << ": "
+                       << strerror(ret < 0 ? -ret : EIO);
+            ReleaseBuffer(buffer);
+            return Fail(ret < 0 ? ret : -EIO);
+        }
+        free_requests_.pop_back();
+        in_flight_++;
     }
-    return 0;
+
+    offset_ += len;
+    bytes_written_ += len;
+    return error_;
 }
 
-int FlashRawData(PartitionHandle* handle, const std::vector<char>& downloaded_data) {
-    int ret = FlashRawDataChunk(handle, downloaded_data.data(), downloaded_data.size());
+void PartitionWriter::Reap() {
+    struct io_uring_cqe* cqe;
+    int ret;
+    do {
+        ret = io_uring_wait_cqe(ring_.get(), &cqe);
+    } while (ret == -EINTR);
     if (ret < 0) {
-        return -errno;
+        LOG(ERROR) << "Failed to wait for write completion: " << strerror(-ret);
+        Fail(ret);
+        // Nothing more can be reaped; the ring is torn down by the destructor.
+        in_flight_ = 0;
+        return;
     }
-    return ret;
+
+    Request* request = static_cast<Request*>(io_uring_cqe_get_data(cqe));
+    if (cqe->res < 0) {
+        LOG(ERROR) << "Failed to flash data of len " << request->len << ": "
+                   << strerror(-cqe->res);
+        Fail(cqe->res);
+    } else if (static_cast<size_t>(cqe->res) != request->len) {
+        LOG(ERROR) << "Short write of " << cqe->res << " bytes out of " << request->len;
+        Fail(-EIO);
+    }
+    io_uring_cqe_seen(ring_.get(), cqe);
+
+    ReleaseBuffer(request->buffer);
+    free_requests_.push_back(request);
+    in_flight_--;
+}
+
+int PartitionWriter::Drain() {
+    while (in_flight_) {
+        Reap();
+    }
+    return error_;
+}
+
+int PartitionWriter::Write(const char* data, size_t len, bool stable) {
+    while (len && !error_) {
+        bool aligned = !direct_ || reinterpret_cast<uintptr_t>(data) % kDirectIoAlignment == 0;
+        if (stable && aligned && len >= kDirectIoAlignment) {
+            if (FlushBuffer()) {
+                break;
+            }
+            size_t n = std::min(len, kWriteSize);
+            if (direct_) {
+                n -= n % kDirectIoAlignment;
+            }
+            Queue(data, n, -1);
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        if (buffer_ < 0 && !AcquireBuffer()) {
+            break;
+        }
+        size_t n = std::min(len, kWriteSize - buffer_len_);
+        memcpy(BufferData(buffer_) + buffer_len_, data, n);
+        buffer_len_ += n;
+        data += n;
+        len -= n;
+        if (buffer_len_ == kWriteSize) {
+            FlushBuffer();
+        }
+    }
+    return error_;
+}
+
+int PartitionWriter::Skip(uint64_t len) {
+    if (FlushBuffer()) {
+        return error_;
+    }
+    offset_ += len;
+    return 0;
+}
+
+char* PartitionWriter::GetBuffer() {
+    if (FlushBuffer() || (buffer_ < 0 && !AcquireBuffer())) {
+        return nullptr;
+    }
+    return BufferData(buffer_);
+}
+
+int PartitionWriter::Submit(size_t len) {
+    buffer_len_ = len;
+    return FlushBuffer();
+}
+
+int PartitionWriter::Finish() {
+    FlushBuffer();
+    Drain();
+    if (buffer_ >= 0) {
+        ReleaseBuffer(buffer_);
+        buffer_ = -1;
+    }
+    return error_;
 }
 
+// Data passed to WriteCallback by libsparse.
+struct SparseWriteContext {
+    PartitionWriter* writer;
+    // Memory that stays valid until the writer is finished.
+    const char* stable_begin;
+    const char* stable_end;
+};
+
 int WriteCallback(void* priv, const void* data, size_t len) {
-    PartitionHandle* handle = reinterpret_cast<PartitionHandle*>(priv);
+    auto context = reinterpret_cast<SparseWriteContext*>(priv);
     if (!data) {
-        if (lseek64(handle->fd(), len, SEEK_CUR) < 0) {
-            int rv = -errno;
-            PLOG(ERROR) << "lseek failed";
-            return rv;
-        }
-        return 0;
+        return context->writer->Skip(len);
+    }
+    const char* chars = reinterpret_cast<const char*>(data);
+    bool stable = chars >= context->stable_begin && chars + len <= context->stable_end;
+    return context->writer->Write(chars, len, stable);
+}
+
+void RecordFlashSpeed(FastbootDevice* device, const std::string& partition_name, uint64_t bytes,
+                      std::chrono::steady_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    if (seconds <= 0) {
+        return;
     }
-    return FlashRawDataChunk(handle, reinterpret_cast<const char*>(data), len);
+    double speed = bytes / seconds / (1024 * 1024);
+    device->flash_speeds()[partition_name] = speed;
+    LOG(INFO) << "Flashed " << bytes << " bytes to " << partition_name << " in " << seconds
+              << "s (" << speed << " MB/s)";
 }
 
-int FlashSparseData(PartitionHandle* handle, std::vector<char>& downloaded_data) {
+}  // namespace
+
+static int FlashRawData(PartitionWriter* writer, const DownloadBuffer& downloaded_data) {
+    return writer->Write(downloaded_data.data(), downloaded_data.size(), true);
+}
+
+static int FlashSparseData(PartitionWriter* writer, DownloadBuffer& downloaded_data) {
     struct sparse_file* file = sparse_file_import_buf(downloaded_data.data(),
                                                       downloaded_data.size(), true, false);
     if (!file) {
@@ -139,20 +421,27 @@ int FlashSparseData(PartitionHandle* handle, std::vector<char>& downloaded_data)
         LOG(ERROR) << "Unable to open sparse data for flashing";
         return -EINVAL;
     }
-    return sparse_file_callback(file, false, false, WriteCallback, reinterpret_cast<void*>(handle));
+    // Raw chunks point into the download buffer; fill chunks do not.
+    SparseWriteContext context = {writer, downloaded_data.data(),
+                                  downloaded_data.data() + downloaded_data.size()};
+    int ret = sparse_file_callback(file, false, false, WriteCallback, &context);
+    sparse_file_destroy(file);
+    return ret;
 }
 
-int FlashBlockDevice(PartitionHandle* handle, std::vector<char>& downloaded_data) {
-    lseek64(handle->fd(), 0, SEEK_SET);
+static int FlashBlockDevice(PartitionWriter* writer, DownloadBuffer& downloaded_data) {
+    int ret;
     if (downloaded_data.size() >= sizeof(SPARSE_HEADER_MAGIC) &&
         *reinterpret_cast<uint32_t*>(downloaded_data.data()) == SPARSE_HEADER_MAGIC) {
-        return FlashSparseData(handle, downloaded_data);
+        ret = FlashSparseData(writer, downloaded_data);
     } else {
-        return FlashRawData(handle, downloaded_data);
+        ret = FlashRawData(writer, downloaded_data);
     }
+    int finish = writer->Finish();
+    return ret < 0 ? ret : finish;
 }
 
-static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_size) {
+static void CopyAVBFooter(DownloadBuffer* data, const uint64_t block_device_size) {
     if (data->size() < AVB_FOOTER_SIZE) {
         return;
     }
@@ -173,13 +462,21 @@ static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_s
     }
 }
 
+// Whether the AVB footer of an image flashed to the partition has to be moved
+// to the end of the partition.
+static bool HasAVBFooterAtEnd(const std::string& partition_name) {
+    return partition_name == "boot" || partition_name == "boot_a" || partition_name == "boot_b" ||
+           partition_name == "init_boot" || partition_name == "init_boot_a" ||
+           partition_name == "init_boot_b";
+}
+
 int Flash(FastbootDevice* device, const std::string& partition_name) {
     PartitionHandle handle;
     if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
         return -ENOENT;
     }
 
-    std::vector<char> data = std::move(device->download_data());
+    DownloadBuffer data = std::move(device->download_data());
     if (data.size() == 0) {
         LOG(ERROR) << "Cannot flash empty data vector";
         return -EINVAL;
@@ -189,27 +486,153 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
         LOG(ERROR) << "Cannot flash " << data.size() << " bytes to block device of size "
                    << block_device_size;
         return -EOVERFLOW;
-    } else if (data.size() < block_device_size &&
-               (partition_name == "boot" || partition_name == "boot_a" ||
-                partition_name == "boot_b" || partition_name == "init_boot" ||
-                partition_name == "init_boot_a" || partition_name == "init_boot_b")) {
+    } else if (data.size() < block_device_size && HasAVBFooterAtEnd(partition_name)) {
         CopyAVBFooter(&data, block_device_size);
     }
     if (android::base::GetProperty("ro.system.build.type", "") != "user") {
         WipeOverlayfsForPartition(device, partition_name);
     }
-    int result = FlashBlockDevice(&handle, data);
+
+    PartitionWriter writer(&handle);
+    if (!writer.Init()) {
+        return -ENOMEM;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int result = FlashBlockDevice(&writer, data);
     sync();
+    if (!result) {
+        RecordFlashSpeed(device, partition_name, writer.bytes_written(),
+                         std::chrono::steady_clock::now() - start);
+    }
     return result;
 }
 
+int StreamFlash(FastbootDevice* device, const std::string& partition_name, uint32_t size) {
+    if (HasAVBFooterAtEnd(partition_name)) {
+        // The footer may have to be moved to the end of the partition, so
+        // these small images still go through the download buffer. The size
+        // comes from the host: bound it before allocating the buffer.
+        uint64_t block_device_size;
+        {
+            // Flash() opens the partition again, exclusively.
+            PartitionHandle handle;
+            if (!OpenPartition(device, partition_name, &handle, O_RDONLY)) {
+                return -ENOENT;
+            }
+            block_device_size = get_block_device_size(handle.fd());
+        }
+        if (size > block_device_size) {
+            LOG(ERROR) << "Cannot flash " << size << " bytes to block device of size "
+                       << block_device_size;
+            return -EOVERFLOW;
+        }
+        device->download_data().resize(size);
+        if (!device->WriteStatus(FastbootResult::DATA, android::base::StringPrintf("%08x", size)) ||
+            !device->HandleData(true, &device->download_data())) {
+            return -EIO;
+        }
+        return Flash(device, partition_name);
+    }
+
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
+        return -ENOENT;
+    }
+    uint64_t block_device_size = get_block_device_size(handle.fd());
+
+    PartitionWriter writer(&handle);
+    if (!writer.Init()) {
+        return -ENOMEM;
+    }
+    if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+        WipeOverlayfsForPartition(device, partition_name);
+    }
+
+    if (!device->WriteStatus(FastbootResult::DATA, android::base::StringPrintf("%08x", size))) {
+        return -EIO;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<char> buffer(kWriteSize);
+    SparseWriteContext context = {&writer, nullptr, nullptr};
+    std::unique_ptr<sparse_stream, decltype(&sparse_stream_destroy)> sparse(nullptr,
+                                                                           sparse_stream_destroy);
+    int ret = 0;
+    for (uint32_t received = 0; received < size;) {
+        size_t len = std::min<size_t>(kWriteSize, size - received);
+        // Once the image is known to be raw, it is received straight into the
+        // writer's buffers.
+        char* data = nullptr;
+        if (received && !sparse && !ret) {
+            data = writer.GetBuffer();
+        }
+        if (!data) {
+            data = buffer.data();
+        }
+        if (!device->HandleData(true, data, len)) {
+            return -EIO;
+        }
+
+        if (received == 0) {
+            if (len >= sizeof(SPARSE_HEADER_MAGIC) &&
+                *reinterpret_cast<uint32_t*>(data) == SPARSE_HEADER_MAGIC) {
+                // Reject images which don't fit before writing any of them.
+                SparseHeaderStart header = {};
+                memcpy(&header, data, std::min(len, sizeof(header)));
+                uint64_t expanded_size = static_cast<uint64_t>(header.total_blks) * header.blk_sz;
+                sparse.reset(sparse_stream_new(WriteCallback, &context));
+                if (!sparse) {
+                    ret = -ENOMEM;
+                } else if (expanded_size > block_device_size) {
+                    LOG(ERROR) << "Cannot flash sparse image of " << expanded_size
+                               << " bytes to block device of size " << block_device_size;
+                    ret = -EOVERFLOW;
+                }
+            } else if (size > block_device_size) {
+                LOG(ERROR) << "Cannot flash " << size << " bytes to block device of size "
+                           << block_device_size;
+                ret = -EOVERFLOW;
+            }
+        }
+
+        // After an error, the rest of the data is still read, so that the
+        // failure is reported once the host expects a response.
+        if (!ret) {
+            if (sparse) {
+                ret = sparse_stream_write(sparse.get(), data, len);
+            } else if (data == buffer.data()) {
+                ret = writer.Write(data, len, false);
+            } else {
+                ret = writer.Submit(len);
+            }
+        }
+        received += len;
+    }
+
+    if (!ret && sparse) {
+        ret = sparse_stream_finish(sparse.get());
+    }
+    int finish = writer.Finish();
+    if (!ret) {
+        ret = finish;
+    }
+    sync();
+    if (ret < 0) {
+        LOG(ERROR) << "Streamed flash of " << partition_name << " failed: " << strerror(-ret);
+    } else {
+        RecordFlashSpeed(device, partition_name, writer.bytes_written(),
+                         std::chrono::steady_clock::now() - start);
+    }
+    return ret;
+}
+
 static void RemoveScratchPartition() {
     AutoMountMetadata mount_metadata;
     android::fs_mgr::TeardownAllOverlayForMountPoint();
 }
 
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe) {
-    std::vector<char> data = std::move(device->download_data());
+    DownloadBuffer data = std::move(device->download_data());
     if (data.empty()) {
         return device->WriteFail("No data available");
     }
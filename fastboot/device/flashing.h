@@ -16,10 +16,13 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 
 class FastbootDevice;
 
 int Flash(FastbootDevice* device, const std::string& partition_name);
+int StreamFlash(FastbootDevice* device, const std::string& partition_name, uint32_t size);
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe);
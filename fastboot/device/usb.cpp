@@ -16,6 +16,7 @@
 
 #include "usb.h"
 #include "usb_iouring.h"
+#include "utility.h"
 
 #include <dirent.h>
 #include <errno.h>
@@ -29,7 +30,6 @@
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
-#include <sys/utsname.h>
 
 #include <algorithm>
 #include <atomic>
@@ -209,20 +209,6 @@ static void usb_ffs_close(usb_handle* h) {
     }
 }
 
-bool DoesKernelSupportIouring() {
-    struct utsname uts {};
-    unsigned int major = 0, minor = 0;
-    if ((uname(&uts) != 0) || (sscanf(uts.release, "%u.%u", &major, &minor) != 2)) {
-        return false;
-    }
-    if (major > 5) {
-        return true;
-    }
-    // We will only support kernels from 5.6 onwards as IOSQE_ASYNC flag and
-    // IO_URING_OP_READ/WRITE opcodes were introduced only on 5.6 kernel
-    return minor >= 6;
-}
-
 std::unique_ptr<usb_handle> create_usb_handle(unsigned num_bufs, unsigned io_size) {
     auto h = std::make_unique<usb_handle>();
     if (DoesKernelSupportIouring() &&
@@ -130,3 +130,6 @@ bool GetDeviceLockStatus();
 // Update all copies of metadata.
 bool UpdateAllPartitionMetadata(FastbootDevice* device, const std::string& super_name,
                                 const android::fs_mgr::LpMetadata& metadata);
+
+// io_uring reads and writes need a 5.6 or newer kernel.
+bool DoesKernelSupportIouring();
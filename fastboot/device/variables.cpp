@@ -420,6 +420,14 @@ std::vector<std::vector<std::string>> GetAllPartitionArgsWithSlot(FastbootDevice
     return args;
 }
 
+std::vector<std::vector<std::string>> GetAllFlashedPartitionArgs(FastbootDevice* device) {
+    std::vector<std::vector<std::string>> args;
+    for (const auto& [partition, speed] : device->flash_speeds()) {
+        args.emplace_back(std::initializer_list<std::string>{partition});
+    }
+    return args;
+}
+
 std::vector<std::vector<std::string>> GetAllPartitionArgsNoSlot(FastbootDevice* device) {
     auto partitions = ListPartitions(device);
 
@@ -541,6 +549,21 @@ bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string
     return true;
 }
 
+bool GetFlashSpeed(FastbootDevice* device, const std::vector<std::string>& args,
+                   std::string* message) {
+    if (args.size() < 1) {
+        *message = "Missing argument";
+        return false;
+    }
+    auto it = device->flash_speeds().find(args[0]);
+    if (it == device->flash_speeds().end()) {
+        *message = "Partition not flashed";
+        return false;
+    }
+    *message = android::base::StringPrintf("%.1f", it->second);
+    return true;
+}
+
 bool GetDmesg(FastbootDevice* device) {
     if (GetDeviceLockStatus()) {
         return device->WriteFail("Cannot use when device flashing is locked");
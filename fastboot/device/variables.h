@@ -90,6 +90,8 @@ bool GetTrebleEnabled(FastbootDevice* device, const std::vector<std::string>& ar
                       std::string* message);
 bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
                      std::string* message);
+bool GetFlashSpeed(FastbootDevice* device, const std::vector<std::string>& args,
+                   std::string* message);
 
 // Complex cases.
 bool GetDmesg(FastbootDevice* device);
@@ -97,3 +99,4 @@ bool GetDmesg(FastbootDevice* device);
 // Helpers for getvar all.
 std::vector<std::vector<std::string>> GetAllPartitionArgsWithSlot(FastbootDevice* device);
 std::vector<std::vector<std::string>> GetAllPartitionArgsNoSlot(FastbootDevice* device);
+std::vector<std::vector<std::string>> GetAllFlashedPartitionArgs(FastbootDevice* device);
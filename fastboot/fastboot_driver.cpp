@@ -36,9 +36,13 @@
 #include <string.h>
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <regex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -257,6 +261,179 @@ RetCode FastBootDriver::Download(const std::string& partition, struct sparse_fil
     return result;
 }
 
+namespace {
+
+// Hands the output of sparse_file_callback() from a producer thread to the
+// thread writing to the transport, so that building sparse chunks (reading,
+// and CRC'ing, the backing files) overlaps with the transfer itself.
+//
+// Small writes are gathered into a ring of pre-allocated buffers. Large writes,
+// which libsparse makes straight out of mmapped files or in-memory data, go to
+// the transport without a copy; the producer then waits until they have been
+// sent, since that memory is only valid for the duration of the callback.
+// Every buffer but the last one handed to the transport is a multiple of
+// TRANSPORT_CHUNK_SIZE, and none of them is empty.
+class SparseDownloadPipeline {
+  public:
+    struct Buffer {
+        const char* data;
+        size_t size;
+        // Ring slot holding the data, or -1 if it is borrowed from the producer.
+        int slot;
+    };
+
+    SparseDownloadPipeline() : storage_(kNumBuffers * kBufferSize) {
+        for (int i = 0; i < static_cast<int>(kNumBuffers); i++) {
+            free_.push_back(i);
+        }
+    }
+
+    // Producer side: the sparse_file_callback() callback. Fails once the
+    // consumer has aborted.
+    int Write(const char* data, size_t len) {
+        while (len) {
+            if (len >= kDirectSize && fill_ % kChunkSize == 0) {
+                size_t direct = len - len % kChunkSize;
+                if (!Flush() || !SendBorrowed(data, direct)) {
+                    return -1;
+                }
+                data += direct;
+                len -= direct;
+                continue;
+            }
+
+            if (slot_ < 0 && !AcquireSlot()) {
+                return -1;
+            }
+            size_t n = std::min(len, kBufferSize - fill_);
+            if (len >= kDirectSize) {
+                // Only top the buffer up to a chunk boundary, so that the
+                // rest of the write can be sent from where it is.
+                n = std::min(n, kChunkSize - fill_ % kChunkSize);
+            }
+            memcpy(SlotData(slot_) + fill_, data, n);
+            fill_ += n;
+            data += n;
+            len -= n;
+            if (fill_ == kBufferSize && !Flush()) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Producer side: called once sparse_file_callback() has returned.
+    void Finish(bool ok) {
+        if (ok) {
+            ok = Flush();
+        }
+        std::lock_guard<std::mutex> lock(lock_);
+        done_ = true;
+        ok_ = ok;
+        cv_.notify_all();
+    }
+
+    // Consumer side: waits for the next buffer to send. Returns false once
+    // the producer has finished and everything has been handed out.
+    bool Next(Buffer* buf) {
+        std::unique_lock<std::mutex> lock(lock_);
+        cv_.wait(lock, [this] { return !ready_.empty() || done_; });
+        if (ready_.empty()) {
+            return false;
+        }
+        *buf = ready_.front();
+        ready_.pop_front();
+        return true;
+    }
+
+    // Consumer side: |buf| has been sent and may be reused.
+    void Release(const Buffer& buf) {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (buf.slot >= 0) {
+            free_.push_back(buf.slot);
+        } else {
+            borrowed_ = false;
+        }
+        cv_.notify_all();
+    }
+
+    // Consumer side: stops the producer after a transport error. No buffer
+    // is touched by the consumer afterwards.
+    void Abort() {
+        std::lock_guard<std::mutex> lock(lock_);
+        aborted_ = true;
+        cv_.notify_all();
+    }
+
+    // Whether the producer generated the whole sparse file.
+    bool ok() {
+        std::lock_guard<std::mutex> lock(lock_);
+        return ok_;
+    }
+
+  private:
+    static constexpr size_t kChunkSize = FastBootDriver::TRANSPORT_CHUNK_SIZE;
+    static constexpr size_t kBufferSize = 1_MiB;
+    static constexpr size_t kNumBuffers = 4;
+    // Writes at least this large are sent without copying them.
+    static constexpr size_t kDirectSize = 64_KiB;
+    static_assert(kBufferSize % kChunkSize == 0);
+
+    char* SlotData(int slot) { return storage_.data() + slot * kBufferSize; }
+
+    bool AcquireSlot() {
+        std::unique_lock<std::mutex> lock(lock_);
+        cv_.wait(lock, [this] { return !free_.empty() || aborted_; });
+        if (aborted_) {
+            return false;
+        }
+        slot_ = free_.front();
+        free_.pop_front();
+        return true;
+    }
+
+    // Queues the partially filled buffer, if any.
+    bool Flush() {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (aborted_) {
+            return false;
+        }
+        if (fill_) {
+            ready_.push_back({SlotData(slot_), fill_, slot_});
+            cv_.notify_all();
+            slot_ = -1;
+            fill_ = 0;
+        }
+        return true;
+    }
+
+    bool SendBorrowed(const char* data, size_t len) {
+        std::unique_lock<std::mutex> lock(lock_);
+        ready_.push_back({data, len, -1});
+        borrowed_ = true;
+        cv_.notify_all();
+        cv_.wait(lock, [this] { return !borrowed_ || aborted_; });
+        return !aborted_;
+    }
+
+    std::vector<char> storage_;
+
+    // Only used by the producer.
+    int slot_ = -1;
+    size_t fill_ = 0;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::deque<int> free_;
+    std::deque<Buffer> ready_;
+    bool borrowed_ = false;
+    bool aborted_ = false;
+    bool done_ = false;
+    bool ok_ = false;
+};
+
+}  // namespace
+
 RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* response,
                                  std::vector<std::string>* info) {
     error_ = "";
@@ -272,27 +449,33 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
         return ret;
     }
 
-    struct SparseCBPrivate {
-        FastBootDriver* self;
-        std::vector<char> tpbuf;
-    } cb_priv;
-    cb_priv.self = this;
-
-    auto cb = [](void* priv, const void* buf, size_t len) -> int {
-        SparseCBPrivate* data = static_cast<SparseCBPrivate*>(priv);
-        const char* cbuf = static_cast<const char*>(buf);
-        return data->self->SparseWriteCallback(data->tpbuf, cbuf, len);
-    };
+    SparseDownloadPipeline pipeline;
+    std::thread producer([s, use_crc, &pipeline] {
+        auto cb = [](void* priv, const void* buf, size_t len) -> int {
+            return static_cast<SparseDownloadPipeline*>(priv)->Write(static_cast<const char*>(buf),
+                                                                      len);
+        };
+        pipeline.Finish(sparse_file_callback(s, true, use_crc, cb, &pipeline) >= 0);
+    });
 
-    if (sparse_file_callback(s, true, use_crc, cb, &cb_priv) < 0) {
-        error_ = "Error reading sparse file";
-        return IO_ERROR;
+    SparseDownloadPipeline::Buffer buf;
+    while (pipeline.Next(&buf)) {
+        ret = SendBuffer(buf.data, buf.size);
+        pipeline.Release(buf);
+        if (ret) {
+            pipeline.Abort();
+            break;
+        }
     }
+    producer.join();
 
-    // Now flush
-    if (cb_priv.tpbuf.size() && (ret = SendBuffer(cb_priv.tpbuf))) {
+    if (ret) {
         return ret;
     }
+    if (!pipeline.ok()) {
+        error_ = "Error reading sparse file";
+        return IO_ERROR;
+    }
 
     return HandleResponse(response, info);
 }
@@ -595,39 +778,6 @@ RetCode FastBootDriver::ReadBuffer(void* buf, size_t size) {
     return SUCCESS;
 }
 
-int FastBootDriver::SparseWriteCallback(std::vector<char>& tpbuf, const char* data, size_t len) {
-    size_t total = 0;
-    size_t to_write = std::min(TRANSPORT_CHUNK_SIZE - tpbuf.size(), len);
-
-    // Handle the residual
-    tpbuf.insert(tpbuf.end(), data, data + to_write);
-    if (tpbuf.size() < TRANSPORT_CHUNK_SIZE) {  // Nothing enough to send rn
-        return 0;
-    }
-
-    if (SendBuffer(tpbuf)) {
-        error_ = ErrnoStr("Send failed in SparseWriteCallback()");
-        return -1;
-    }
-    tpbuf.clear();
-    total += to_write;
-
-    // Now we need to send a multiple of chunk size
-    size_t nchunks = (len - total) / TRANSPORT_CHUNK_SIZE;
-    size_t nbytes = TRANSPORT_CHUNK_SIZE * nchunks;
-    if (nbytes && SendBuffer(data + total, nbytes)) {  // Don't send a ZLP
-        error_ = ErrnoStr("Send failed in SparseWriteCallback()");
-        return -1;
-    }
-    total += nbytes;
-
-    if (len - total > 0) {  // We have residual data to save for next time
-        tpbuf.assign(data + total, data + len);
-    }
-
-    return 0;
-}
-
 void FastBootDriver::set_transport(std::unique_ptr<Transport> transport) {
     transport_ = std::move(transport);
 }
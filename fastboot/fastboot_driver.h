@@ -154,8 +154,6 @@ class FastBootDriver : public IFastBootDriver {
                              std::vector<std::string>* info,
                              const std::function<RetCode(const char*, uint64_t)>& write_fn);
 
-    int SparseWriteCallback(std::vector<char>& tpbuf, const char* data, size_t len);
-
     std::string error_;
     std::function<void(const std::string&)> prolog_;
     std::function<void(int)> epilog_;
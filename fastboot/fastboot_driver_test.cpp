@@ -18,8 +18,12 @@
 
 #include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
+#include <android-base/stringprintf.h>
 #include <gtest/gtest.h>
+#include <sparse/sparse.h>
 #include "mock_transport.h"
 
 using namespace ::testing;
@@ -97,3 +101,55 @@ TEST_F(DriverTest, TextMessage) {
               " Indeed we can do that now with a TEXT message whenever we feel like it."
               " Isn't that truly super cool?");
 }
+
+TEST_F(DriverTest, SparseDownload) {
+    std::unique_ptr<MockTransport> transport_pointer = std::make_unique<MockTransport>();
+    MockTransport* transport = transport_pointer.get();
+    FastBootDriver driver(std::move(transport_pointer));
+
+    // Mix large data chunks, which are sent in place, with small writes that
+    // leave the stream off a transport chunk boundary.
+    constexpr unsigned int kBlockSize = 4096;
+    std::vector<char> data(3 * 1024 * 1024 + 3 * kBlockSize);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 7 + i / 4093);
+    }
+    unsigned int blocks = data.size() / kBlockSize;
+    std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)> s(
+            sparse_file_new(kBlockSize, 4 * data.size()), sparse_file_destroy);
+    ASSERT_NE(s, nullptr);
+    ASSERT_EQ(sparse_file_add_data(s.get(), data.data(), kBlockSize, 0), 0);
+    ASSERT_EQ(sparse_file_add_fill(s.get(), 0xcafed00d, kBlockSize, 1), 0);
+    ASSERT_EQ(sparse_file_add_data(s.get(), data.data(), data.size(), 2), 0);
+    ASSERT_EQ(sparse_file_add_data(s.get(), data.data(), kBlockSize, 3 * blocks), 0);
+
+    std::string expected;
+    auto append = [](void* priv, const void* buf, size_t len) -> int {
+        static_cast<std::string*>(priv)->append(static_cast<const char*>(buf), len);
+        return 0;
+    };
+    ASSERT_EQ(sparse_file_callback(s.get(), true, false, append, &expected), 0);
+
+    std::string command = android::base::StringPrintf("download:%08zx", expected.size());
+    std::string reply = android::base::StringPrintf("DATA%08zx", expected.size());
+    std::string received;
+    size_t unaligned_writes = 0;
+    EXPECT_CALL(*transport, Write(_, _))
+            .With(AllArgs(RawData(command.c_str())))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(*transport, Read(_, _)).WillOnce(Invoke(CopyData(reply.c_str())));
+    EXPECT_CALL(*transport, Write(_, _))
+            .WillRepeatedly(Invoke([&](const void* buf, size_t len) -> ssize_t {
+                if (len % FastBootDriver::TRANSPORT_CHUNK_SIZE) {
+                    unaligned_writes++;
+                }
+                received.append(static_cast<const char*>(buf), len);
+                return len;
+            }));
+    EXPECT_CALL(*transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY")));
+
+    ASSERT_EQ(driver.Download(s.get(), false), SUCCESS) << driver.Error();
+    ASSERT_EQ(received, expected);
+    // Only the final write may be a partial transport chunk.
+    ASSERT_LE(unaligned_writes, size_t(1));
+}
@@ -111,6 +111,8 @@ class ICowOpIter {
     virtual void Prev() = 0;
 };
 
+class IDecompressor;
+
 class CowReader final : public ICowReader {
   public:
     enum class ReaderFlags {
@@ -119,7 +121,7 @@ class CowReader final : public ICowReader {
     };
 
     CowReader(ReaderFlags reader_flag = ReaderFlags::DEFAULT, bool is_merge = false);
-    ~CowReader() { owned_fd_ = {}; }
+    ~CowReader();
 
     // Parse the COW, optionally, up to the given label. If no label is
     // specified, the COW must have an intact footer.
@@ -168,6 +170,13 @@ class CowReader final : public ICowReader {
 
     void UpdateMergeOpsCompleted(int num_merge_ops) { header_.num_merge_ops += num_merge_ops; }
 
+    // By default, a single decompressor (and its context and scratch
+    // buffers) is kept for the lifetime of the reader and reused by every
+    // ReadData() call. Disabling the cache creates a fresh decompressor per
+    // operation. Clones always start with an empty cache of their own, so
+    // each worker thread owning a clone gets a private decompressor.
+    void set_decompressor_cache(bool enabled) { cache_decompressor_ = enabled; }
+
   private:
     bool ParseV2(android::base::borrowed_fd fd, std::optional<uint64_t> label);
     bool PrepMergeOps();
@@ -179,6 +188,7 @@ class CowReader final : public ICowReader {
                          std::unordered_map<uint32_t, int>* block_map);
     uint64_t FindNumCopyops();
     uint8_t GetCompressionType();
+    IDecompressor* GetDecompressor();
 
     android::base::unique_fd owned_fd_;
     android::base::borrowed_fd fd_;
@@ -195,6 +205,8 @@ class CowReader final : public ICowReader {
     std::shared_ptr<std::unordered_map<uint64_t, uint64_t>> xor_data_loc_;
     ReaderFlags reader_flag_;
     bool is_merge_{};
+    std::unique_ptr<IDecompressor> decompressor_;
+    bool cache_decompressor_ = true;
 };
 
 // Though this function takes in a CowHeaderV3, the struct could be populated as a v1/v2 CowHeader.
@@ -19,6 +19,7 @@
 #include <array>
 #include <cstring>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -97,6 +98,7 @@ ssize_t StreamDecompressor::Decompress(void* buffer, size_t buffer_size, size_t,
     }
 
     stream_remaining_ = stream_->Size();
+    decompressor_ended_ = false;
     output_buffer_ = reinterpret_cast<uint8_t*>(buffer);
     output_buffer_remaining_ = buffer_size;
     ignore_bytes_ = ignore_bytes;
@@ -146,18 +148,31 @@ class GzDecompressor final : public StreamDecompressor {
 
   private:
     z_stream z_ = {};
+    bool initialized_ = false;
 };
 
 bool GzDecompressor::Init() {
+    // Keep the inflate state (and its 32K window) across streams; resetting
+    // it is much cheaper than a full inflateInit()/inflateEnd() cycle.
+    if (initialized_) {
+        if (int rv = inflateReset(&z_); rv != Z_OK) {
+            LOG(ERROR) << "inflateReset returned error code " << rv;
+            return false;
+        }
+        return true;
+    }
     if (int rv = inflateInit(&z_); rv != Z_OK) {
         LOG(ERROR) << "inflateInit returned error code " << rv;
         return false;
     }
+    initialized_ = true;
     return true;
 }
 
 GzDecompressor::~GzDecompressor() {
-    inflateEnd(&z_);
+    if (initialized_) {
+        inflateEnd(&z_);
+    }
 }
 
 bool GzDecompressor::PartialDecompress(const uint8_t* data, size_t length) {
@@ -226,7 +241,16 @@ class BrotliDecompressor final : public StreamDecompressor {
 };
 
 bool BrotliDecompressor::Init() {
+    // Brotli has no API to reset a decoder, so a finished instance has to be
+    // replaced when the decompressor is reused.
+    if (decoder_) {
+        BrotliDecoderDestroyInstance(decoder_);
+    }
     decoder_ = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!decoder_) {
+        LOG(ERROR) << "BrotliDecoderCreateInstance failed";
+        return false;
+    }
     return true;
 }
 
@@ -280,8 +304,8 @@ class Lz4Decompressor final : public IDecompressor {
 
     ssize_t Decompress(void* buffer, size_t buffer_size, size_t decompressed_size,
                        size_t ignore_bytes) override {
-        std::string input_buffer(stream_->Size(), '\0');
-        ssize_t streamed_in = stream_->ReadFully(input_buffer.data(), input_buffer.size());
+        input_buffer_.resize(stream_->Size());
+        ssize_t streamed_in = stream_->ReadFully(input_buffer_.data(), input_buffer_.size());
         if (streamed_in < 0) {
             return -1;
         }
@@ -291,16 +315,17 @@ class Lz4Decompressor final : public IDecompressor {
         size_t decode_buffer_size = buffer_size;
 
         // It's unclear if LZ4 can exactly satisfy a partial decode request, so
-        // if we get one, create a temporary buffer.
-        std::string temp;
-        if (buffer_size < decompressed_size) {
-            temp.resize(decompressed_size, '\0');
-            decode_buffer = temp.data();
-            decode_buffer_size = temp.size();
+        // if we get one, decode into the scratch buffer.
+        const bool use_temp = buffer_size < decompressed_size;
+        if (use_temp) {
+            temp_.resize(decompressed_size);
+            decode_buffer = temp_.data();
+            decode_buffer_size = temp_.size();
         }
 
-        const int bytes_decompressed = LZ4_decompress_safe(input_buffer.data(), decode_buffer,
-                                                           input_buffer.size(), decode_buffer_size);
+        const int bytes_decompressed =
+                LZ4_decompress_safe(input_buffer_.data(), decode_buffer, input_buffer_.size(),
+                                    decode_buffer_size);
         if (bytes_decompressed < 0) {
             LOG(ERROR) << "Failed to decompress LZ4 block, code: " << bytes_decompressed;
             return -1;
@@ -318,7 +343,7 @@ class Lz4Decompressor final : public IDecompressor {
             return -1;
         }
 
-        if (temp.empty()) {
+        if (!use_temp) {
             // LZ4's API has no way to sink out the first N bytes of decoding,
             // so we read them all in and memmove() to drop the partial read.
             if (ignore_bytes) {
@@ -329,13 +354,21 @@ class Lz4Decompressor final : public IDecompressor {
         }
 
         size_t max_copy = std::min(bytes_decompressed - ignore_bytes, buffer_size);
-        memcpy(buffer, temp.data() + ignore_bytes, max_copy);
+        memcpy(buffer, temp_.data() + ignore_bytes, max_copy);
         return max_copy;
     }
+
+  private:
+    // Scratch buffers, kept across calls so that a reused decompressor does
+    // not allocate per operation.
+    std::string input_buffer_;
+    std::string temp_;
 };
 
 class ZstdDecompressor final : public IDecompressor {
   public:
+    ~ZstdDecompressor() override { ZSTD_freeDCtx(dctx_); }
+
     ssize_t Decompress(void* buffer, size_t buffer_size, size_t decompressed_size,
                        size_t ignore_bytes = 0) override {
         if (buffer_size < decompressed_size - ignore_bytes) {
@@ -350,24 +383,30 @@ class ZstdDecompressor final : public IDecompressor {
             }
             return decompressed_size;
         }
-        std::vector<unsigned char> ignore_buf(decompressed_size);
-        if (!Decompress(ignore_buf.data(), decompressed_size)) {
+        ignore_buf_.resize(decompressed_size);
+        if (!Decompress(ignore_buf_.data(), decompressed_size)) {
             return -1;
         }
-        memcpy(buffer, ignore_buf.data() + ignore_bytes, buffer_size);
+        memcpy(buffer, ignore_buf_.data() + ignore_bytes, buffer_size);
         return decompressed_size;
     }
     bool Decompress(void* output_buffer, const size_t output_size) {
-        std::string input_buffer;
-        input_buffer.resize(stream_->Size());
-        size_t bytes_read = stream_->Read(input_buffer.data(), input_buffer.size());
-        if (bytes_read != input_buffer.size()) {
-            LOG(ERROR) << "Failed to read all input at once. Expected: " << input_buffer.size()
+        if (!dctx_) {
+            dctx_ = ZSTD_createDCtx();
+            if (!dctx_) {
+                LOG(ERROR) << "ZSTD_createDCtx failed";
+                return false;
+            }
+        }
+        input_buffer_.resize(stream_->Size());
+        size_t bytes_read = stream_->Read(input_buffer_.data(), input_buffer_.size());
+        if (bytes_read != input_buffer_.size()) {
+            LOG(ERROR) << "Failed to read all input at once. Expected: " << input_buffer_.size()
                        << " actual: " << bytes_read;
             return false;
         }
-        const auto bytes_decompressed = ZSTD_decompress(output_buffer, output_size,
-                                                        input_buffer.data(), input_buffer.size());
+        const auto bytes_decompressed = ZSTD_decompressDCtx(
+                dctx_, output_buffer, output_size, input_buffer_.data(), input_buffer_.size());
         if (bytes_decompressed != output_size) {
             LOG(ERROR) << "Failed to decompress ZSTD block, expected output size: " << output_size
                        << ", actual: " << bytes_decompressed;
@@ -375,6 +414,13 @@ class ZstdDecompressor final : public IDecompressor {
         }
         return true;
     }
+
+  private:
+    // The decompression context and scratch buffers live as long as the
+    // decompressor, so that repeated calls do not allocate.
+    ZSTD_DCtx* dctx_ = nullptr;
+    std::string input_buffer_;
+    std::vector<unsigned char> ignore_buf_;
 };
 
 std::unique_ptr<IDecompressor> IDecompressor::Brotli() {
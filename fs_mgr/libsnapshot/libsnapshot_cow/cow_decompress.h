@@ -58,6 +58,10 @@ class IDecompressor {
     //
     // Returns the number of bytes written to |buffer|, or -1 on error. errno
     // is NOT set.
+    //
+    // A decompressor may be reused for any number of streams; contexts and
+    // scratch buffers are kept across calls. set_stream() must be called
+    // before each call.
     virtual ssize_t Decompress(void* buffer, size_t buffer_size, size_t decompressed_size,
                                size_t ignore_bytes = 0) = 0;
 
@@ -75,6 +75,10 @@ CowReader::CowReader(ReaderFlags reader_flag, bool is_merge)
       reader_flag_(reader_flag),
       is_merge_(is_merge) {}
 
+CowReader::~CowReader() {
+    owned_fd_ = {};
+}
+
 std::unique_ptr<CowReader> CowReader::CloneCowReader() {
     auto cow = std::make_unique<CowReader>();
     cow->owned_fd_.reset();
@@ -89,6 +93,7 @@ std::unique_ptr<CowReader> CowReader::CloneCowReader() {
     cow->xor_data_loc_ = xor_data_loc_;
     cow->block_pos_index_ = block_pos_index_;
     cow->is_merge_ = is_merge_;
+    cow->cache_decompressor_ = cache_decompressor_;
     return cow;
 }
 
@@ -129,6 +134,7 @@ bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> lab
     if (!ReadCowHeader(fd, &header_)) {
         return false;
     }
+    decompressor_ = nullptr;
 
     std::unique_ptr<CowParserBase> parser;
     switch (header_.prefix.major_version) {
@@ -720,9 +726,33 @@ uint8_t CowReader::GetCompressionType() {
     return header_.compression_algorithm;
 }
 
+IDecompressor* CowReader::GetDecompressor() {
+    if (decompressor_ && cache_decompressor_) {
+        return decompressor_.get();
+    }
+    switch (GetCompressionType()) {
+        case kCowCompressGz:
+            decompressor_ = IDecompressor::Gz();
+            break;
+        case kCowCompressBrotli:
+            decompressor_ = IDecompressor::Brotli();
+            break;
+        case kCowCompressZstd:
+            decompressor_ = IDecompressor::Zstd();
+            break;
+        case kCowCompressLz4:
+            decompressor_ = IDecompressor::Lz4();
+            break;
+        default:
+            decompressor_ = nullptr;
+            break;
+    }
+    return decompressor_.get();
+}
+
 ssize_t CowReader::ReadData(const CowOperation* op, void* buffer, size_t buffer_size,
                             size_t ignore_bytes) {
-    std::unique_ptr<IDecompressor> decompressor;
+    bool compressed = false;
     const size_t op_buf_size = CowOpCompressionSize(op, header_.block_size);
     if (!op_buf_size) {
         LOG(ERROR) << "Compression size is zero. op: " << *op;
@@ -732,20 +762,12 @@ ssize_t CowReader::ReadData(const CowOperation* op, void* buffer, size_t buffer_
         case kCowCompressNone:
             break;
         case kCowCompressGz:
-            decompressor = IDecompressor::Gz();
-            break;
         case kCowCompressBrotli:
-            decompressor = IDecompressor::Brotli();
+            compressed = true;
             break;
         case kCowCompressZstd:
-            if (op_buf_size != op->data_length) {
-                decompressor = IDecompressor::Zstd();
-            }
-            break;
         case kCowCompressLz4:
-            if (op_buf_size != op->data_length) {
-                decompressor = IDecompressor::Lz4();
-            }
+            compressed = (op_buf_size != op->data_length);
             break;
         default:
             LOG(ERROR) << "Unknown compression type: " << GetCompressionType();
@@ -758,12 +780,17 @@ ssize_t CowReader::ReadData(const CowOperation* op, void* buffer, size_t buffer_
     } else {
         offset = op->source();
     }
-    if (!decompressor ||
-        ((op->data_length == op_buf_size) && (header_.prefix.major_version == 3))) {
+    if (!compressed || ((op->data_length == op_buf_size) && (header_.prefix.major_version == 3))) {
         CowDataStream stream(this, offset + ignore_bytes, op->data_length - ignore_bytes);
         return stream.ReadFully(buffer, buffer_size);
     }
 
+    IDecompressor* decompressor = GetDecompressor();
+    if (!decompressor) {
+        LOG(ERROR) << "Failed to create decompressor for type: " << GetCompressionType();
+        return -1;
+    }
+
     CowDataStream stream(this, offset, op->data_length);
     decompressor->set_stream(&stream);
     return decompressor->Decompress(buffer, buffer_size, op_buf_size, ignore_bytes);
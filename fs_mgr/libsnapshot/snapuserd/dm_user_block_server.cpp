@@ -14,6 +14,10 @@
 
 #include <snapuserd/dm_user_block_server.h>
 
+#include <limits.h>
+
+#include <algorithm>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <snapuserd/snapuserd_kernel.h>
@@ -63,7 +67,7 @@ bool DmUserBlockServer::ProcessRequest(dm_user_header* header) {
     header_response_ = true;
 
     // Reset the output buffer.
-    buffer_.ResetBufferOffset();
+    ResetResponse();
 
     switch (request_type) {
         case DM_USER_REQ_MAP_READ:
@@ -85,7 +89,31 @@ void* DmUserBlockServer::GetResponseBuffer(size_t size, size_t to_write) {
     return buffer_.AcquireBuffer(size, to_write);
 }
 
+bool DmUserBlockServer::AddResponseData(const void* data, size_t size) {
+    EndBufferedSegment();
+    iov_.push_back({const_cast<void*>(data), size});
+    return true;
+}
+
+void DmUserBlockServer::EndBufferedSegment() {
+    size_t end = buffer_.GetPayloadBytesWritten();
+    if (end > segment_start_) {
+        void* start = reinterpret_cast<uint8_t*>(buffer_.GetPayloadBufPtr()) + segment_start_;
+        iov_.push_back({start, end - segment_start_});
+        segment_start_ = end;
+    }
+}
+
+void DmUserBlockServer::ResetResponse() {
+    buffer_.ResetBufferOffset();
+    iov_.clear();
+    segment_start_ = 0;
+}
+
 bool DmUserBlockServer::SendBufferedIo() {
+    if (!iov_.empty()) {
+        return WriteDmUserPayloadVectored();
+    }
     return WriteDmUserPayload(buffer_.GetPayloadBytesWritten());
 }
 
@@ -103,6 +131,7 @@ void DmUserBlockServer::SendError() {
     // TODO: Fix the interface
     CHECK(header_response_);
 
+    ResetResponse();
     WriteDmUserPayload(0);
 }
 
@@ -124,7 +153,50 @@ bool DmUserBlockServer::WriteDmUserPayload(size_t size) {
     header_response_ = false;
 
     // Reset the buffer for use by the next request.
-    buffer_.ResetBufferOffset();
+    ResetResponse();
+    return true;
+}
+
+// Same as WriteDmUserPayload, but gathers the payload from the response
+// buffer and caller-owned data in a single writev, avoiding a copy of the
+// latter into the response buffer.
+bool DmUserBlockServer::WriteDmUserPayloadVectored() {
+    EndBufferedSegment();
+
+    std::vector<struct iovec> iov;
+    iov.reserve(iov_.size() + 1);
+    if (header_response_) {
+        iov.push_back({buffer_.GetBufPtr(), sizeof(struct dm_user_header)});
+    }
+    iov.insert(iov.end(), iov_.begin(), iov_.end());
+
+    size_t index = 0;
+    while (index < iov.size()) {
+        int count = std::min(iov.size() - index, static_cast<size_t>(IOV_MAX));
+        ssize_t rv = TEMP_FAILURE_RETRY(writev(ctrl_fd_.get(), &iov[index], count));
+        if (rv <= 0) {
+            SNAP_PLOG(ERROR) << "Write to dm-user failed, segments: " << iov.size();
+            return false;
+        }
+
+        // Skip past whatever was written, which may end mid-segment.
+        size_t written = rv;
+        while (index < iov.size() && written >= iov[index].iov_len) {
+            written -= iov[index].iov_len;
+            index++;
+        }
+        if (written) {
+            iov[index].iov_base = reinterpret_cast<uint8_t*>(iov[index].iov_base) + written;
+            iov[index].iov_len -= written;
+        }
+    }
+
+    // After the first header is sent in response to a request, we cannot
+    // send any additional headers.
+    header_response_ = false;
+
+    // Reset the buffer for use by the next request.
+    ResetResponse();
     return true;
 }
 
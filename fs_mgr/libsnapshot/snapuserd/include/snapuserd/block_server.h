@@ -16,6 +16,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <memory>
 
@@ -62,6 +63,22 @@ class IBlockServer {
     // control from RequestSectors.
     virtual void* GetResponseBuffer(size_t size, size_t to_write) = 0;
 
+    // Queue |size| bytes at |data| as the next part of the response, after
+    // any buffer previously returned by GetResponseBuffer. Block servers
+    // which support scatter/gather I/O send |data| in place rather than
+    // copying it, so it must stay valid and unchanged until SendBufferedIo
+    // returns. This cannot be called outside of RequestSectors().
+    //
+    // The default implementation copies |data| into a response buffer.
+    virtual bool AddResponseData(const void* data, size_t size) {
+        void* buffer = GetResponseBuffer(size, size);
+        if (!buffer) {
+            return false;
+        }
+        memcpy(buffer, data, size);
+        return true;
+    }
+
     // Send all outstanding buffers to the driver, in order. This should
     // be called at least once in response to RequestSectors. This returns
     // ownership of any buffers returned by GetResponseBuffer.
@@ -15,8 +15,10 @@
 #pragma once
 
 #include <android-base/unique_fd.h>
+#include <sys/uio.h>
 
 #include <string>
+#include <vector>
 
 #include <snapuserd/block_server.h>
 #include <snapuserd/snapuserd_buffer.h>
@@ -31,12 +33,16 @@ class DmUserBlockServer : public IBlockServer {
 
     bool ProcessRequests() override;
     void* GetResponseBuffer(size_t size, size_t to_write) override;
+    bool AddResponseData(const void* data, size_t size) override;
     bool SendBufferedIo() override;
     void SendError();
 
   private:
     bool ProcessRequest(dm_user_header* header);
     bool WriteDmUserPayload(size_t size);
+    bool WriteDmUserPayloadVectored();
+    void EndBufferedSegment();
+    void ResetResponse();
 
     std::string misc_name_;
     android::base::unique_fd ctrl_fd_;
@@ -45,6 +51,11 @@ class DmUserBlockServer : public IBlockServer {
     // Per-request state.
     BufferSink buffer_;
     bool header_response_ = false;
+    // Response segments in send order, when AddResponseData was used: runs
+    // of |buffer_| interleaved with caller-owned data.
+    std::vector<struct iovec> iov_;
+    // Start of the run of |buffer_| not yet recorded in |iov_|.
+    size_t segment_start_ = 0;
 };
 
 class DmUserBlockServerOpener : public IBlockServerOpener {
@@ -17,6 +17,8 @@
 #include <libsnapshot/cow_format.h>
 #include <pthread.h>
 
+#include <android-base/scopeguard.h>
+
 #include "read_worker.h"
 #include "snapuserd_core.h"
 #include "utility.h"
@@ -29,6 +31,7 @@ using namespace android::dm;
 using android::base::unique_fd;
 
 void ReadWorker::CloseFds() {
+    FinalizeIouring();
     block_server_ = {};
     backing_store_fd_ = {};
     backing_store_direct_fd_ = {};
@@ -43,13 +46,19 @@ ReadWorker::ReadWorker(const std::string& cow_device, const std::string& backing
       backing_store_device_(backing_device),
       direct_read_(direct_read),
       block_server_opener_(opener),
-      aligned_buffer_(std::unique_ptr<void, decltype(&::free)>(nullptr, &::free)) {}
+      aligned_buffer_(std::unique_ptr<void, decltype(&::free)>(nullptr, &::free)),
+      direct_data_(std::unique_ptr<void, decltype(&::free)>(nullptr, &::free)) {}
 
 // Start the replace operation. This will read the
 // internal COW format and if the block is compressed,
 // it will be de-compressed.
 bool ReadWorker::ProcessReplaceOp(const CowOperation* cow_op, void* buffer, size_t buffer_size) {
-    if (!reader_->ReadData(cow_op, buffer, buffer_size)) {
+    // Let the queued device reads make progress while this op is read and
+    // decompressed. Failures are handled when the batch is completed.
+    if (batch_io_) {
+        SubmitPendingIos();
+    }
+    if (reader_->ReadData(cow_op, buffer, buffer_size) < 0) {
         SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block
                         << " buffer_size: " << buffer_size;
         return false;
@@ -57,6 +66,22 @@ bool ReadWorker::ProcessReplaceOp(const CowOperation* cow_op, void* buffer, size
     return true;
 }
 
+const uint8_t* ReadWorker::GetDecompressedOp(const CowOperation* cow_op, size_t size) {
+    DecompressedOpCache* cache = snapuserd_->GetDecompressedOpCache();
+    if (!cache) {
+        if (!ProcessReplaceOp(cow_op, decompressed_buffer_.get(), size)) {
+            return nullptr;
+        }
+        return decompressed_buffer_.get();
+    }
+
+    // Keep a reference so the data stays valid even if the cache evicts it.
+    cached_op_ = cache->Get(cow_op, size, [&](void* buffer, size_t buffer_size) -> bool {
+        return ProcessReplaceOp(cow_op, buffer, buffer_size);
+    });
+    return cached_op_ ? cached_op_->data() : nullptr;
+}
+
 bool ReadWorker::ReadFromSourceDevice(const CowOperation* cow_op, void* buffer) {
     uint64_t offset;
     if (!reader_->GetSourceOffset(cow_op, &offset)) {
@@ -94,6 +119,10 @@ bool ReadWorker::ReadFromSourceDevice(const CowOperation* cow_op, void* buffer)
 // Start the copy operation. This will read the backing
 // block device which is represented by cow_op->source.
 bool ReadWorker::ProcessCopyOp(const CowOperation* cow_op, void* buffer) {
+    if (batch_io_) {
+        return QueueSourceRead(cow_op, buffer, false);
+    }
+
     if (!ReadFromSourceDevice(cow_op, buffer)) {
         return false;
     }
@@ -101,6 +130,10 @@ bool ReadWorker::ProcessCopyOp(const CowOperation* cow_op, void* buffer) {
 }
 
 bool ReadWorker::ProcessXorOp(const CowOperation* cow_op, void* buffer) {
+    if (batch_io_) {
+        return QueueSourceRead(cow_op, buffer, false);
+    }
+
     if (!ReadFromSourceDevice(cow_op, buffer)) {
         return false;
     }
@@ -147,6 +180,11 @@ bool ReadWorker::ProcessOrderedOp(const CowOperation* cow_op, void* buffer) {
             return true;
         }
         case MERGE_GROUP_STATE::GROUP_MERGE_PENDING: {
+            if (batch_io_) {
+                // The ref-count is released once the queued read completes.
+                return QueueSourceRead(cow_op, buffer, true);
+            }
+
             bool ret;
             if (cow_op->type() == kCowCopyOp) {
                 ret = ProcessCopyOp(cow_op, buffer);
@@ -185,11 +223,14 @@ bool ReadWorker::ProcessCowOp(const CowOperation* cow_op, void* buffer) {
     switch (cow_op->type()) {
         case kCowReplaceOp: {
             size_t buffer_size = CowOpCompressionSize(cow_op, BLOCK_SZ);
-            uint8_t chunk[buffer_size];
-            if (!ProcessReplaceOp(cow_op, chunk, buffer_size)) {
+            if (buffer_size == BLOCK_SZ) {
+                return ProcessReplaceOp(cow_op, buffer, BLOCK_SZ);
+            }
+            const uint8_t* data = GetDecompressedOp(cow_op, buffer_size);
+            if (!data) {
                 return false;
             }
-            std::memcpy(buffer, chunk, BLOCK_SZ);
+            std::memcpy(buffer, data, BLOCK_SZ);
             return true;
         }
 
@@ -252,9 +293,252 @@ bool ReadWorker::Init() {
         SNAP_PLOG(ERROR) << "Unable to open block server";
         return false;
     }
+
+    InitializeIouring();
+    return true;
+}
+
+bool ReadWorker::InitializeIouring() {
+    if (!snapuserd_->IsIouringSupported()) {
+        return false;
+    }
+
+    ring_ = std::make_unique<struct io_uring>();
+
+    int ret = io_uring_queue_init(queue_depth_, ring_.get(), 0);
+    if (ret) {
+        SNAP_LOG(ERROR) << "io_uring_queue_init failed with ret: " << ret;
+        ring_ = nullptr;
+        return false;
+    }
+
+    pending_ios_.reserve(queue_depth_);
+    xor_data_.resize(queue_depth_ * BLOCK_SZ);
+    if (direct_read_) {
+        void* aligned_addr;
+        if (posix_memalign(&aligned_addr, getpagesize(), queue_depth_ * BLOCK_SZ) != 0) {
+            SNAP_LOG(ERROR) << "posix_memalign failed for O_DIRECT queue buffers";
+        } else {
+            direct_data_.reset(aligned_addr);
+        }
+    }
+    read_async_ = true;
+
+    SNAP_LOG(INFO) << "ReadWorker: io_uring initialized with queue depth: " << queue_depth_;
+    return true;
+}
+
+void ReadWorker::FinalizeIouring() {
+    if (read_async_) {
+        io_uring_queue_exit(ring_.get());
+        ring_ = nullptr;
+        read_async_ = false;
+    }
+}
+
+bool ReadWorker::QueueSourceRead(const CowOperation* cow_op, void* buffer,
+                                 bool notify_completion) {
+    uint64_t offset;
+    if (!reader_->GetSourceOffset(cow_op, &offset)) {
+        SNAP_LOG(ERROR) << "QueueSourceRead: Failed to get source offset";
+        if (notify_completion) {
+            snapuserd_->NotifyIOCompletion(cow_op->new_block);
+        }
+        return false;
+    }
+
+    const CowOperation* xor_op = (cow_op->type() == kCowXorOp) ? cow_op : nullptr;
+
+    // Same policy as ReadFromSourceDevice(): aligned blocks are read through
+    // the O_DIRECT fd, into an aligned queue slot.
+    if (direct_read_ && direct_data_ && IsBlockAligned(offset)) {
+        return QueueRead(backing_store_direct_fd_.get(), buffer, BLOCK_SZ, offset, xor_op,
+                         notify_completion, cow_op->new_block, true);
+    }
+    return QueueRead(backing_store_fd_.get(), buffer, BLOCK_SZ, offset, xor_op,
+                     notify_completion, cow_op->new_block);
+}
+
+bool ReadWorker::QueueRead(int fd, void* buffer, size_t size, off_t offset,
+                           const CowOperation* xor_op, bool notify_completion, uint64_t new_block,
+                           bool direct) {
+    // Plain reads which are contiguous both on disk and in the response
+    // buffer are merged into a single I/O, as long as it has not been handed
+    // to the ring yet.
+    if (!xor_op && !notify_completion && !direct && pending_ios_prepared_ < pending_ios_.size()) {
+        PendingIo& last = pending_ios_.back();
+        if (!last.xor_op && !last.notify_completion && !last.direct && last.fd == fd &&
+            last.offset + static_cast<off_t>(last.size) == offset &&
+            reinterpret_cast<uint8_t*>(last.buffer) + last.size == buffer) {
+            last.size += size;
+            return true;
+        }
+    }
+
+    if (pending_ios_.size() == queue_depth_ && !CompletePendingIos()) {
+        if (notify_completion) {
+            snapuserd_->NotifyIOCompletion(new_block);
+        }
+        return false;
+    }
+
+    // CompletePendingIos() may have fallen back to synchronous I/O.
+    if (!batch_io_) {
+        void* target = direct ? aligned_buffer_.get() : buffer;
+        bool ret = android::base::ReadFullyAtOffset(fd, target, size, offset);
+        if (!ret) {
+            SNAP_PLOG(ERROR) << "Read failed at offset: " << offset << " size: " << size;
+        } else if (direct) {
+            std::memcpy(buffer, target, size);
+        }
+        if (ret && xor_op) {
+            xor_buffer_.resize(BLOCK_SZ);
+            ssize_t xor_size = reader_->ReadData(xor_op, xor_buffer_.data(), BLOCK_SZ);
+            ret = (xor_size == BLOCK_SZ);
+            auto xor_out = reinterpret_cast<uint8_t*>(buffer);
+            for (size_t i = 0; ret && i < BLOCK_SZ; i++) {
+                xor_out[i] ^= xor_buffer_[i];
+            }
+        }
+        if (notify_completion) {
+            snapuserd_->NotifyIOCompletion(new_block);
+        }
+        return ret;
+    }
+
+    pending_ios_.push_back({fd, buffer, size, offset, xor_op, notify_completion, new_block, direct,
+                            /*bytes_read=*/0});
     return true;
 }
 
+bool ReadWorker::SubmitPendingIos() {
+    while (pending_ios_prepared_ < pending_ios_.size()) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+        if (!sqe) {
+            SNAP_LOG(ERROR) << "io_uring_get_sqe failed in ReadWorker";
+            return false;
+        }
+        const PendingIo& io = pending_ios_[pending_ios_prepared_];
+        void* buffer = io.direct ? DirectSlot(pending_ios_prepared_) : io.buffer;
+        io_uring_prep_read(sqe, io.fd, buffer, io.size, io.offset);
+        sqe->user_data = pending_ios_prepared_;
+        pending_ios_prepared_++;
+    }
+
+    if (pending_ios_submitted_ == pending_ios_prepared_) {
+        return true;
+    }
+
+    int ret = io_uring_submit(ring_.get());
+    if (ret <= 0) {
+        SNAP_LOG(ERROR) << "io_uring_submit failed in ReadWorker: " << ret;
+        return false;
+    }
+    pending_ios_submitted_ += ret;
+    return pending_ios_submitted_ == pending_ios_prepared_;
+}
+
+bool ReadWorker::CompletePendingIos() {
+    if (pending_ios_.empty()) {
+        return true;
+    }
+
+    bool ring_ok = SubmitPendingIos();
+    bool status = true;
+
+    // Read XOR data from the COW device while the source reads are in
+    // flight.
+    for (size_t i = 0; i < pending_ios_.size(); i++) {
+        const PendingIo& io = pending_ios_[i];
+        if (!io.xor_op) {
+            continue;
+        }
+        ssize_t size = reader_->ReadData(io.xor_op, &xor_data_[i * BLOCK_SZ], BLOCK_SZ);
+        if (size != BLOCK_SZ) {
+            SNAP_LOG(ERROR) << "ReadData failed for xor block " << io.new_block
+                            << ", return value: " << size;
+            status = false;
+        }
+    }
+
+    // Reap I/O completions
+    size_t pending_ios_to_complete = pending_ios_submitted_;
+    while (pending_ios_to_complete) {
+        struct io_uring_cqe* cqe;
+        int ret = io_uring_wait_cqe(ring_.get(), &cqe);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret) {
+            SNAP_LOG(ERROR) << "ReadWorker - io_uring_wait_cqe failed: " << strerror(-ret);
+            ring_ok = false;
+            break;
+        }
+
+        PendingIo& io = pending_ios_[cqe->user_data];
+        if (cqe->res < 0) {
+            SNAP_LOG(ERROR) << "ReadWorker - read failed with res: " << cqe->res
+                            << " offset: " << io.offset << " size: " << io.size;
+        } else {
+            io.bytes_read = cqe->res;
+        }
+        io_uring_cqe_seen(ring_.get(), cqe);
+        pending_ios_to_complete -= 1;
+    }
+
+    if (!ring_ok) {
+        // Tear the ring down before any of its buffers is touched again.
+        // Exiting the ring cancels the reads which are still in flight, so
+        // none of them can land in a buffer after the synchronous re-read
+        // below has filled (and possibly XOR'ed) it.
+        SNAP_LOG(ERROR) << "ReadWorker io_uring failed - falling back to synchronous I/O";
+        FinalizeIouring();
+        batch_io_ = false;
+    }
+
+    for (size_t i = 0; i < pending_ios_.size(); i++) {
+        PendingIo& io = pending_ios_[i];
+
+        // Finish short, failed or never submitted reads synchronously. An
+        // O_DIRECT read can only be redone as a whole, aligned block.
+        if (io.direct && io.bytes_read < io.size) {
+            io.bytes_read = 0;
+        }
+        uint8_t* target = reinterpret_cast<uint8_t*>(io.direct ? DirectSlot(i) : io.buffer);
+        if (io.bytes_read < io.size) {
+            if (!android::base::ReadFullyAtOffset(io.fd, target + io.bytes_read,
+                                                  io.size - io.bytes_read,
+                                                  io.offset + io.bytes_read)) {
+                SNAP_PLOG(ERROR) << "Read failed at offset: " << io.offset
+                                 << " size: " << io.size;
+                status = false;
+            }
+        }
+        if (status && io.direct) {
+            std::memcpy(io.buffer, target, io.size);
+        }
+
+        if (status && io.xor_op) {
+            auto xor_out = reinterpret_cast<uint8_t*>(io.buffer);
+            const uint8_t* xor_in = &xor_data_[i * BLOCK_SZ];
+            for (size_t j = 0; j < BLOCK_SZ; j++) {
+                xor_out[j] ^= xor_in[j];
+            }
+        }
+
+        // I/O is complete - decrement the refcount irrespective of the
+        // return status
+        if (io.notify_completion) {
+            snapuserd_->NotifyIOCompletion(io.new_block);
+        }
+    }
+
+    pending_ios_.clear();
+    pending_ios_prepared_ = 0;
+    pending_ios_submitted_ = 0;
+    return status;
+}
+
 bool ReadWorker::Run() {
     SNAP_LOG(INFO) << "Processing snapshot I/O requests....";
 
@@ -281,6 +565,9 @@ bool ReadWorker::ReadDataFromBaseDevice(sector_t sector, void* buffer, size_t re
     CHECK(read_size <= BLOCK_SZ);
 
     loff_t offset = sector << SECTOR_SHIFT;
+    if (batch_io_) {
+        return QueueRead(base_path_merge_fd_.get(), buffer, read_size, offset, nullptr, false, 0);
+    }
     if (!android::base::ReadFullyAtOffset(base_path_merge_fd_, buffer, read_size, offset)) {
         SNAP_PLOG(ERROR) << "ReadDataFromBaseDevice failed. fd: " << base_path_merge_fd_
                          << "at sector :" << sector << " size: " << read_size;
@@ -307,39 +594,48 @@ bool ReadWorker::GetCowOpBlockOffset(const CowOperation* cow_op, uint64_t io_blo
 bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
     size_t remaining_size = sz;
     std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
+    const BlockIndex& block_index = snapuserd_->GetBlockIndex();
     int ret = 0;
 
+    // Resolve the mapping of the first block once; the remaining blocks of
+    // the request are found by walking forward from there.
+    size_t pos = block_index.Lookup(sector);
+
+    // Device reads for each payload are batched and completed before the
+    // payload is sent. On early return, make sure nothing is left in flight
+    // into the response buffer.
+    batch_io_ = read_async_;
+    auto scope_guard = android::base::make_scope_guard([this]() -> void {
+        CompletePendingIos();
+        batch_io_ = false;
+        pinned_ops_.clear();
+    });
+
     do {
         // Process 1MB payload at a time
         size_t read_size = std::min(PAYLOAD_BUFFER_SZ, remaining_size);
 
         size_t total_bytes_read = 0;
         const CowOperation* prev_op = nullptr;
+        const uint8_t* prev_data = nullptr;
+        bool prev_pinned = false;
         while (read_size) {
             // We need to check every 4k block to verify if it is
             // present in the mapping.
             size_t size = std::min(BLOCK_SZ, read_size);
 
-            auto it = std::lower_bound(chunk_vec.begin(), chunk_vec.end(),
-                                       std::make_pair(sector, nullptr), SnapshotHandler::compare);
+            // |it| is the last mapping at or before this sector.
+            pos = block_index.Advance(pos, sector);
+            auto it = chunk_vec.begin() + pos;
             const bool sector_not_found = (it == chunk_vec.end() || it->first != sector);
 
-            void* buffer = block_server_->GetResponseBuffer(BLOCK_SZ, size);
-            if (!buffer) {
-                SNAP_LOG(ERROR) << "AcquireBuffer failed in ReadAlignedSector";
-                return false;
-            }
-
             if (sector_not_found) {
                 // Find the 4k block
                 uint64_t io_block = SectorToChunk(sector);
-                // Get the previous iterator. Since the vector is sorted, the
-                // lookup of this sector can fall in a range of blocks if
-                // CowOperation has compressed multiple blocks.
-                if (it != chunk_vec.begin()) {
-                    std::advance(it, -1);
-                }
-
+                // |it| already points to the previous mapping. Since the
+                // vector is sorted, the lookup of this sector can fall in a
+                // range of blocks if CowOperation has compressed multiple
+                // blocks.
                 bool is_mapping_present = true;
 
                 // Vector itself is empty. This can happen if the block was not
@@ -384,18 +680,19 @@ bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
 
                     // Cached copy of the previous iteration. Just retrieve the
                     // data
-                    if (prev_op && prev_op->new_block == cow_op->new_block) {
-                        std::memcpy(buffer, (char*)decompressed_buffer_.get() + block_offset, size);
-                    } else {
-                        // Get the data from the disk based on the compression
-                        // size
-                        if (!ProcessReplaceOp(cow_op, decompressed_buffer_.get(),
-                                              compression_size)) {
+                    if (!prev_op || prev_op->new_block != cow_op->new_block) {
+                        // Get the data based on the compression size
+                        prev_data = GetDecompressedOp(cow_op, compression_size);
+                        if (!prev_data) {
                             return false;
                         }
-                        // Copy the data from the decompressed buffer relative
-                        // to the i/o block offset.
-                        std::memcpy(buffer, (char*)decompressed_buffer_.get() + block_offset, size);
+                        // Data owned by the shared op cache stays valid as long
+                        // as it is referenced, so it can be handed to the block
+                        // server without copying.
+                        if (cached_op_) {
+                            pinned_ops_.emplace_back(cached_op_);
+                        }
+                        prev_pinned = (cached_op_ != nullptr);
                         // Cache this CowOperation pointer for successive I/O
                         // operation. Since the request is sequential and the
                         // block is already decompressed, subsequest I/O blocks
@@ -403,7 +700,27 @@ bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
                         // buffer.
                         prev_op = cow_op;
                     }
+                    if (prev_pinned) {
+                        if (!block_server_->AddResponseData(prev_data + block_offset, size)) {
+                            SNAP_LOG(ERROR) << "AddResponseData failed in ReadAlignedSector";
+                            return false;
+                        }
+                    } else {
+                        void* buffer = block_server_->GetResponseBuffer(BLOCK_SZ, size);
+                        if (!buffer) {
+                            SNAP_LOG(ERROR) << "AcquireBuffer failed in ReadAlignedSector";
+                            return false;
+                        }
+                        // Copy the data from the decompressed buffer relative
+                        // to the i/o block offset.
+                        std::memcpy(buffer, prev_data + block_offset, size);
+                    }
                 } else {
+                    void* buffer = block_server_->GetResponseBuffer(BLOCK_SZ, size);
+                    if (!buffer) {
+                        SNAP_LOG(ERROR) << "AcquireBuffer failed in ReadAlignedSector";
+                        return false;
+                    }
                     // Block not found in map - which means this block was not
                     // changed as per the OTA. Just route the I/O to the base
                     // device.
@@ -414,6 +731,11 @@ bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
                 }
                 ret = size;
             } else {
+                void* buffer = block_server_->GetResponseBuffer(BLOCK_SZ, size);
+                if (!buffer) {
+                    SNAP_LOG(ERROR) << "AcquireBuffer failed in ReadAlignedSector";
+                    return false;
+                }
                 // We found the sector in mapping. Check the type of COW OP and
                 // process it.
                 if (!ProcessCowOp(it->second, buffer)) {
@@ -421,6 +743,8 @@ bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
                             << "ProcessCowOp failed, sector = " << sector << ", size = " << sz;
                     return false;
                 }
+                // ProcessCowOp may have replaced the decompressed data.
+                prev_op = nullptr;
 
                 ret = std::min(BLOCK_SZ, read_size);
             }
@@ -430,9 +754,15 @@ bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
             sector += (ret >> SECTOR_SHIFT);
         }
 
+        if (!CompletePendingIos()) {
+            SNAP_LOG(ERROR) << "CompletePendingIos failed, sector = " << sector;
+            return false;
+        }
+
         if (!SendBufferedIo()) {
             return false;
         }
+        pinned_ops_.clear();
 
         SNAP_LOG(DEBUG) << "SendBufferedIo success total_bytes_read: " << total_bytes_read
                         << " remaining_size: " << remaining_size;
@@ -467,9 +797,9 @@ int ReadWorker::ReadUnalignedSector(
     const CowOperation* cow_op = it->second;
     if (IsMappingPresent(cow_op, requested_offset, final_offset)) {
         size_t buffer_size = CowOpCompressionSize(cow_op, BLOCK_SZ);
-        uint8_t chunk[buffer_size];
         // Read the entire decompressed buffer based on the block-size
-        if (!ProcessReplaceOp(cow_op, chunk, buffer_size)) {
+        const uint8_t* chunk = GetDecompressedOp(cow_op, buffer_size);
+        if (!chunk) {
             return -1;
         }
         size_t skip_offset = (requested_offset - final_offset);
@@ -482,7 +812,7 @@ int ReadWorker::ReadUnalignedSector(
             return -1;
         }
 
-        std::memcpy(buffer, (char*)chunk + skip_offset, write_sz);
+        std::memcpy(buffer, chunk + skip_offset, write_sz);
         return write_sz;
     }
 
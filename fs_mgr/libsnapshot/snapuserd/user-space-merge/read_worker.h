@@ -17,7 +17,9 @@
 #include <utility>
 #include <vector>
 
+#include <liburing.h>
 #include <snapuserd/block_server.h>
+#include "snapuserd_op_cache.h"
 #include "worker.h"
 
 namespace android {
@@ -45,6 +47,9 @@ class ReadWorker : public Worker, public IBlockServer::Delegate {
     bool ProcessOrderedOp(const CowOperation* cow_op, void* buffer);
     bool ProcessCopyOp(const CowOperation* cow_op, void* buffer);
     bool ProcessReplaceOp(const CowOperation* cow_op, void* buffer, size_t buffer_size);
+    // Returns the whole decompressed data of a multi-block replace op. The
+    // pointer is valid until the next call.
+    const uint8_t* GetDecompressedOp(const CowOperation* cow_op, size_t size);
     bool ProcessZeroOp(void* buffer);
 
     bool IsMappingPresent(const CowOperation* cow_op, loff_t requested_offset,
@@ -57,6 +62,21 @@ class ReadWorker : public Worker, public IBlockServer::Delegate {
     bool ReadFromSourceDevice(const CowOperation* cow_op, void* buffer);
     bool ReadDataFromBaseDevice(sector_t sector, void* buffer, size_t read_size);
 
+    // io_uring batching of base and source device reads. While a request is
+    // being served by ReadAlignedSector, reads are queued instead of being
+    // issued synchronously, and all of them are completed right before the
+    // payload is sent back to the driver.
+    bool InitializeIouring();
+    void FinalizeIouring();
+    bool QueueSourceRead(const CowOperation* cow_op, void* buffer, bool notify_completion);
+    bool QueueRead(int fd, void* buffer, size_t size, off_t offset, const CowOperation* xor_op,
+                   bool notify_completion, uint64_t new_block, bool direct = false);
+    bool SubmitPendingIos();
+    bool CompletePendingIos();
+    void* DirectSlot(size_t slot) {
+        return reinterpret_cast<uint8_t*>(direct_data_.get()) + slot * BLOCK_SZ;
+    }
+
     constexpr bool IsBlockAligned(size_t size) { return ((size & (BLOCK_SZ - 1)) == 0); }
     constexpr sector_t ChunkToSector(chunk_t chunk) { return chunk << CHUNK_SHIFT; }
     constexpr chunk_t SectorToChunk(sector_t sector) { return sector >> CHUNK_SHIFT; }
@@ -72,6 +92,40 @@ class ReadWorker : public Worker, public IBlockServer::Delegate {
     std::vector<uint8_t> xor_buffer_;
     std::unique_ptr<void, decltype(&::free)> aligned_buffer_;
     std::unique_ptr<uint8_t[]> decompressed_buffer_;
+    DecompressedOpCache::Buffer cached_op_;
+    // Decompressed ops referenced by the response, until it is sent.
+    std::vector<DecompressedOpCache::Buffer> pinned_ops_;
+
+    struct PendingIo {
+        int fd;
+        void* buffer;
+        size_t size;
+        off_t offset;
+        // If set, the block is XOR'ed with this op's COW data once read.
+        const CowOperation* xor_op;
+        // If set, the merge ref-count of |new_block| is released once read.
+        bool notify_completion;
+        uint64_t new_block;
+        // If set, |fd| is opened with O_DIRECT; the block is read into the
+        // aligned slot in |direct_data_| and copied to |buffer| once read.
+        bool direct;
+        size_t bytes_read;
+    };
+
+    bool read_async_ = false;
+    bool batch_io_ = false;
+    // Each I/O in the batch is at most a single 4k block, except for
+    // unmapped blocks which are coalesced; a full 1MB payload therefore
+    // rarely needs more than one round trip.
+    size_t queue_depth_ = 32;
+    std::unique_ptr<struct io_uring> ring_;
+    std::vector<PendingIo> pending_ios_;
+    size_t pending_ios_prepared_ = 0;
+    size_t pending_ios_submitted_ = 0;
+    // XOR data for pending I/Os, BLOCK_SZ per queue slot.
+    std::vector<uint8_t> xor_data_;
+    // Page aligned O_DIRECT read buffers, BLOCK_SZ per queue slot.
+    std::unique_ptr<void, decltype(&::free)> direct_data_;
 };
 
 }  // namespace snapshot
@@ -0,0 +1,72 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "snapuserd_block_index.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <android-base/logging.h>
+
+namespace android {
+namespace snapshot {
+
+void BlockIndex::Build(const ChunkVec* chunk_vec) {
+    chunk_vec_ = chunk_vec;
+    bucket_start_.clear();
+
+    const auto& vec = *chunk_vec_;
+    if (vec.empty()) {
+        bucket_start_.shrink_to_fit();
+        return;
+    }
+    CHECK(vec.size() <= std::numeric_limits<uint32_t>::max());
+
+    const size_t num_buckets = (vec.back().first >> kBucketShift) + 1;
+    bucket_start_.resize(num_buckets + 1);
+
+    size_t pos = 0;
+    for (size_t bucket = 0; bucket <= num_buckets; bucket++) {
+        while (pos < vec.size() && (vec[pos].first >> kBucketShift) < bucket) {
+            pos++;
+        }
+        bucket_start_[bucket] = pos;
+    }
+    bucket_start_.shrink_to_fit();
+}
+
+size_t BlockIndex::Lookup(sector_t sector) const {
+    const size_t num_entries = size();
+    if (!num_entries) {
+        return 0;
+    }
+
+    const size_t bucket = sector >> kBucketShift;
+    if (bucket + 1 >= bucket_start_.size()) {
+        // Beyond the last mapped bucket.
+        return num_entries - 1;
+    }
+
+    const auto& vec = *chunk_vec_;
+    auto begin = vec.begin() + bucket_start_[bucket];
+    auto end = vec.begin() + bucket_start_[bucket + 1];
+    auto it = std::upper_bound(begin, end, sector,
+                               [](sector_t s, const auto& entry) { return s < entry.first; });
+
+    size_t pos = it - vec.begin();
+    return pos ? pos - 1 : 0;
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,80 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include <libsnapshot/cow_format.h>
+#include <snapuserd/snapuserd_kernel.h>
+
+namespace android {
+namespace snapshot {
+
+// Two-level index over the sorted sector -> CowOperation mapping (chunk_vec).
+//
+// The device is split into fixed size buckets of kBucketBlocks blocks. For
+// every bucket, the index records the position of the first mapping whose
+// sector falls in or after that bucket. A lookup is therefore a table access
+// followed by a search bounded by the bucket size, independent of the total
+// number of COW operations.
+//
+// Since I/O requests are mostly sequential, callers are expected to do a
+// single Lookup() for the first block of a request and then walk forward
+// with Advance() for each subsequent block.
+class BlockIndex {
+  public:
+    using ChunkVec = std::vector<std::pair<sector_t, const CowOperation*>>;
+
+    static constexpr size_t kBucketBlocks = 256;
+    static constexpr uint32_t kBucketShift = CHUNK_SHIFT + 8;
+    static_assert((1UL << (kBucketShift - CHUNK_SHIFT)) == kBucketBlocks);
+
+    // |chunk_vec| must be sorted by sector and must outlive the index.
+    void Build(const ChunkVec* chunk_vec);
+
+    // Returns the position of the last mapping whose sector is <= |sector|.
+    // If all mappings are beyond |sector|, 0 is returned; if there are no
+    // mappings at all, chunk_vec.size() is returned. This matches a
+    // lower_bound() lookup followed by stepping back to the previous entry
+    // when the sector is not an exact match.
+    size_t Lookup(sector_t sector) const;
+
+    // Move |pos| forward so that it again satisfies the Lookup() contract for
+    // |sector|. |sector| must not be smaller than the sector |pos| was
+    // obtained for.
+    size_t Advance(size_t pos, sector_t sector) const {
+        const auto& vec = *chunk_vec_;
+        while (pos + 1 < vec.size() && vec[pos + 1].first <= sector) {
+            pos++;
+        }
+        return pos;
+    }
+
+    size_t size() const { return chunk_vec_ ? chunk_vec_->size() : 0; }
+
+  private:
+    const ChunkVec* chunk_vec_ = nullptr;
+    // bucket_start_[i] is the position of the first mapping with
+    // (sector >> kBucketShift) >= i. The table has one extra trailing entry
+    // so that bucket i always spans [bucket_start_[i], bucket_start_[i + 1]).
+    std::vector<uint32_t> bucket_start_;
+};
+
+}  // namespace snapshot
+}  // namespace android
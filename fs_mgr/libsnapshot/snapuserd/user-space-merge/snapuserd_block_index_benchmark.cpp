@@ -0,0 +1,188 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays dm-user I/O traces against the sector -> CowOperation mapping.
+//
+// Usage:
+//   snapuserd_benchmark [--cow=<cow file>] [--trace=<trace file>]
+//
+// With --cow, the mapping is built from the operations of a real COW file,
+// the same way SnapshotHandler does. With --trace, each line of the trace
+// file is a "<sector> <size in bytes>" request as seen by ReadWorker. Without
+// these flags, a synthetic mapping and trace are generated.
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <libsnapshot/cow_reader.h>
+
+#include "snapuserd_block_index.h"
+
+DEFINE_string(cow, "", "COW file used to build the block mapping");
+DEFINE_string(trace, "", "I/O trace file with one \"<sector> <size>\" request per line");
+
+namespace android {
+namespace snapshot {
+
+struct IoRequest {
+    sector_t sector;
+    size_t size;
+};
+
+static CowReader sReader;
+static std::vector<CowOperation> sSyntheticOps;
+static BlockIndex::ChunkVec sChunkVec;
+static BlockIndex sIndex;
+static std::vector<IoRequest> sTrace;
+
+static bool compare(std::pair<sector_t, const CowOperation*> p1,
+                    std::pair<sector_t, const CowOperation*> p2) {
+    return p1.first < p2.first;
+}
+
+static bool LoadCowMapping(const std::string& path) {
+    android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        PLOG(ERROR) << "open failed: " << path;
+        return false;
+    }
+    if (!sReader.Parse(std::move(fd))) {
+        LOG(ERROR) << "Failed to parse " << path;
+        return false;
+    }
+    for (auto iter = sReader.GetOpIter(true); !iter->AtEnd(); iter->Next()) {
+        const CowOperation* op = iter->Get();
+        sChunkVec.emplace_back(op->new_block << CHUNK_SHIFT, op);
+    }
+    return true;
+}
+
+// Roughly models an OTA: long runs of changed blocks separated by
+// unchanged regions.
+static void BuildSyntheticMapping() {
+    std::mt19937 gen(10);
+    std::uniform_int_distribution<uint64_t> run_length(1, 512);
+    std::uniform_int_distribution<uint64_t> gap_length(0, 2048);
+
+    sSyntheticOps.resize(1 << 20);
+    uint64_t block = 0;
+    size_t i = 0;
+    while (i < sSyntheticOps.size()) {
+        block += gap_length(gen);
+        for (uint64_t n = run_length(gen); n && i < sSyntheticOps.size(); n--, i++) {
+            sChunkVec.emplace_back(block++ << CHUNK_SHIFT, &sSyntheticOps[i]);
+        }
+    }
+}
+
+static bool LoadTrace(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        LOG(ERROR) << "Failed to open trace " << path;
+        return false;
+    }
+    IoRequest req;
+    while (in >> req.sector >> req.size) {
+        sTrace.emplace_back(req);
+    }
+    return !sTrace.empty();
+}
+
+// Mix of sequential 1MB reads and random 4K reads, as seen during boot.
+static void BuildSyntheticTrace() {
+    const sector_t max_sector = sChunkVec.empty() ? (1 << 20) : sChunkVec.back().first + 2048;
+    std::mt19937 gen(20);
+    std::uniform_int_distribution<sector_t> sector_dist(0, max_sector >> CHUNK_SHIFT);
+    std::bernoulli_distribution sequential(0.5);
+
+    for (size_t i = 0; i < 4096; i++) {
+        const sector_t sector = sector_dist(gen) << CHUNK_SHIFT;
+        sTrace.push_back({sector, sequential(gen) ? (1UL << 20) : BLOCK_SZ});
+    }
+}
+
+static void BM_LowerBoundPerBlock(benchmark::State& state) {
+    size_t blocks = 0;
+    for (auto _ : state) {
+        for (const auto& req : sTrace) {
+            sector_t sector = req.sector;
+            for (size_t remaining = req.size; remaining >= BLOCK_SZ; remaining -= BLOCK_SZ) {
+                auto it = std::lower_bound(sChunkVec.begin(), sChunkVec.end(),
+                                           std::make_pair(sector, nullptr), compare);
+                if ((it == sChunkVec.end() || it->first != sector) && it != sChunkVec.begin()) {
+                    --it;
+                }
+                benchmark::DoNotOptimize(it);
+                sector += (1 << CHUNK_SHIFT);
+                blocks++;
+            }
+        }
+    }
+    state.SetItemsProcessed(blocks);
+}
+BENCHMARK(BM_LowerBoundPerBlock);
+
+static void BM_BlockIndexWalk(benchmark::State& state) {
+    size_t blocks = 0;
+    for (auto _ : state) {
+        for (const auto& req : sTrace) {
+            sector_t sector = req.sector;
+            size_t pos = sIndex.Lookup(sector);
+            for (size_t remaining = req.size; remaining >= BLOCK_SZ; remaining -= BLOCK_SZ) {
+                pos = sIndex.Advance(pos, sector);
+                benchmark::DoNotOptimize(pos);
+                sector += (1 << CHUNK_SHIFT);
+                blocks++;
+            }
+        }
+    }
+    state.SetItemsProcessed(blocks);
+}
+BENCHMARK(BM_BlockIndexWalk);
+
+}  // namespace snapshot
+}  // namespace android
+
+int main(int argc, char** argv) {
+    using namespace android::snapshot;
+
+    ::benchmark::Initialize(&argc, argv);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    if (!FLAGS_cow.empty()) {
+        if (!LoadCowMapping(FLAGS_cow)) return 1;
+    } else {
+        BuildSyntheticMapping();
+    }
+    std::sort(sChunkVec.begin(), sChunkVec.end(), compare);
+    sIndex.Build(&sChunkVec);
+
+    if (!FLAGS_trace.empty()) {
+        if (!LoadTrace(FLAGS_trace)) return 1;
+    } else {
+        BuildSyntheticTrace();
+    }
+
+    ::benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -67,7 +67,7 @@ bool SnapshotHandler::InitializeWorkers() {
     read_ahead_thread_ = std::make_unique<ReadAhead>(cow_device_, backing_store_device_, misc_name_,
                                                      GetSharedPtr());
 
-    update_verify_ = std::make_unique<UpdateVerify>(misc_name_);
+    update_verify_ = std::make_unique<UpdateVerify>(misc_name_, IsIouringSupported());
 
     return true;
 }
@@ -237,6 +237,11 @@ bool SnapshotHandler::ReadMetadata() {
 
     // Sort the vector based on sectors as we need this during un-aligned access
     std::sort(chunk_vec_.begin(), chunk_vec_.end(), compare);
+    block_index_.Build(&chunk_vec_);
+
+    if (reader_->GetMaxCompressionSize() > BLOCK_SZ) {
+        op_cache_ = std::make_unique<DecompressedOpCache>(kDecompressedOpCacheSize);
+    }
 
     PrepareReadAhead();
 
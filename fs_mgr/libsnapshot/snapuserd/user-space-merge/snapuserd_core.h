@@ -48,6 +48,8 @@
 #include <snapuserd/snapuserd_kernel.h>
 #include <storage_literals/storage_literals.h>
 #include <system/thread_defs.h>
+#include "snapuserd_block_index.h"
+#include "snapuserd_op_cache.h"
 #include "snapuserd_readahead.h"
 #include "snapuserd_verify.h"
 
@@ -63,6 +65,10 @@ static_assert(PAYLOAD_BUFFER_SZ >= BLOCK_SZ);
 
 static constexpr int kNumWorkerThreads = 4;
 
+// Memory budget of the decompressed op cache shared by the read workers;
+// only used when the COW has multi-block replace ops.
+static constexpr size_t kDecompressedOpCacheSize = 8_MiB;
+
 #define SNAP_LOG(level) LOG(level) << misc_name_ << ": "
 #define SNAP_PLOG(level) PLOG(level) << misc_name_ << ": "
 
@@ -125,6 +131,8 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     std::shared_ptr<SnapshotHandler> GetSharedPtr() { return shared_from_this(); }
 
     std::vector<std::pair<sector_t, const CowOperation*>>& GetChunkVec() { return chunk_vec_; }
+    const BlockIndex& GetBlockIndex() const { return block_index_; }
+    DecompressedOpCache* GetDecompressedOpCache() { return op_cache_.get(); }
 
     static bool compare(std::pair<sector_t, const CowOperation*> p1,
                         std::pair<sector_t, const CowOperation*> p2) {
@@ -211,6 +219,10 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     // chunk_vec stores the pseudo mapping of sector
     // to COW operations.
     std::vector<std::pair<sector_t, const CowOperation*>> chunk_vec_;
+    // Bucketed index over chunk_vec_ used by the read path.
+    BlockIndex block_index_;
+    // Decompressed multi-block ops, shared across read workers.
+    std::unique_ptr<DecompressedOpCache> op_cache_;
 
     std::mutex lock_;
     std::condition_variable cv;
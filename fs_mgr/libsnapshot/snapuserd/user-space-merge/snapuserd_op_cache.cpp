@@ -0,0 +1,86 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "snapuserd_op_cache.h"
+
+namespace android {
+namespace snapshot {
+
+DecompressedOpCache::Buffer DecompressedOpCache::Get(const CowOperation* op, size_t size,
+                                                     const DecompressFn& decompress) {
+    std::promise<Buffer> promise;
+    uint64_t id;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto it = entries_.find(op);
+        if (it != entries_.end()) {
+            hits_++;
+            lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+            std::shared_future<Buffer> data = it->second.data;
+            lock.unlock();
+            // May block until another worker finishes decompressing this op.
+            return data.get();
+        }
+
+        misses_++;
+        id = next_id_++;
+        lru_.push_front(op);
+        entries_[op] = {promise.get_future().share(), lru_.begin(), size, id};
+        total_size_ += size;
+        EvictLocked();
+    }
+
+    auto buffer = std::make_shared<std::vector<uint8_t>>(size);
+    if (!decompress(buffer->data(), size)) {
+        promise.set_value(nullptr);
+
+        // Drop the failed entry so that the next reader retries.
+        std::lock_guard<std::mutex> lock(lock_);
+        auto it = entries_.find(op);
+        if (it != entries_.end() && it->second.id == id) {
+            total_size_ -= it->second.size;
+            lru_.erase(it->second.lru_pos);
+            entries_.erase(it);
+        }
+        return nullptr;
+    }
+
+    promise.set_value(buffer);
+    return buffer;
+}
+
+size_t DecompressedOpCache::hits() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return hits_;
+}
+
+size_t DecompressedOpCache::misses() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return misses_;
+}
+
+void DecompressedOpCache::EvictLocked() {
+    // Always keep the most recent entry, even if it alone exceeds the
+    // capacity. Readers still waiting on an evicted entry hold their own
+    // reference to its data.
+    while (total_size_ > capacity_ && lru_.size() > 1) {
+        auto it = entries_.find(lru_.back());
+        total_size_ -= it->second.size;
+        entries_.erase(it);
+        lru_.pop_back();
+    }
+}
+
+}  // namespace snapshot
+}  // namespace android
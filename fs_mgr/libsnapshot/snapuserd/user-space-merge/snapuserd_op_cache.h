@@ -0,0 +1,78 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <libsnapshot/cow_format.h>
+
+namespace android {
+namespace snapshot {
+
+// LRU cache of decompressed multi-block replace ops, shared by all the
+// ReadWorkers of a snapshot.
+//
+// With COW v3 compression factors, a single replace op can cover up to
+// 256KB. Without the cache, each random 4k read of such an op decompresses
+// the whole op, and workers serving neighbouring blocks duplicate that
+// work. Concurrent lookups of the same op wait for a single decompression.
+class DecompressedOpCache {
+  public:
+    using Buffer = std::shared_ptr<const std::vector<uint8_t>>;
+    using DecompressFn = std::function<bool(void* buffer, size_t size)>;
+
+    explicit DecompressedOpCache(size_t capacity) : capacity_(capacity) {}
+
+    // Returns the |size| bytes of decompressed data of |op|. On a miss,
+    // |decompress| is called to fill a new buffer. Returns nullptr if
+    // decompression failed.
+    Buffer Get(const CowOperation* op, size_t size, const DecompressFn& decompress);
+
+    size_t hits() const;
+    size_t misses() const;
+
+  private:
+    struct Entry {
+        std::shared_future<Buffer> data;
+        std::list<const CowOperation*>::iterator lru_pos;
+        size_t size;
+        // Distinguishes an entry from a later one for the same op.
+        uint64_t id;
+    };
+
+    void EvictLocked();
+
+    mutable std::mutex lock_;
+    const size_t capacity_;
+    uint64_t next_id_ = 0;
+    size_t total_size_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    // Most recently used op at the front.
+    std::list<const CowOperation*> lru_;
+    std::unordered_map<const CowOperation*, Entry> entries_;
+};
+
+}  // namespace snapshot
+}  // namespace android
@@ -42,6 +42,7 @@
 #include "merge_worker.h"
 #include "read_worker.h"
 #include "snapuserd_core.h"
+#include "snapuserd_verify.h"
 #include "testing/dm_user_harness.h"
 #include "testing/host_harness.h"
 #include "testing/temp_device.h"
@@ -1518,6 +1519,172 @@ std::vector<TestParam> GetVariableBlockTestConfigs() {
     return testParams;
 }
 
+TEST(BlockIndexTest, MatchesLowerBound) {
+    // Sparse mapping with runs, gaps and bucket-sized holes.
+    std::vector<CowOperation> ops(64);
+    BlockIndex::ChunkVec chunk_vec;
+    uint64_t block = 3;
+    for (size_t i = 0; i < ops.size(); i++) {
+        chunk_vec.emplace_back(block << CHUNK_SHIFT, &ops[i]);
+        block += (i % 8 == 7) ? BlockIndex::kBucketBlocks + 5 : 1 + (i % 3);
+    }
+
+    BlockIndex index;
+    index.Build(&chunk_vec);
+
+    const sector_t last = (block + BlockIndex::kBucketBlocks) << CHUNK_SHIFT;
+    size_t pos = index.Lookup(0);
+    for (sector_t sector = 0; sector < last; sector += (1 << CHUNK_SHIFT)) {
+        auto it = std::lower_bound(chunk_vec.begin(), chunk_vec.end(),
+                                   std::make_pair(sector, nullptr), SnapshotHandler::compare);
+        if ((it == chunk_vec.end() || it->first != sector) && it != chunk_vec.begin()) {
+            --it;
+        }
+        const size_t expected = it - chunk_vec.begin();
+        ASSERT_EQ(index.Lookup(sector), expected) << "sector: " << sector;
+
+        pos = index.Advance(pos, sector);
+        ASSERT_EQ(pos, expected) << "sector: " << sector;
+    }
+
+    BlockIndex::ChunkVec empty;
+    index.Build(&empty);
+    ASSERT_EQ(index.Lookup(0), 0u);
+    ASSERT_EQ(index.Advance(0, 1 << CHUNK_SHIFT), 0u);
+}
+
+TEST(DecompressedOpCacheTest, HitMissEvict) {
+    std::vector<CowOperation> ops(4);
+    const size_t kOpSize = 64_KiB;
+    DecompressedOpCache cache(2 * kOpSize);
+    size_t decompress_calls = 0;
+    auto fill = [&](uint8_t value) {
+        return [&, value](void* buffer, size_t size) -> bool {
+            decompress_calls++;
+            memset(buffer, value, size);
+            return true;
+        };
+    };
+
+    auto data = cache.Get(&ops[0], kOpSize, fill(1));
+    ASSERT_NE(data, nullptr);
+    ASSERT_EQ(data->size(), kOpSize);
+    ASSERT_EQ((*data)[100], 1);
+
+    // Hit: no decompression.
+    data = cache.Get(&ops[0], kOpSize, fill(2));
+    ASSERT_EQ((*data)[100], 1);
+    ASSERT_EQ(decompress_calls, 1u);
+
+    // Filling the cache evicts the least recently used op.
+    ASSERT_NE(cache.Get(&ops[1], kOpSize, fill(3)), nullptr);
+    ASSERT_NE(cache.Get(&ops[2], kOpSize, fill(4)), nullptr);
+    ASSERT_EQ(decompress_calls, 3u);
+    data = cache.Get(&ops[0], kOpSize, fill(5));
+    ASSERT_EQ((*data)[100], 5);
+    ASSERT_EQ(decompress_calls, 4u);
+
+    // Failures are not cached.
+    auto fail = [](void*, size_t) -> bool { return false; };
+    ASSERT_EQ(cache.Get(&ops[3], kOpSize, fail), nullptr);
+    ASSERT_NE(cache.Get(&ops[3], kOpSize, fill(6)), nullptr);
+    ASSERT_EQ(cache.hits(), 1u);
+    ASSERT_EQ(cache.misses(), 6u);
+}
+
+class UpdateVerifyTest : public ::testing::Test {
+  public:
+    static uint64_t AdaptStride(uint64_t bytes_read, std::chrono::milliseconds elapsed,
+                                std::chrono::milliseconds budget, uint64_t remaining,
+                                uint64_t verify_block_size) {
+        return UpdateVerify::AdaptStride(bytes_read, elapsed, budget, remaining,
+                                         verify_block_size);
+    }
+
+  protected:
+    void SetUp() override {
+        if (!KernelSupportsIoUring()) {
+            GTEST_SKIP() << "io_uring is not supported";
+        }
+        std::string path = android::base::GetExecutableDirectory();
+        file_ = std::make_unique<TemporaryFile>(path);
+        ASSERT_GE(file_->fd, 0);
+    }
+
+    // Fills the file with |size| bytes, like a block device of that size.
+    void CreateDevice(uint64_t size) {
+        std::string data(size, 'x');
+        ASSERT_TRUE(android::base::WriteFully(file_->fd, data.data(), data.size()));
+        ASSERT_EQ(fsync(file_->fd), 0);
+
+        unique_fd fd(open(file_->path, O_RDONLY | O_DIRECT));
+        if (fd < 0) {
+            GTEST_SKIP() << "O_DIRECT is not supported for " << file_->path;
+        }
+    }
+
+    bool VerifyAsync(uint64_t dev_sz, uint64_t verify_block_size, std::chrono::milliseconds budget,
+                     uint64_t* bytes_read) {
+        if (!verify_.InitializeIouring()) {
+            return false;
+        }
+        bool ret = verify_.VerifyBlocksAsync("system", file_->path, dev_sz, verify_block_size,
+                                             budget, bytes_read);
+        verify_.FinalizeIouring();
+        return ret;
+    }
+
+    void SetAdaptInterval(std::chrono::milliseconds interval) {
+        verify_.kAdaptInterval = interval;
+    }
+
+    UpdateVerify verify_{"system_b", true};
+    std::unique_ptr<TemporaryFile> file_;
+};
+
+TEST_F(UpdateVerifyTest, AsyncPartialLastChunk) {
+    // The last chunk is shorter than both the chunk and the size of one read.
+    const uint64_t dev_sz = 2_MiB + 320_KiB;
+    ASSERT_NO_FATAL_FAILURE(CreateDevice(dev_sz));
+    if (IsSkipped()) return;
+
+    uint64_t bytes_read = 0;
+    ASSERT_TRUE(VerifyAsync(dev_sz, 1_MiB, 0ms, &bytes_read));
+    ASSERT_EQ(bytes_read, dev_sz);
+}
+
+TEST_F(UpdateVerifyTest, AsyncTimeBudget) {
+    const uint64_t dev_sz = 8_MiB;
+    ASSERT_NO_FATAL_FAILURE(CreateDevice(dev_sz));
+    if (IsSkipped()) return;
+
+    // Adapt the stride after every batch of reads.  The budget leaves room to
+    // read everything, so the stride stays at one chunk.
+    SetAdaptInterval(0ms);
+    uint64_t bytes_read = 0;
+    ASSERT_TRUE(VerifyAsync(dev_sz, 64_KiB, 1h, &bytes_read));
+    ASSERT_EQ(bytes_read, dev_sz);
+}
+
+TEST_F(UpdateVerifyTest, AsyncReadFailure) {
+    ASSERT_NO_FATAL_FAILURE(CreateDevice(1_MiB));
+    if (IsSkipped()) return;
+
+    // Reads past the end come back short, which fails the asynchronous path
+    // so that the threaded one verifies the partition again.
+    ASSERT_FALSE(VerifyAsync(2_MiB, 1_MiB, 0ms, nullptr));
+}
+
+TEST(UpdateVerifyStrideTest, AdaptStride) {
+    // 10MB read in the first second, with one second left: 10MB of the
+    // remaining 40MB can be read, so one chunk in four.
+    ASSERT_EQ(UpdateVerifyTest::AdaptStride(10_MiB, 1000ms, 2000ms, 40_MiB, 1_MiB), 4u);
+    // Everything left can be read.
+    ASSERT_EQ(UpdateVerifyTest::AdaptStride(10_MiB, 1000ms, 5000ms, 40_MiB, 1_MiB), 1u);
+    // Nothing more can be read, so the stride skips past the end.
+    ASSERT_EQ(UpdateVerifyTest::AdaptStride(10_MiB, 1000ms, 1000ms, 40_MiB, 1_MiB), 41u);
+}
+
 INSTANTIATE_TEST_SUITE_P(Io, SnapuserdVariableBlockSizeTest,
                          ::testing::ValuesIn(GetVariableBlockTestConfigs()));
 INSTANTIATE_TEST_SUITE_P(Io, HandlerTestV3, ::testing::ValuesIn(GetVariableBlockTestConfigs()));
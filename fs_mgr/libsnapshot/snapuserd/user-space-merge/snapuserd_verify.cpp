@@ -16,6 +16,9 @@
 
 #include "snapuserd_verify.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <android-base/chrono_utils.h>
 #include <android-base/scopeguard.h>
 #include <android-base/strings.h>
@@ -30,8 +33,10 @@ using namespace android;
 using namespace android::dm;
 using android::base::unique_fd;
 
-UpdateVerify::UpdateVerify(const std::string& misc_name)
-    : misc_name_(misc_name), state_(UpdateVerifyState::VERIFY_UNKNOWN) {}
+UpdateVerify::UpdateVerify(const std::string& misc_name, bool use_iouring)
+    : misc_name_(misc_name),
+      use_iouring_(use_iouring),
+      state_(UpdateVerifyState::VERIFY_UNKNOWN) {}
 
 bool UpdateVerify::CheckPartitionVerification() {
     auto now = std::chrono::system_clock::now();
@@ -105,8 +110,7 @@ bool UpdateVerify::VerifyBlocks(const std::string& partition_name,
     }
 
     loff_t file_offset = offset;
-    auto verify_block_size = android::base::GetUintProperty<uint>("ro.virtual_ab.verify_block_size",
-                                                                  kBlockSizeVerify);
+    const uint64_t verify_block_size = GetVerifyBlockSize();
     const uint64_t read_sz = verify_block_size;
 
     void* addr;
@@ -145,6 +149,210 @@ bool UpdateVerify::VerifyBlocks(const std::string& partition_name,
     return true;
 }
 
+uint64_t UpdateVerify::GetVerifyBlockSize() {
+    const uint64_t verify_block_size = android::base::GetUintProperty<uint64_t>(
+            "ro.virtual_ab.verify_block_size", kBlockSizeVerify);
+    // The reads would never advance with a zero block size.
+    if (verify_block_size == 0) {
+        SNAP_LOG(WARNING) << "Ignoring verify_block_size of 0, using: " << kBlockSizeVerify;
+        return kBlockSizeVerify;
+    }
+    return verify_block_size;
+}
+
+bool UpdateVerify::InitializeIouring() {
+    if (!use_iouring_) {
+        return false;
+    }
+
+    ring_ = std::make_unique<struct io_uring>();
+
+    int ret = io_uring_queue_init(kQueueDepth, ring_.get(), 0);
+    if (ret) {
+        SNAP_LOG(ERROR) << "io_uring_queue_init failed with ret: " << ret;
+        ring_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void UpdateVerify::FinalizeIouring() {
+    if (ring_) {
+        io_uring_queue_exit(ring_.get());
+        ring_ = nullptr;
+    }
+}
+
+uint64_t UpdateVerify::AdaptStride(uint64_t bytes_read, std::chrono::milliseconds elapsed,
+                                   std::chrono::milliseconds budget, uint64_t remaining,
+                                   uint64_t verify_block_size) {
+    // Bytes that can still be read at the throughput measured so far, spread
+    // over what is left of the partition.
+    const uint64_t affordable = bytes_read * (budget - elapsed).count() / elapsed.count();
+    return affordable ? std::max<uint64_t>(1, (remaining + affordable - 1) / affordable)
+                      : remaining / verify_block_size + 1;
+}
+
+bool UpdateVerify::VerifyBlocksAsync(const std::string& partition_name,
+                                     const std::string& dm_block_device, uint64_t dev_sz,
+                                     uint64_t verify_block_size, std::chrono::milliseconds budget,
+                                     uint64_t* bytes_read_out) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(dm_block_device.c_str(), O_RDONLY | O_DIRECT)));
+    if (fd < 0) {
+        SNAP_LOG(ERROR) << "open failed: " << dm_block_device;
+        return false;
+    }
+
+    const uint64_t io_size = std::min(verify_block_size, kAsyncIoSize);
+    if (!verify_block_size || !IsBlockAligned(verify_block_size)) {
+        SNAP_LOG(ERROR) << "verify_block_size: " << verify_block_size << " is not block aligned";
+        return false;
+    }
+
+    void* addr;
+    ssize_t page_size = getpagesize();
+    if (posix_memalign(&addr, page_size, io_size * kQueueDepth) < 0) {
+        SNAP_PLOG(ERROR) << "posix_memalign failed "
+                         << " page_size: " << page_size << " size: " << io_size * kQueueDepth;
+        return false;
+    }
+    std::unique_ptr<void, decltype(&::free)> buffer(addr, ::free);
+
+    struct Slot {
+        uint64_t offset;
+        size_t size;
+    };
+    std::vector<Slot> slots(kQueueDepth);
+    std::vector<int> free_slots;
+    for (int i = kQueueDepth - 1; i >= 0; i--) {
+        free_slots.push_back(i);
+    }
+
+    // Next read is at |chunk_offset + chunk_pos|. Only one of every |stride|
+    // chunks of verify_block_size bytes is read.
+    uint64_t chunk_offset = 0;
+    uint64_t chunk_pos = 0;
+    uint64_t stride = 1;
+    uint64_t bytes_read = 0;
+    int inflight = 0;
+    bool failed = false;
+    bool budget_exceeded = false;
+
+    const auto start = std::chrono::steady_clock::now();
+    auto last_adapt = start;
+
+    while (true) {
+        while (!failed && !free_slots.empty() && chunk_offset < dev_sz) {
+            const uint64_t chunk_end = std::min(chunk_offset + verify_block_size, dev_sz);
+            const uint64_t offset = chunk_offset + chunk_pos;
+            const size_t to_read = std::min(io_size, chunk_end - offset);
+
+            struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+            if (!sqe) {
+                break;
+            }
+            const int slot = free_slots.back();
+            free_slots.pop_back();
+            slots[slot] = {offset, to_read};
+
+            char* slot_buffer = static_cast<char*>(buffer.get()) + slot * io_size;
+            io_uring_prep_read(sqe, fd.get(), slot_buffer, to_read, offset);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(slot)));
+            inflight += 1;
+
+            chunk_pos += to_read;
+            if (chunk_offset + chunk_pos >= chunk_end) {
+                chunk_offset += stride * verify_block_size;
+                chunk_pos = 0;
+            }
+        }
+
+        if (!inflight) {
+            break;
+        }
+
+        int ret = io_uring_submit(ring_.get());
+        if (ret < 0) {
+            SNAP_LOG(ERROR) << "io_uring_submit failed for verification: " << strerror(-ret);
+            // Tear down the ring before the buffers of earlier reads go away.
+            FinalizeIouring();
+            return false;
+        }
+
+        struct io_uring_cqe* cqe;
+        ret = io_uring_wait_cqe(ring_.get(), &cqe);
+        if (ret) {
+            if (ret == -EINTR || ret == -EAGAIN) {
+                continue;
+            }
+            SNAP_LOG(ERROR) << "io_uring_wait_cqe failed for verification: " << strerror(-ret);
+            FinalizeIouring();
+            return false;
+        }
+
+        do {
+            const int slot =
+                    static_cast<int>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+            if (cqe->res < 0 || static_cast<size_t>(cqe->res) != slots[slot].size) {
+                SNAP_LOG(ERROR) << "Failed to read block from block device: " << dm_block_device
+                                << " partition-name: " << partition_name
+                                << " at offset: " << slots[slot].offset
+                                << " read-size: " << slots[slot].size << " res: " << cqe->res;
+                failed = true;
+            } else {
+                bytes_read += cqe->res;
+            }
+            io_uring_cqe_seen(ring_.get(), cqe);
+            free_slots.push_back(slot);
+            inflight -= 1;
+        } while (io_uring_peek_cqe(ring_.get(), &cqe) == 0);
+
+        if (failed || budget.count() == 0 || chunk_offset >= dev_sz) {
+            continue;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_adapt < kAdaptInterval) {
+            continue;
+        }
+        last_adapt = now;
+
+        const auto elapsed =
+                std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
+        if (elapsed >= budget) {
+            // Stop issuing reads; whatever is in flight is still checked.
+            budget_exceeded = true;
+            chunk_offset = dev_sz;
+            continue;
+        }
+        if (elapsed.count() == 0) {
+            continue;
+        }
+
+        stride = AdaptStride(bytes_read, elapsed, budget, dev_sz - chunk_offset,
+                             verify_block_size);
+    }
+
+    if (failed) {
+        return false;
+    }
+    if (bytes_read_out) {
+        *bytes_read_out = bytes_read;
+    }
+
+    const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+    const uint64_t throughput = duration.count() ? (bytes_read * 1000 / duration.count()) : 0;
+    SNAP_LOG(INFO) << "Verification stats for partition: " << partition_name
+                   << " bytes-read: " << bytes_read << " dev_sz: " << dev_sz
+                   << " coverage: " << (bytes_read * 100 / dev_sz) << "%"
+                   << " throughput: " << throughput / 1_MiB << " MB/s"
+                   << " final-stride: " << stride << " queue-depth: " << kQueueDepth
+                   << " duration: " << duration.count() << " ms"
+                   << (budget_exceeded ? " (time budget exceeded)" : "");
+    return true;
+}
+
 bool UpdateVerify::VerifyPartition(const std::string& partition_name,
                                    const std::string& dm_block_device) {
     android::base::Timer timer;
@@ -175,16 +383,34 @@ bool UpdateVerify::VerifyPartition(const std::string& partition_name,
         return false;
     }
 
+    const uint64_t verify_block_size = GetVerifyBlockSize();
+
+    if (InitializeIouring()) {
+        const std::chrono::milliseconds budget(android::base::GetUintProperty<uint64_t>(
+                "ro.virtual_ab.verify_time_budget_ms", 0));
+        bool ret = VerifyBlocksAsync(partition_name, dm_block_device, dev_sz, verify_block_size,
+                                     budget, nullptr);
+        FinalizeIouring();
+        if (ret) {
+            succeeded = true;
+            UpdatePartitionVerificationState(UpdateVerifyState::VERIFY_SUCCESS);
+            SNAP_LOG(INFO) << "Partition: " << partition_name
+                           << " Block-device: " << dm_block_device << " Size: " << dev_sz
+                           << " verification success. Duration : " << timer.duration().count()
+                           << " ms";
+            return true;
+        }
+        SNAP_LOG(WARNING) << "Asynchronous verification failed for partition: " << partition_name
+                          << ", verifying again with threads";
+    }
+
     /*
      * Not all partitions are of same size. Some partitions are as small as
      * 100Mb. We can just finish them in a single thread. For bigger partitions
      * such as product, 4 threads are sufficient enough.
      *
-     * TODO: With io_uring SQ_POLL support, we can completely cut this
-     * down to just single thread for all partitions and potentially verify all
-     * the partitions with zero syscalls. Additionally, since block layer
-     * supports polling, IO_POLL could be used which will further cut down
-     * latency.
+     * This is the fallback when io_uring is not available or failed; see
+     * VerifyBlocksAsync().
      */
     int num_threads = kMinThreadsToVerify;
     auto verify_threshold_size = android::base::GetUintProperty<uint>(
@@ -197,8 +423,6 @@ bool UpdateVerify::VerifyPartition(const std::string& partition_name,
     off_t start_offset = 0;
     const int skip_blocks = num_threads;
 
-    auto verify_block_size =
-            android::base::GetUintProperty("ro.virtual_ab.verify_block_size", kBlockSizeVerify);
     while (num_threads) {
         threads.emplace_back(std::async(std::launch::async, &UpdateVerify::VerifyBlocks, this,
                                         partition_name, dm_block_device, start_offset, skip_blocks,
@@ -18,10 +18,13 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <chrono>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <string>
 
+#include <liburing.h>
 #include <snapuserd/snapuserd_kernel.h>
 #include <storage_literals/storage_literals.h>
 
@@ -31,8 +34,10 @@ namespace snapshot {
 using namespace android::storage_literals;
 
 class UpdateVerify {
+    friend class UpdateVerifyTest;
+
   public:
-    UpdateVerify(const std::string& misc_name);
+    UpdateVerify(const std::string& misc_name, bool use_iouring = false);
     void VerifyUpdatePartition();
     bool CheckPartitionVerification();
 
@@ -44,6 +49,7 @@ class UpdateVerify {
     };
 
     std::string misc_name_;
+    bool use_iouring_;
     UpdateVerifyState state_;
     std::mutex m_lock_;
     std::condition_variable m_cv_;
@@ -70,11 +76,40 @@ class UpdateVerify {
     uint64_t kThresholdSize = 750_MiB;
     uint64_t kBlockSizeVerify = 2_MiB;
 
+    /*
+     * With io_uring, a single thread keeps up to kQueueDepth reads of
+     * kAsyncIoSize in flight, which bounds the buffer memory to 8MB per
+     * partition. Each snapshot handler verifies its own partition, so all the
+     * partitions being verified have their reads in flight at the same time.
+     *
+     * If ro.virtual_ab.verify_time_budget_ms is set, the partition is sampled
+     * instead of read in full: every kAdaptInterval, the read throughput
+     * measured so far is used to pick the stride (in units of
+     * verify_block_size) that lets the rest of the partition be covered
+     * within the remaining budget.
+     *
+     * If io_uring fails in any way, including a failed read, the partition
+     * is verified again through the threaded path, which has the final say.
+     */
+    int kQueueDepth = 32;
+    uint64_t kAsyncIoSize = 256_KiB;
+    std::chrono::milliseconds kAdaptInterval = std::chrono::milliseconds(100);
+    std::unique_ptr<struct io_uring> ring_;
+
     bool IsBlockAligned(uint64_t read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
     void UpdatePartitionVerificationState(UpdateVerifyState state);
     bool VerifyPartition(const std::string& partition_name, const std::string& dm_block_device);
     bool VerifyBlocks(const std::string& partition_name, const std::string& dm_block_device,
                       off_t offset, int skip_blocks, uint64_t dev_sz);
+    bool InitializeIouring();
+    void FinalizeIouring();
+    uint64_t GetVerifyBlockSize();
+    bool VerifyBlocksAsync(const std::string& partition_name, const std::string& dm_block_device,
+                           uint64_t dev_sz, uint64_t verify_block_size,
+                           std::chrono::milliseconds budget, uint64_t* bytes_read);
+    static uint64_t AdaptStride(uint64_t bytes_read, std::chrono::milliseconds elapsed,
+                                std::chrono::milliseconds budget, uint64_t remaining,
+                                uint64_t verify_block_size);
 };
 
 }  // namespace snapshot
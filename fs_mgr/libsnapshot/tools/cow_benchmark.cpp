@@ -13,14 +13,23 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
+#include <unistd.h>
+
 #include <memory>
 
 #include <array>
+#include <chrono>
 #include <iostream>
 #include <random>
+#include <string>
+#include <vector>
 
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
 #include <libsnapshot/cow_compress.h>
 #include <libsnapshot/cow_format.h>
+#include <libsnapshot/cow_reader.h>
+#include <libsnapshot/cow_writer.h>
 
 static const uint32_t BLOCK_SZ = 4096;
 static const uint32_t SEED_NUMBER = 10;
@@ -191,12 +200,94 @@ void IncrementalCompressionTest() {
               << "\n";
 }
 
+static double RandomReadThroughput(android::base::borrowed_fd fd, bool cache_decompressor,
+                                   size_t num_reads) {
+    CowReader reader;
+    if (!reader.Parse(fd)) {
+        std::cerr << "Failed to parse cow\n";
+        return 0;
+    }
+    reader.set_decompressor_cache(cache_decompressor);
+
+    std::vector<const CowOperation*> ops;
+    for (auto iter = reader.GetOpIter(); !iter->AtEnd(); iter->Next()) {
+        if (iter->Get()->type() == kCowReplaceOp) {
+            ops.emplace_back(iter->Get());
+        }
+    }
+    if (ops.empty()) {
+        return 0;
+    }
+
+    const size_t block_size = reader.GetHeader().block_size;
+    std::vector<char> buffer(reader.GetMaxCompressionSize());
+    std::default_random_engine gen(SEED_NUMBER);
+    std::uniform_int_distribution<size_t> distribution(0, ops.size() - 1);
+
+    size_t bytes_read = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_reads; i++) {
+        const CowOperation* op = ops[distribution(gen)];
+        const size_t op_size = CowOpCompressionSize(op, block_size);
+        if (reader.ReadData(op, buffer.data(), op_size) != static_cast<ssize_t>(op_size)) {
+            std::cerr << "ReadData failed\n";
+            return 0;
+        }
+        bytes_read += op_size;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> elapsed = end - start;
+    return bytes_read / elapsed.count() / (1024 * 1024);
+}
+
+void RandomReadTest() {
+    std::cout << "\n-------Random Read Decompressor Cache Perf Analysis-------\n";
+
+    // 16MB of compressible data, read back with 16k random op reads.
+    static constexpr size_t kNumBlocks = 4096;
+    static constexpr size_t kNumReads = 16384;
+
+    std::vector<std::string> compression_list = {"lz4", "zstd", "gz", "brotli"};
+    std::vector<uint64_t> compression_factors = {BLOCK_SZ, BLOCK_SZ * 16, BLOCK_SZ * 64};
+
+    std::vector<char> buffer(kNumBlocks * BLOCK_SZ);
+    std::default_random_engine gen(SEED_NUMBER);
+    std::uniform_int_distribution<int> distribution(0, 10);
+    for (size_t i = 0; i < buffer.size(); i++) {
+        buffer[i] = static_cast<char>(distribution(gen));
+    }
+
+    for (const auto& compression : compression_list) {
+        for (const auto factor : compression_factors) {
+            TemporaryFile cow;
+            CowOptions options;
+            options.compression = compression;
+            options.compression_factor = factor;
+            options.op_count_max = kNumBlocks;
+
+            auto writer = CreateCowWriter(3, options, android::base::unique_fd(dup(cow.fd)));
+            if (!writer || !writer->AddRawBlocks(0, buffer.data(), buffer.size()) ||
+                !writer->Finalize()) {
+                std::cerr << "Failed to write cow for " << compression << "\n";
+                continue;
+            }
+
+            const double uncached = RandomReadThroughput(cow.fd, false, kNumReads);
+            const double cached = RandomReadThroughput(cow.fd, true, kNumReads);
+            std::cout << "Metrics for " << compression << " (op size " << factor
+                      << "): no cache -> " << uncached << " MB/s, cache -> " << cached
+                      << " MB/s\n";
+        }
+    }
+}
+
 }  // namespace snapshot
 }  // namespace android
 
 int main() {
     android::snapshot::OneShotCompressionTest();
     android::snapshot::IncrementalCompressionTest();
+    android::snapshot::RandomReadTest();
 
     return 0;
 }
\ No newline at end of file
@@ -37,9 +37,39 @@ ActionManager& ActionManager::GetInstance() {
 }
 
 void ActionManager::AddAction(std::unique_ptr<Action> action) {
+    IndexAction(action.get());
     actions_.emplace_back(std::move(action));
 }
 
+void ActionManager::IndexAction(const Action* action) {
+    if (!action->event_trigger().empty()) {
+        event_trigger_actions_[action->event_trigger()].emplace_back(action);
+        return;
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        property_trigger_actions_[name].emplace_back(action);
+    }
+}
+
+static void EraseFromIndex(std::unordered_map<std::string, std::vector<const Action*>>* index,
+                           const std::string& key, const Action* action) {
+    auto it = index->find(key);
+    if (it == index->end()) return;
+    auto& actions = it->second;
+    actions.erase(std::remove(actions.begin(), actions.end(), action), actions.end());
+    if (actions.empty()) index->erase(it);
+}
+
+void ActionManager::UnindexAction(const Action* action) {
+    if (!action->event_trigger().empty()) {
+        EraseFromIndex(&event_trigger_actions_, action->event_trigger(), action);
+        return;
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        EraseFromIndex(&property_trigger_actions_, name, action);
+    }
+}
+
 void ActionManager::QueueEventTrigger(const std::string& trigger) {
     auto lock = std::lock_guard{event_queue_lock_};
     event_queue_.emplace(trigger);
@@ -61,20 +91,56 @@ void ActionManager::QueueBuiltinAction(BuiltinFunction func, const std::string&
     action->AddCommand(std::move(func), {name}, 0);
 
     event_queue_.emplace(action.get());
+    IndexAction(action.get());
     actions_.emplace_back(std::move(action));
 }
 
+void ActionManager::QueueMatchingActions(const EventTrigger& trigger) {
+    auto it = event_trigger_actions_.find(trigger);
+    if (it == event_trigger_actions_.end()) return;
+    for (const auto& action : it->second) {
+        if (action->CheckEvent(trigger)) {
+            current_executing_actions_.emplace(action);
+        }
+    }
+}
+
+void ActionManager::QueueMatchingActions(const PropertyChange& property_change) {
+    // QueueAllPropertyActions() checks every action with property triggers only.
+    if (property_change.first.empty()) {
+        for (const auto& action : actions_) {
+            if (action->CheckEvent(property_change)) {
+                current_executing_actions_.emplace(action.get());
+            }
+        }
+        return;
+    }
+
+    auto it = property_trigger_actions_.find(property_change.first);
+    if (it == property_trigger_actions_.end()) return;
+    for (const auto& action : it->second) {
+        if (action->CheckEvent(property_change)) {
+            current_executing_actions_.emplace(action);
+        }
+    }
+}
+
+void ActionManager::QueueMatchingActions(const BuiltinAction& builtin_action) {
+    // A builtin action only matches itself, unless it was removed since it was queued.
+    auto it = std::find_if(actions_.begin(), actions_.end(),
+                           [&](const auto& action) { return action.get() == builtin_action; });
+    if (it != actions_.end()) {
+        current_executing_actions_.emplace(builtin_action);
+    }
+}
+
 void ActionManager::ExecuteOneCommand() {
     {
         auto lock = std::lock_guard{event_queue_lock_};
         // Loop through the event queue until we have an action to execute
         while (current_executing_actions_.empty() && !event_queue_.empty()) {
-            for (const auto& action : actions_) {
-                if (std::visit([&action](const auto& event) { return action->CheckEvent(event); },
-                               event_queue_.front())) {
-                    current_executing_actions_.emplace(action.get());
-                }
-            }
+            std::visit([this](const auto& event) { QueueMatchingActions(event); },
+                       event_queue_.front());
             event_queue_.pop();
         }
     }
@@ -101,9 +167,8 @@ void ActionManager::ExecuteOneCommand() {
         current_executing_actions_.pop();
         current_command_ = 0;
         if (action->oneshot()) {
-            auto eraser = [&action](std::unique_ptr<Action>& a) { return a.get() == action; };
-            actions_.erase(std::remove_if(actions_.begin(), actions_.end(), eraser),
-                           actions_.end());
+            RemoveActionIf(
+                    [&action](const std::unique_ptr<Action>& a) { return a.get() == action; });
         }
     }
 }
@@ -18,6 +18,7 @@
 
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/thread_annotations.h>
@@ -39,7 +40,12 @@ class ActionManager {
     void AddAction(std::unique_ptr<Action> action);
     template <class UnaryPredicate>
     void RemoveActionIf(UnaryPredicate predicate) {
-        actions_.erase(std::remove_if(actions_.begin(), actions_.end(), predicate), actions_.end());
+        auto remove = [&](const std::unique_ptr<Action>& action) {
+            if (!predicate(action)) return false;
+            UnindexAction(action.get());
+            return true;
+        };
+        actions_.erase(std::remove_if(actions_.begin(), actions_.end(), remove), actions_.end());
     }
     void QueueEventTrigger(const std::string& trigger);
     void QueuePropertyChange(const std::string& name, const std::string& value);
@@ -55,7 +61,19 @@ class ActionManager {
     ActionManager(ActionManager const&) = delete;
     void operator=(ActionManager const&) = delete;
 
+    void IndexAction(const Action* action);
+    void UnindexAction(const Action* action);
+    void QueueMatchingActions(const EventTrigger& trigger);
+    void QueueMatchingActions(const PropertyChange& property_change);
+    void QueueMatchingActions(const BuiltinAction& builtin_action);
+
     std::vector<std::unique_ptr<Action>> actions_;
+    // Actions that an event trigger or a change of a property can match, by
+    // trigger or property name, in the order of actions_. Actions with an
+    // event trigger are only indexed by it, as property changes cannot match
+    // them.
+    std::unordered_map<std::string, std::vector<const Action*>> event_trigger_actions_;
+    std::unordered_map<std::string, std::vector<const Action*>> property_trigger_actions_;
     std::queue<std::variant<EventTrigger, PropertyChange, BuiltinAction>> event_queue_
             GUARDED_BY(event_queue_lock_);
     mutable std::mutex event_queue_lock_;
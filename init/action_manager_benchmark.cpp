@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action_manager.h"
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace init {
+
+// Adds |num_actions| actions, as parsed from init scripts: half are
+// "on property:bench.prop<N>=1" and half are "on bench_event<N>".
+static void AddActions(ActionManager* action_manager, int num_actions) {
+    auto nop = [](const BuiltinArguments&) { return Result<void>{}; };
+    for (int i = 0; i < num_actions; i++) {
+        std::string event_trigger;
+        std::map<std::string, std::string> property_triggers;
+        if (i % 2) {
+            event_trigger = StringPrintf("bench_event%d", i / 2);
+        } else {
+            property_triggers.emplace(StringPrintf("bench.prop%d", i / 2), "1");
+        }
+        auto action = std::make_unique<Action>(false, nullptr, "/bench.rc", i, event_trigger,
+                                               property_triggers);
+        action->AddCommand(nop, {"nop"}, i);
+        action_manager->AddAction(std::move(action));
+    }
+}
+
+// Property changes during boot, which do not match the value of the action
+// watching the property.
+static void BenchmarkPropertyChange(benchmark::State& state) {
+    ActionManager action_manager;
+    AddActions(&action_manager, state.range(0));
+    const int num_properties = state.range(0) / 2;
+
+    int i = 0;
+    for (auto _ : state) {
+        action_manager.QueuePropertyChange(StringPrintf("bench.prop%d", i++ % num_properties),
+                                           "0");
+        action_manager.QueuePropertyChange("bench.unwatched", "1");
+        while (action_manager.HasMoreCommands()) {
+            action_manager.ExecuteOneCommand();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BenchmarkPropertyChange)->Arg(100)->Arg(1000)->Arg(5000);
+
+// Event triggers without any action, as queued by "trigger" commands.
+static void BenchmarkEventTrigger(benchmark::State& state) {
+    ActionManager action_manager;
+    AddActions(&action_manager, state.range(0));
+
+    for (auto _ : state) {
+        action_manager.QueueEventTrigger("bench_unused_event");
+        while (action_manager.HasMoreCommands()) {
+            action_manager.ExecuteOneCommand();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkEventTrigger)->Arg(100)->Arg(1000)->Arg(5000);
+
+}  // namespace init
+}  // namespace android
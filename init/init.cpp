@@ -361,7 +361,7 @@ static void LoadBootScripts(ActionManager& action_manager, ServiceList& service_
     }
 }
 
-void PropertyChanged(const std::string& name, const std::string& value) {
+static void HandlePropertyChange(const std::string& name, const std::string& value) {
     // If the property is sys.powerctl, we bypass the event queue and immediately handle it.
     // This is to ensure that init will always and immediately shutdown/reboot, regardless of
     // if there are other pending events to process or if init is waiting on an exec service or
@@ -374,12 +374,27 @@ void PropertyChanged(const std::string& name, const std::string& value) {
 
     if (property_triggers_enabled) {
         ActionManager::GetInstance().QueuePropertyChange(name, value);
-        WakeMainInitThread();
     }
 
     prop_waiter_state.CheckAndResetWait(name, value);
 }
 
+void PropertyChanged(const std::string& name, const std::string& value) {
+    HandlePropertyChange(name, value);
+    if (property_triggers_enabled) {
+        WakeMainInitThread();
+    }
+}
+
+void PropertiesChanged(const std::vector<std::pair<std::string, std::string>>& properties) {
+    for (const auto& [name, value] : properties) {
+        HandlePropertyChange(name, value);
+    }
+    if (property_triggers_enabled && !properties.empty()) {
+        WakeMainInitThread();
+    }
+}
+
 static std::optional<boot_clock::time_point> HandleProcessActions() {
     std::optional<boot_clock::time_point> next_process_action_time;
     for (const auto& s : ServiceList::GetInstance()) {
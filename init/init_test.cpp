@@ -612,6 +612,53 @@ TEST(init, LazilyLoadedActionsCanBeTriggeredByTheNextTrigger) {
     EXPECT_EQ(2, num_executed);
 }
 
+TEST(init, PropertyTriggers) {
+    std::string init_script =
+            R"init(
+on property:test.a=1
+run a1
+on property:test.b=1
+run b1
+on property:test.a=*
+run a_any
+on boot && property:test.a=1
+run boot_a1
+)init";
+
+    std::vector<std::string> runs;
+    auto run_command = [&runs](const BuiltinArguments& args) {
+        runs.emplace_back(args[1]);
+        return Result<void>{};
+    };
+    BuiltinFunctionMap test_function_map = {
+            {"run", {1, 1, {false, run_command}}},
+    };
+
+    ActionManagerCommand change_a = [](ActionManager& am) {
+        am.QueuePropertyChange("test.a", "1");
+        am.QueuePropertyChange("test.c", "1");
+    };
+    std::vector<ActionManagerCommand> commands{change_a};
+
+    ActionManager action_manager;
+    ServiceList service_list;
+    TestInitText(init_script, test_function_map, commands, &action_manager, &service_list);
+    EXPECT_EQ(runs, (std::vector<std::string>{"a1", "a_any"}));
+
+    // Removed actions are no longer triggered.
+    action_manager.RemoveActionIf([](const std::unique_ptr<Action>& action) {
+        return action->property_triggers().count("test.a") &&
+               action->property_triggers().at("test.a") == "1";
+    });
+    runs.clear();
+    action_manager.QueuePropertyChange("test.a", "1");
+    action_manager.QueuePropertyChange("test.b", "1");
+    while (action_manager.HasMoreCommands()) {
+        action_manager.ExecuteOneCommand();
+    }
+    EXPECT_EQ(runs, (std::vector<std::string>{"a_any", "b1"}));
+}
+
 TEST(init, RejectsNoUserStartingInV) {
     std::string init_script =
             R"init(
@@ -22,7 +22,10 @@
 #include <sys/system_properties.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <unordered_map>
 
 #include <android-base/file.h>
@@ -34,6 +37,7 @@
 
 using android::base::Dirname;
 using android::base::ReadFdToString;
+using android::base::ReadFileToString;
 using android::base::StartsWith;
 using android::base::unique_fd;
 using android::base::WriteStringToFd;
@@ -47,6 +51,40 @@ namespace {
 
 constexpr const char kLegacyPersistentPropertyDir[] = "/data/property";
 
+// Updates since the last write of persistent_property_filename are appended to a journal next to
+// it, so that setting a property does not rewrite every persistent property. Each record of the
+// journal is a JournalRecordHeader followed by a serialized PersistentProperties holding the
+// properties set by one batch of updates. The first record only carries the journal_generation of
+// the snapshot that the journal applies to, so that a journal left behind by a crash after the
+// snapshot was replaced is not replayed on top of the new one. The journal is compacted into
+// persistent_property_filename once it is larger than both kMinJournalSizeToCompact and the
+// snapshot itself.
+constexpr uint32_t kJournalRecordMagic = 0x4c4e524a;  // "JRNL"
+constexpr size_t kMinJournalSizeToCompact = 64 * 1024;
+
+struct JournalRecordHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t checksum;
+};
+
+std::string JournalFilename() {
+    return persistent_property_filename + ".journal";
+}
+
+// FNV-1a, to tell records torn by a crash from complete ones.
+uint32_t JournalChecksum(const std::string& data) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+bool IsPersistentPropertyName(const std::string& name) {
+    return StartsWith(name, "persist.") || StartsWith(name, "next_boot.");
+}
+
 void AddPersistentProperty(const std::string& name, const std::string& value,
                            PersistentProperties* persistent_properties) {
     auto persistent_property_record = persistent_properties->add_properties();
@@ -54,6 +92,178 @@ void AddPersistentProperty(const std::string& name, const std::string& value,
     persistent_property_record->set_value(value);
 }
 
+// PersistentProperties with an index of its records by name.
+class IndexedPersistentProperties {
+  public:
+    explicit IndexedPersistentProperties(PersistentProperties properties = {})
+        : properties_(std::move(properties)) {
+        for (int i = 0; i < properties_.properties_size(); i++) {
+            index_[properties_.properties(i).name()] = i;
+        }
+    }
+
+    // Returns false if name already has this value.
+    bool Set(const std::string& name, const std::string& value) {
+        auto [it, inserted] = index_.emplace(name, properties_.properties_size());
+        if (inserted) {
+            AddPersistentProperty(name, value, &properties_);
+            return true;
+        }
+        auto record = properties_.mutable_properties(it->second);
+        if (record->value() == value) {
+            return false;
+        }
+        record->set_value(value);
+        return true;
+    }
+
+    const PersistentProperties& properties() const { return properties_; }
+
+  private:
+    PersistentProperties properties_;
+    std::unordered_map<std::string, int> index_;
+};
+
+// Applies the records of journal to persistent_properties. Returns the size of the leading valid
+// records; anything after them was torn by a crash or is corrupted. Nothing is valid in a journal
+// that does not start with generation, the journal_generation of the snapshot.
+size_t ReplayJournal(const std::string& journal, uint64_t generation,
+                     IndexedPersistentProperties* persistent_properties) {
+    size_t offset = 0;
+    while (journal.size() - offset >= sizeof(JournalRecordHeader)) {
+        JournalRecordHeader header;
+        memcpy(&header, journal.data() + offset, sizeof(header));
+        if (header.magic != kJournalRecordMagic ||
+            header.size > journal.size() - offset - sizeof(header)) {
+            break;
+        }
+        std::string payload = journal.substr(offset + sizeof(header), header.size);
+        PersistentProperties record;
+        if (JournalChecksum(payload) != header.checksum || !record.ParseFromString(payload) ||
+            !std::all_of(record.properties().begin(), record.properties().end(),
+                         [](const auto& prop) { return IsPersistentPropertyName(prop.name()); })) {
+            break;
+        }
+        if (offset == 0 && record.journal_generation() != generation) {
+            break;
+        }
+        for (const auto& prop : record.properties()) {
+            persistent_properties->Set(prop.name(), prop.value());
+        }
+        offset += sizeof(header) + header.size;
+    }
+    return offset;
+}
+
+// The persistent properties of persistent_property_filename and its journal, as last read or
+// written, so that updates do not need to read them again.
+struct PersistentPropertyState {
+    std::string filename;
+    // Identity of the snapshot, to notice that it was replaced behind our back.
+    ino_t snapshot_ino = 0;
+    struct timespec snapshot_mtime = {};
+    size_t snapshot_size = 0;
+    IndexedPersistentProperties properties;
+    unique_fd journal_fd;
+    size_t journal_size = 0;
+    uint64_t journal_generation = 0;
+};
+
+std::mutex state_lock;
+PersistentPropertyState state;
+
+void SetSnapshot(const struct stat& sb) {
+    state.snapshot_ino = sb.st_ino;
+    state.snapshot_mtime = sb.st_mtim;
+    state.snapshot_size = sb.st_size;
+}
+
+bool IsStateCurrent() {
+    struct stat sb;
+    if (state.filename != persistent_property_filename ||
+        stat(state.filename.c_str(), &sb) == -1 || sb.st_ino != state.snapshot_ino ||
+        static_cast<size_t>(sb.st_size) != state.snapshot_size ||
+        sb.st_mtim.tv_sec != state.snapshot_mtime.tv_sec ||
+        sb.st_mtim.tv_nsec != state.snapshot_mtime.tv_nsec) {
+        return false;
+    }
+    return state.journal_fd == -1 || (fstat(state.journal_fd.get(), &sb) == 0 && sb.st_nlink > 0);
+}
+
+Result<void> FsyncDirectory(const std::string& path) {
+    auto dir = Dirname(path);
+    auto dir_fd = unique_fd{open(dir.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC)};
+    if (dir_fd < 0) {
+        return ErrnoError() << "Unable to open persistent properties directory for fsync()";
+    }
+    fsync(dir_fd.get());
+    return {};
+}
+
+Result<void> OpenJournal() {
+    const std::string journal_filename = JournalFilename();
+    bool existed = access(journal_filename.c_str(), F_OK) == 0;
+    state.journal_fd.reset(TEMP_FAILURE_RETRY(
+            open(journal_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                 0600)));
+    if (state.journal_fd == -1) {
+        return ErrnoError() << "Could not open persistent property journal";
+    }
+    struct stat sb;
+    if (fstat(state.journal_fd.get(), &sb) == -1) {
+        Result<void> error = ErrnoError() << "fstat on persistent property journal failed";
+        state.journal_fd.reset();
+        return error;
+    }
+    state.journal_size = sb.st_size;
+    // Like the rename() of the snapshot, the creation of the journal is only durable once the
+    // directory is.
+    if (!existed) {
+        return FsyncDirectory(journal_filename);
+    }
+    return {};
+}
+
+Result<void> AppendJournalRecord(const PersistentProperties& record) {
+    if (state.journal_fd == -1) {
+        if (auto result = OpenJournal(); !result.ok()) return result;
+    }
+
+    std::string data;
+    auto append_record = [&data](const PersistentProperties& record) {
+        std::string payload;
+        if (!record.SerializeToString(&payload)) {
+            return false;
+        }
+        JournalRecordHeader header = {kJournalRecordMagic, static_cast<uint32_t>(payload.size()),
+                                      JournalChecksum(payload)};
+        data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        data += payload;
+        return true;
+    };
+    if (state.journal_size == 0) {
+        PersistentProperties generation_record;
+        generation_record.set_journal_generation(state.journal_generation);
+        if (!append_record(generation_record)) {
+            return Error() << "Unable to serialize journal generation";
+        }
+    }
+    if (!append_record(record)) {
+        return Error() << "Unable to serialize properties";
+    }
+
+    if (!WriteStringToFd(data, state.journal_fd) || fdatasync(state.journal_fd.get()) == -1) {
+        Result<void> error = ErrnoError() << "Unable to append to persistent property journal";
+        // Don't leave a partial record for the next one to follow.
+        if (ftruncate(state.journal_fd.get(), state.journal_size) == -1) {
+            state.journal_fd.reset();
+        }
+        return error;
+    }
+    state.journal_size += data.size();
+    return {};
+}
+
 Result<PersistentProperties> LoadLegacyPersistentProperties() {
     std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(kLegacyPersistentPropertyDir), closedir);
     if (!dir) {
@@ -144,7 +354,7 @@ Result<PersistentProperties> ParsePersistentPropertyFile(const std::string& file
         return Error() << "Unable to parse persistent property file: Could not parse protobuf";
     }
     for (auto& prop : persistent_properties.properties()) {
-        if (!StartsWith(prop.name(), "persist.") && !StartsWith(prop.name(), "next_boot.")) {
+        if (!IsPersistentPropertyName(prop.name())) {
             return Error() << "Unable to load persistent property file: property '" << prop.name()
                            << "' doesn't start with 'persist.' or 'next_boot.'";
         }
@@ -152,36 +362,70 @@ Result<PersistentProperties> ParsePersistentPropertyFile(const std::string& file
     return persistent_properties;
 }
 
-}  // namespace
-
-Result<PersistentProperties> LoadPersistentPropertyFile() {
+// Reads persistent_property_filename and applies its journal.
+Result<PersistentProperties> LoadPersistentPropertyFileLocked() {
+    const std::string journal_filename = JournalFilename();
     auto file_contents = ReadPersistentPropertyFile();
-    if (!file_contents.ok()) return file_contents.error();
+    if (!file_contents.ok()) {
+        unlink(journal_filename.c_str());
+        return file_contents.error();
+    }
 
     auto persistent_properties = ParsePersistentPropertyFile(*file_contents);
     if (!persistent_properties.ok()) {
         // If the file cannot be parsed in either format, then we don't have any recovery
         // mechanisms, so we delete it to allow for future writes to take place successfully.
         unlink(persistent_property_filename.c_str());
+        unlink(journal_filename.c_str());
+        return persistent_properties;
     }
-    return persistent_properties;
+
+    std::string journal;
+    if (!ReadFileToString(journal_filename, &journal)) {
+        return persistent_properties;
+    }
+    const uint64_t generation = persistent_properties->journal_generation();
+    IndexedPersistentProperties properties(std::move(*persistent_properties));
+    size_t valid_size = ReplayJournal(journal, generation, &properties);
+    if (valid_size < journal.size()) {
+        LOG(WARNING) << "Dropping " << journal.size() - valid_size
+                     << " bytes of torn, corrupted or stale persistent property journal";
+        truncate(journal_filename.c_str(), valid_size);
+        state.filename.clear();
+    }
+    return properties.properties();
 }
 
-Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_properties) {
+// Replaces persistent_property_filename with persistent_properties, and empties the journal.
+Result<void> WritePersistentPropertyFileLocked(const PersistentProperties& persistent_properties) {
+    // A fresh generation, so that the journal of the snapshot being replaced never matches it.
+    static std::mt19937_64 generations{std::random_device{}()};
+    uint64_t generation;
+    do {
+        generation = generations();
+    } while (generation == 0 || generation == state.journal_generation);
+
     const std::string temp_filename = persistent_property_filename + ".tmp";
     unique_fd fd(TEMP_FAILURE_RETRY(
         open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0600)));
     if (fd == -1) {
         return ErrnoError() << "Could not open temporary properties file";
     }
+    PersistentProperties snapshot = persistent_properties;
+    snapshot.set_journal_generation(generation);
     std::string serialized_string;
-    if (!persistent_properties.SerializeToString(&serialized_string)) {
+    if (!snapshot.SerializeToString(&serialized_string)) {
         return Error() << "Unable to serialize properties";
     }
     if (!WriteStringToFd(serialized_string, fd)) {
         return ErrnoError() << "Unable to write file contents";
     }
     fsync(fd.get());
+    struct stat sb;
+    bool have_identity = fstat(fd.get(), &sb) == 0;
+    if (!have_identity) {
+        PLOG(WARNING) << "fstat on temporary properties file failed";
+    }
     fd.reset();
 
     if (rename(temp_filename.c_str(), persistent_property_filename.c_str())) {
@@ -194,16 +438,52 @@ Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_
     // directories must be fsync()'ed otherwise, the rename is not necessarily written to storage.
     // Note in this case, that the source and destination directories are the same, so only one
     // fsync() is required.
-    auto dir = Dirname(persistent_property_filename);
-    auto dir_fd = unique_fd{open(dir.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC)};
-    if (dir_fd < 0) {
-        return ErrnoError() << "Unable to open persistent properties directory for fsync()";
+    if (auto result = FsyncDirectory(persistent_property_filename); !result.ok()) {
+        return result;
+    }
+
+    // The new snapshot contains every record of the journal. A journal that survives a crash
+    // before it is emptied still starts with the generation of the previous snapshot, so it is
+    // dropped instead of being replayed, which could bring back next_boot. properties that were
+    // just applied. Emptying it is only needed to start the new generation.
+    if (state.filename != persistent_property_filename) {
+        state.journal_fd.reset();
+    }
+    if (state.journal_fd == -1) {
+        state.journal_fd.reset(TEMP_FAILURE_RETRY(
+                open(JournalFilename().c_str(), O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC)));
+    }
+    if (state.journal_fd != -1) {
+        if (ftruncate(state.journal_fd.get(), 0) == -1 || fsync(state.journal_fd.get()) == -1) {
+            return ErrnoError() << "Unable to empty persistent property journal";
+        }
     }
-    fsync(dir_fd.get());
 
+    state.journal_size = 0;
+    state.journal_generation = generation;
+    if (!have_identity) {
+        // Without the identity of the snapshot, read it back on the next write.
+        state.filename.clear();
+        return {};
+    }
+    state.filename = persistent_property_filename;
+    SetSnapshot(sb);
+    state.properties = IndexedPersistentProperties(std::move(snapshot));
     return {};
 }
 
+}  // namespace
+
+Result<PersistentProperties> LoadPersistentPropertyFile() {
+    std::lock_guard lock(state_lock);
+    return LoadPersistentPropertyFileLocked();
+}
+
+Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_properties) {
+    std::lock_guard lock(state_lock);
+    return WritePersistentPropertyFileLocked(persistent_properties);
+}
+
 PersistentProperties LoadPersistentPropertiesFromMemory() {
     PersistentProperties persistent_properties;
     __system_property_foreach(
@@ -222,36 +502,69 @@ PersistentProperties LoadPersistentPropertiesFromMemory() {
     return persistent_properties;
 }
 
-// Persistent properties are not written often, so we rather not keep any data in memory and read
-// then rewrite the persistent property file for each update.
 void WritePersistentProperty(const std::string& name, const std::string& value) {
-    auto persistent_properties = LoadPersistentPropertyFile();
+    WritePersistentProperties({{name, value}});
+}
 
-    if (!persistent_properties.ok()) {
-        LOG(ERROR) << "Recovering persistent properties from memory: "
-                   << persistent_properties.error();
-        persistent_properties = LoadPersistentPropertiesFromMemory();
+void WritePersistentProperties(const std::vector<std::pair<std::string, std::string>>& properties) {
+    std::lock_guard lock(state_lock);
+
+    bool write_snapshot = false;
+    if (!IsStateCurrent()) {
+        auto persistent_properties = LoadPersistentPropertyFileLocked();
+        if (!persistent_properties.ok()) {
+            LOG(ERROR) << "Recovering persistent properties from memory: "
+                       << persistent_properties.error();
+            persistent_properties = LoadPersistentPropertiesFromMemory();
+            write_snapshot = true;
+        }
+        struct stat sb = {};
+        if (!write_snapshot) {
+            stat(persistent_property_filename.c_str(), &sb);
+        }
+        state.filename = persistent_property_filename;
+        SetSnapshot(sb);
+        state.journal_generation = persistent_properties->journal_generation();
+        state.properties = IndexedPersistentProperties(std::move(*persistent_properties));
+        state.journal_fd.reset();
+    }
+
+    PersistentProperties record;
+    for (const auto& [name, value] : properties) {
+        // These would make the whole file unreadable.
+        if (!IsPersistentPropertyName(name)) {
+            LOG(ERROR) << "Not storing non-persistent property '" << name << "'";
+            continue;
+        }
+        if (state.properties.Set(name, value)) {
+            AddPersistentProperty(name, value, &record);
+        }
+    }
+    if (record.properties().empty() && !write_snapshot) {
+        return;
     }
-    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
-                           persistent_properties->mutable_properties()->end(),
-                           [&name](const auto& record) { return record.name() == name; });
-    if (it != persistent_properties->mutable_properties()->end()) {
-        if (it->value() == value) {
+
+    if (!write_snapshot) {
+        if (auto result = AppendJournalRecord(record); !result.ok()) {
+            LOG(ERROR) << "Could not append persistent property to journal: " << result.error();
+            write_snapshot = true;
+        } else if (state.journal_size < kMinJournalSizeToCompact ||
+                   state.journal_size < state.snapshot_size) {
             return;
         }
-        it->set_name(name);
-        it->set_value(value);
-    } else {
-        AddPersistentProperty(name, value, &persistent_properties.value());
     }
 
-    if (auto result = WritePersistentPropertyFile(*persistent_properties); !result.ok()) {
+    if (auto result = WritePersistentPropertyFileLocked(state.properties.properties());
+        !result.ok()) {
         LOG(ERROR) << "Could not store persistent property: " << result.error();
+        // Read everything back on the next write.
+        state.filename.clear();
     }
 }
 
 PersistentProperties LoadPersistentProperties() {
-    auto persistent_properties = LoadPersistentPropertyFile();
+    std::lock_guard lock(state_lock);
+    auto persistent_properties = LoadPersistentPropertyFileLocked();
 
     if (!persistent_properties.ok()) {
         LOG(ERROR) << "Could not load single persistent property file, trying legacy directory: "
@@ -262,7 +575,7 @@ PersistentProperties LoadPersistentProperties() {
                        << persistent_properties.error();
             return {};
         }
-        if (auto result = WritePersistentPropertyFile(*persistent_properties); result.ok()) {
+        if (auto result = WritePersistentPropertyFileLocked(*persistent_properties); result.ok()) {
             RemoveLegacyPersistentPropertyFiles();
         } else {
             LOG(ERROR) << "Unable to write single persistent property file: " << result.error();
@@ -312,7 +625,7 @@ PersistentProperties LoadPersistentProperties() {
     }
 
     // write current updated persist prop file
-    auto result = WritePersistentPropertyFile(updated_persistent_properties);
+    auto result = WritePersistentPropertyFileLocked(updated_persistent_properties);
     if (!result.ok()) {
         LOG(ERROR) << "Could not store persistent property: " << result.error();
     }
@@ -320,7 +633,5 @@ PersistentProperties LoadPersistentProperties() {
     return updated_persistent_properties;
 }
 
-
-
 }  // namespace init
 }  // namespace android
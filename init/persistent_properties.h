@@ -18,6 +18,8 @@
 #define _INIT_PERSISTENT_PROPERTIES_H
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "result.h"
 #include "system/core/init/persistent_properties.pb.h"
@@ -27,6 +29,8 @@ namespace init {
 
 PersistentProperties LoadPersistentProperties();
 void WritePersistentProperty(const std::string& name, const std::string& value);
+// Stores several properties with a single write to storage.
+void WritePersistentProperties(const std::vector<std::pair<std::string, std::string>>& properties);
 PersistentProperties LoadPersistentPropertiesFromMemory();
 
 // Exposed only for testing
@@ -69,10 +69,19 @@ void CheckPropertiesEqual(std::vector<std::pair<std::string, std::string>> expec
     EXPECT_TRUE(expected.empty()) << "Did not find expected properties:" << joiner(expected);
 }
 
+// A temporary persistent property file, which also removes the journal that updates leave next
+// to it.
+class TemporaryPersistentPropertyFile : public TemporaryFile {
+  public:
+    TemporaryPersistentPropertyFile() { persistent_property_filename = path; }
+    ~TemporaryPersistentPropertyFile() { unlink(journal_path().c_str()); }
+
+    std::string journal_path() const { return path + ".journal"s; }
+};
+
 TEST(persistent_properties, EndToEnd) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     std::vector<std::pair<std::string, std::string>> persistent_properties = {
         {"persist.sys.locale", "en-US"},
@@ -94,9 +103,8 @@ TEST(persistent_properties, EndToEnd) {
 }
 
 TEST(persistent_properties, AddProperty) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     std::vector<std::pair<std::string, std::string>> persistent_properties = {
         {"persist.sys.timezone", "America/Los_Angeles"},
@@ -116,9 +124,8 @@ TEST(persistent_properties, AddProperty) {
 }
 
 TEST(persistent_properties, UpdateProperty) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     std::vector<std::pair<std::string, std::string>> persistent_properties = {
         {"persist.sys.locale", "en-US"},
@@ -139,9 +146,8 @@ TEST(persistent_properties, UpdateProperty) {
 }
 
 TEST(persistent_properties, UpdatePropertyBadParse) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     ASSERT_RESULT_OK(WriteFile(tf.path, "ab"));
 
@@ -159,9 +165,8 @@ TEST(persistent_properties, UpdatePropertyBadParse) {
 }
 
 TEST(persistent_properties, NopUpdateDoesntWriteFile) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     auto last_modified = [&tf]() -> time_t {
         struct stat buf;
@@ -184,9 +189,8 @@ TEST(persistent_properties, NopUpdateDoesntWriteFile) {
 }
 
 TEST(persistent_properties, RejectNonPersistProperty) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     WritePersistentProperty("notpersist.sys.locale", "pt-BR");
 
@@ -207,9 +211,8 @@ TEST(persistent_properties, RejectNonPersistProperty) {
 }
 
 TEST(persistent_properties, StagedPersistProperty) {
-    TemporaryFile tf;
+    TemporaryPersistentPropertyFile tf;
     ASSERT_TRUE(tf.fd != -1);
-    persistent_property_filename = tf.path;
 
     std::vector<std::pair<std::string, std::string>> persistent_properties = {
         {"persist.sys.locale", "en-US"},
@@ -238,5 +241,132 @@ TEST(persistent_properties, StagedPersistProperty) {
     CheckPropertiesEqual(expected_persistent_properties, second_read_back_properties);
 }
 
+TEST(persistent_properties, UpdatesAreJournaled) {
+    TemporaryPersistentPropertyFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    const std::string journal_filename = tf.journal_path();
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+            {"persist.sys.locale", "en-US"},
+            {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+    auto snapshot = ReadFile(tf.path);
+    ASSERT_RESULT_OK(snapshot);
+
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    WritePersistentProperties({{"persist.test.a", "1"}, {"persist.test.b", "2"}});
+
+    // The snapshot is left alone, and the updates are replayed from the journal.
+    auto snapshot_after = ReadFile(tf.path);
+    ASSERT_RESULT_OK(snapshot_after);
+    EXPECT_EQ(*snapshot, *snapshot_after);
+    struct stat sb;
+    ASSERT_EQ(stat(journal_filename.c_str(), &sb), 0);
+    EXPECT_GT(sb.st_size, 0);
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+            {"persist.sys.locale", "pt-BR"},
+            {"persist.sys.timezone", "America/Los_Angeles"},
+            {"persist.test.a", "1"},
+            {"persist.test.b", "2"},
+    };
+    auto read_back_properties = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(read_back_properties);
+    CheckPropertiesEqual(persistent_properties_expected, *read_back_properties);
+}
+
+TEST(persistent_properties, TornJournalRecordIsDropped) {
+    TemporaryPersistentPropertyFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    const std::string journal_filename = tf.journal_path();
+
+    ASSERT_RESULT_OK(WritePersistentPropertyFile(
+            VectorToPersistentProperties({{"persist.sys.locale", "en-US"}})));
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    struct stat sb;
+    ASSERT_EQ(stat(journal_filename.c_str(), &sb), 0);
+    const off_t valid_size = sb.st_size;
+
+    // Simulate a crash in the middle of appending the next record.
+    WritePersistentProperty("persist.sys.timezone", "America/Los_Angeles");
+    ASSERT_EQ(stat(journal_filename.c_str(), &sb), 0);
+    ASSERT_EQ(truncate(journal_filename.c_str(), sb.st_size - 1), 0);
+
+    auto read_back_properties = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(read_back_properties);
+    CheckPropertiesEqual({{"persist.sys.locale", "pt-BR"}}, *read_back_properties);
+    ASSERT_EQ(stat(journal_filename.c_str(), &sb), 0);
+    EXPECT_EQ(sb.st_size, valid_size);
+
+    // Later updates follow the last valid record.
+    WritePersistentProperty("persist.sys.timezone", "Europe/Paris");
+    read_back_properties = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(read_back_properties);
+    CheckPropertiesEqual(
+            {{"persist.sys.locale", "pt-BR"}, {"persist.sys.timezone", "Europe/Paris"}},
+            *read_back_properties);
+}
+
+TEST(persistent_properties, StaleJournalIsDropped) {
+    TemporaryPersistentPropertyFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    const std::string journal_filename = tf.journal_path();
+
+    ASSERT_RESULT_OK(WritePersistentPropertyFile(
+            VectorToPersistentProperties({{"persist.sys.locale", "en-US"}})));
+    WritePersistentProperty("next_boot.persist.sys.locale", "pt-BR");
+    auto journal = ReadFile(journal_filename);
+    ASSERT_RESULT_OK(journal);
+
+    // Simulate a crash after the staged property was applied to a new snapshot, but before the
+    // journal of the previous one was emptied.
+    ASSERT_RESULT_OK(WritePersistentPropertyFile(
+            VectorToPersistentProperties({{"persist.sys.locale", "pt-BR"}})));
+    ASSERT_TRUE(android::base::WriteStringToFile(*journal, journal_filename));
+
+    auto read_back_properties = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(read_back_properties);
+    CheckPropertiesEqual({{"persist.sys.locale", "pt-BR"}}, *read_back_properties);
+    struct stat sb;
+    ASSERT_EQ(stat(journal_filename.c_str(), &sb), 0);
+    EXPECT_EQ(sb.st_size, 0);
+
+    // Later updates start a journal for the new snapshot.
+    WritePersistentProperty("persist.sys.timezone", "Europe/Paris");
+    read_back_properties = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(read_back_properties);
+    CheckPropertiesEqual(
+            {{"persist.sys.locale", "pt-BR"}, {"persist.sys.timezone", "Europe/Paris"}},
+            *read_back_properties);
+}
+
+TEST(persistent_properties, JournalIsCompacted) {
+    TemporaryPersistentPropertyFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    const std::string journal_filename = tf.journal_path();
+
+    ASSERT_RESULT_OK(WritePersistentPropertyFile(
+            VectorToPersistentProperties({{"persist.sys.locale", "en-US"}})));
+
+    // Enough updates of one property to overflow the journal several times.
+    const std::string value(1024, 'x');
+    for (int i = 0; i < 256; i++) {
+        WritePersistentProperty("persist.test.value", value + std::to_string(i));
+    }
+
+    struct stat sb;
+    ASSERT_EQ(stat(journal_filename.c_str(), &sb), 0);
+    EXPECT_LT(sb.st_size, 64 * 1024);
+    ASSERT_EQ(stat(tf.path, &sb), 0);
+    EXPECT_GT(sb.st_size, 1024);
+
+    auto read_back_properties = LoadPersistentPropertyFile();
+    ASSERT_RESULT_OK(read_back_properties);
+    CheckPropertiesEqual({{"persist.sys.locale", "en-US"}, {"persist.test.value", value + "255"}},
+                         *read_back_properties);
+}
+
 }  // namespace init
 }  // namespace android
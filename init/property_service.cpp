@@ -39,6 +39,7 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -117,6 +118,9 @@ constexpr auto LEGACY_ID_PROP = "ro.build.legacy.id";
 constexpr auto VBMETA_DIGEST_PROP = "ro.boot.vbmeta.digest";
 constexpr auto DIGEST_SIZE_USED = 8;
 
+// Persistent writes at least this slow are logged even when they are not batched.
+constexpr auto kSlowPersistWrite = 100ms;
+
 static bool persistent_properties_loaded = false;
 
 static int from_init_socket = -1;
@@ -200,6 +204,14 @@ void NotifyPropertyChange(const std::string& name, const std::string& value) {
     }
 }
 
+static void NotifyPropertiesChange(
+        const std::vector<std::pair<std::string, std::string>>& properties) {
+    auto lock = std::lock_guard{accept_messages_lock};
+    if (accept_messages) {
+        PropertiesChanged(properties);
+    }
+}
+
 class AsyncRestorecon {
   public:
     void TriggerRestorecon(const std::string& path) {
@@ -374,23 +386,44 @@ class SocketConnection {
     DISALLOW_COPY_AND_ASSIGN(SocketConnection);
 };
 
+// Side effects of the properties of a PROP_MSG_SETPROP_BATCH message, deferred so that they are
+// applied once for the whole batch.
+struct PropertyBatch {
+    std::vector<std::pair<std::string, std::string>> persistent;
+    std::vector<std::pair<std::string, std::string>> changed;
+};
+
 class PersistWriteThread {
   public:
     PersistWriteThread();
     void Write(std::string name, std::string value, SocketConnection socket);
+    // Stores batch.persistent, then notifies init of batch.changed and replies result.
+    void Write(PropertyBatch batch, uint32_t result, SocketConnection socket);
 
   private:
     void Work();
 
   private:
+    struct Item {
+        PropertyBatch batch;
+        uint32_t result;
+        SocketConnection socket;
+    };
+
     std::thread thread_;
     std::mutex mutex_;
     std::condition_variable cv_;
-    std::deque<std::tuple<std::string, std::string, SocketConnection>> work_;
+    std::deque<Item> work_;
+    // Largest size of work_ since the writer thread last took it, guarded by mutex_.
+    size_t max_queue_depth_ = 0;
+
+    // Only accessed by the writer thread.
+    size_t batches_ = 0;
 };
 
 static std::optional<uint32_t> PropertySet(const std::string& name, const std::string& value,
-                                           SocketConnection* socket, std::string* error) {
+                                           SocketConnection* socket, std::string* error,
+                                           PropertyBatch* batch = nullptr) {
     size_t valuelen = value.size();
 
     if (!IsLegalPropertyName(name)) {
@@ -428,6 +461,13 @@ static std::optional<uint32_t> PropertySet(const std::string& name, const std::s
         // Don't write properties to disk until after we have read all default
         // properties to prevent them from being overwritten by default values.
         bool need_persist = StartsWith(name, "persist.") || StartsWith(name, "next_boot.");
+        if (batch) {
+            if (persistent_properties_loaded && need_persist) {
+                batch->persistent.emplace_back(name, value);
+            }
+            batch->changed.emplace_back(name, value);
+            return {PROP_SUCCESS};
+        }
         if (socket && persistent_properties_loaded && need_persist) {
             if (persist_write_thread) {
                 persist_write_thread->Write(name, value, std::move(*socket));
@@ -548,7 +588,8 @@ uint32_t CheckPermissions(const std::string& name, const std::string& value,
 // if asynchronous.
 std::optional<uint32_t> HandlePropertySet(const std::string& name, const std::string& value,
                                           const std::string& source_context, const ucred& cr,
-                                          SocketConnection* socket, std::string* error) {
+                                          SocketConnection* socket, std::string* error,
+                                          PropertyBatch* batch = nullptr) {
     if (auto ret = CheckPermissions(name, value, source_context, cr, error); ret != PROP_SUCCESS) {
         return {ret};
     }
@@ -586,7 +627,7 @@ std::optional<uint32_t> HandlePropertySet(const std::string& name, const std::st
         return {PROP_SUCCESS};
     }
 
-    return PropertySet(name, value, socket, error);
+    return PropertySet(name, value, socket, error, batch);
 }
 
 // Helper for HandlePropertySet, for the case where no socket is used, and
@@ -599,6 +640,41 @@ uint32_t HandlePropertySetNoSocket(const std::string& name, const std::string& v
     return *ret;
 }
 
+// Sets the properties of a PROP_MSG_SETPROP_BATCH message. Persistent properties are stored with
+// a single write, and init is notified of every change at once. Returns PROP_SUCCESS, or the
+// error of the first property that could not be set, or std::nullopt if the persistent write
+// was handed to persist_write_thread, which replies on socket once it is done.
+static std::optional<uint32_t> HandlePropertySetBatch(
+        const std::vector<std::pair<std::string, std::string>>& properties,
+        const std::string& source_context, const ucred& cr, SocketConnection* socket) {
+    uint32_t result = PROP_SUCCESS;
+    PropertyBatch batch;
+    for (const auto& [name, value] : properties) {
+        std::string error;
+        auto ret = HandlePropertySet(name, value, source_context, cr, nullptr, &error, &batch);
+        CHECK(ret.has_value());
+        if (*ret != PROP_SUCCESS) {
+            LOG(ERROR) << "Unable to set property '" << name << "' from uid:" << cr.uid
+                       << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
+            if (result == PROP_SUCCESS) {
+                result = *ret;
+            }
+        }
+    }
+
+    if (!batch.persistent.empty()) {
+        // Go through the same queue as single sets, so that the writes reach the disk in the
+        // order in which the properties were set.
+        if (persist_write_thread) {
+            persist_write_thread->Write(std::move(batch), result, std::move(*socket));
+            return {};
+        }
+        WritePersistentProperties(batch.persistent);
+    }
+    NotifyPropertiesChange(batch.changed);
+    return {result};
+}
+
 static void handle_property_set_fd(int fd) {
     static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
 
@@ -689,6 +765,52 @@ static void handle_property_set_fd(int fd) {
         break;
       }
 
+    case PROP_MSG_SETPROP_BATCH: {
+        uint32_t count = 0;
+        if (!socket.RecvUint32(&count, &timeout_ms)) {
+            PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading count from the "
+                           "socket";
+            socket.SendUint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+        // Don't allow init to make arbitrarily large allocations.
+        if (count > kMaxPropertySetBatchSize) {
+            LOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): batch of " << count
+                       << " properties is too large";
+            socket.SendUint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+
+        std::vector<std::pair<std::string, std::string>> properties(count);
+        for (auto& [name, value] : properties) {
+            if (!socket.RecvString(&name, &timeout_ms) ||
+                !socket.RecvString(&value, &timeout_ms)) {
+                PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading name/value "
+                               "from the socket";
+                socket.SendUint32(PROP_ERROR_READ_DATA);
+                return;
+            }
+        }
+
+        // A single getpeercon() for the whole batch.
+        std::string source_context;
+        if (!socket.GetSourceContext(&source_context)) {
+            PLOG(ERROR) << "Unable to set " << count << " properties: getpeercon() failed";
+            socket.SendUint32(PROP_ERROR_PERMISSION_DENIED);
+            return;
+        }
+
+        // HandlePropertySetBatch takes ownership of the socket if the set is handled
+        // asynchronously.
+        auto result = HandlePropertySetBatch(properties, source_context, socket.cred(), &socket);
+        if (!result) {
+            // Result will be sent after completion.
+            return;
+        }
+        socket.SendUint32(*result);
+        break;
+      }
+
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
         socket.SendUint32(PROP_ERROR_INVALID_CMD);
@@ -1501,9 +1623,11 @@ PersistWriteThread::PersistWriteThread() {
 
 void PersistWriteThread::Work() {
     while (true) {
-        std::tuple<std::string, std::string, SocketConnection> item;
+        std::deque<Item> batch;
+        size_t max_queue_depth;
 
-        // Grab the next item within the lock.
+        // Grab every pending item within the lock, so that a burst of writes is stored with a
+        // single write/fsync.
         {
             std::unique_lock<std::mutex> lock(mutex_);
 
@@ -1511,23 +1635,48 @@ void PersistWriteThread::Work() {
                 cv_.wait(lock);
             }
 
-            item = std::move(work_.front());
-            work_.pop_front();
+            batch.swap(work_);
+            max_queue_depth = max_queue_depth_;
+            max_queue_depth_ = 0;
         }
 
         // Perform write/fsync outside the lock.
-        WritePersistentProperty(std::get<0>(item), std::get<1>(item));
-        NotifyPropertyChange(std::get<0>(item), std::get<1>(item));
+        Timer t;
+        std::vector<std::pair<std::string, std::string>> properties;
+        for (const auto& item : batch) {
+            properties.insert(properties.end(), item.batch.persistent.begin(),
+                              item.batch.persistent.end());
+        }
+        WritePersistentProperties(properties);
+
+        // Writes that queue up behind a slow one, or that are slow themselves, are what delay
+        // the callers of setprop.
+        batches_++;
+        if (batch.size() > 1 || t.duration() >= kSlowPersistWrite) {
+            LOG(INFO) << "Persisted " << properties.size() << " properties from "
+                      << batch.size() << " requests in " << t << " (batch " << batches_
+                      << ", queue depth up to " << max_queue_depth << ")";
+        }
 
-        SocketConnection& socket = std::get<2>(item);
-        socket.SendUint32(PROP_SUCCESS);
+        for (auto& item : batch) {
+            NotifyPropertiesChange(item.batch.changed);
+            item.socket.SendUint32(item.result);
+        }
     }
 }
 
 void PersistWriteThread::Write(std::string name, std::string value, SocketConnection socket) {
+    PropertyBatch batch;
+    batch.persistent.emplace_back(name, value);
+    batch.changed.emplace_back(std::move(name), std::move(value));
+    Write(std::move(batch), PROP_SUCCESS, std::move(socket));
+}
+
+void PersistWriteThread::Write(PropertyBatch batch, uint32_t result, SocketConnection socket) {
     {
         std::unique_lock<std::mutex> lock(mutex_);
-        work_.emplace_back(std::move(name), std::move(value), std::move(socket));
+        work_.push_back({std::move(batch), result, std::move(socket)});
+        max_queue_depth_ = std::max(max_queue_depth_, work_.size());
     }
     cv_.notify_all();
 }
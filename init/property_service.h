@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <sys/socket.h>
 
 #include <condition_variable>
@@ -31,6 +32,14 @@ namespace init {
 
 static constexpr const char kRestoreconProperty[] = "selinux.restorecon_recursive";
 
+// Sets several properties over one connection to the property service: a uint32_t count, followed
+// by that many names and values, each encoded as for PROP_MSG_SETPROP2. The reply is a single
+// uint32_t, PROP_SUCCESS if every property was set, or the error of the first one that wasn't.
+#ifndef PROP_MSG_SETPROP_BATCH
+#define PROP_MSG_SETPROP_BATCH 0x00020002
+#endif
+static constexpr uint32_t kMaxPropertySetBatchSize = 1024;
+
 bool CanReadProperty(const std::string& source_context, const std::string& name);
 
 void PropertyInit();
@@ -26,6 +26,8 @@
 #include <android-base/strings.h>
 #include <gtest/gtest.h>
 
+#include "property_service.h"
+
 using android::base::GetProperty;
 using android::base::SetProperty;
 
@@ -58,6 +60,120 @@ TEST(property_service, very_long_name_35166374) {
   ASSERT_EQ(0, close(fd));
 }
 
+static int ConnectToPropertyService() {
+    int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+
+    static const char* property_service_socket = "/dev/socket/" PROP_SERVICE_NAME;
+    sockaddr_un addr = {};
+    addr.sun_family = AF_LOCAL;
+    strlcpy(addr.sun_path, property_service_socket, sizeof(addr.sun_path));
+
+    socklen_t addr_len = strlen(property_service_socket) + offsetof(sockaddr_un, sun_path) + 1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void AppendUint32(std::string* msg, uint32_t value) {
+    msg->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void AppendString(std::string* msg, const std::string& value) {
+    AppendUint32(msg, value.size());
+    msg->append(value);
+}
+
+TEST(property_service, batch_too_large) {
+    int fd = ConnectToPropertyService();
+    ASSERT_NE(fd, -1);
+
+    std::string msg;
+    AppendUint32(&msg, PROP_MSG_SETPROP_BATCH);
+    AppendUint32(&msg, kMaxPropertySetBatchSize + 1);
+    ASSERT_EQ(static_cast<ssize_t>(msg.size()), send(fd, msg.data(), msg.size(), 0));
+    uint32_t result = 0;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(result)),
+              TEMP_FAILURE_RETRY(recv(fd, &result, sizeof(result), MSG_WAITALL)));
+    EXPECT_EQ(static_cast<uint32_t>(PROP_ERROR_READ_DATA), result);
+    ASSERT_EQ(0, close(fd));
+}
+
+TEST(property_service, batch_set) {
+    if (getuid() != 0) {
+        GTEST_SKIP() << "Skipping test, must be run as root.";
+        return;
+    }
+
+    int fd = ConnectToPropertyService();
+    ASSERT_NE(fd, -1);
+
+    std::string msg;
+    AppendUint32(&msg, PROP_MSG_SETPROP_BATCH);
+    AppendUint32(&msg, 3);
+    AppendString(&msg, "property_service_batch_test.a");
+    AppendString(&msg, "1");
+    AppendString(&msg, "property_service_batch_test.b");
+    AppendString(&msg, "2");
+    // Invalid values don't prevent the rest of the batch from being set.
+    AppendString(&msg, "property_service_batch_test.c");
+    AppendString(&msg, "\x80");
+    ASSERT_EQ(static_cast<ssize_t>(msg.size()), send(fd, msg.data(), msg.size(), 0));
+    uint32_t result = 0;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(result)),
+              TEMP_FAILURE_RETRY(recv(fd, &result, sizeof(result), MSG_WAITALL)));
+    EXPECT_EQ(static_cast<uint32_t>(PROP_ERROR_INVALID_VALUE), result);
+    ASSERT_EQ(0, close(fd));
+
+    EXPECT_EQ("1", GetProperty("property_service_batch_test.a", ""));
+    EXPECT_EQ("2", GetProperty("property_service_batch_test.b", ""));
+    EXPECT_EQ("", GetProperty("property_service_batch_test.c", ""));
+}
+
+TEST(property_service, batch_persist_after_queued_set) {
+    if (getuid() != 0) {
+        GTEST_SKIP() << "Skipping test, must be run as root.";
+        return;
+    }
+    const std::string name = "persist.property_service_batch_test.order";
+    auto guard = android::base::make_scope_guard([&name]() { SetProperty(name, ""); });
+
+    int single_fd = ConnectToPropertyService();
+    ASSERT_NE(single_fd, -1);
+    std::string msg;
+    AppendUint32(&msg, PROP_MSG_SETPROP2);
+    AppendString(&msg, name);
+    AppendString(&msg, "A");
+    ASSERT_EQ(static_cast<ssize_t>(msg.size()), send(single_fd, msg.data(), msg.size(), 0));
+
+    int batch_fd = ConnectToPropertyService();
+    ASSERT_NE(batch_fd, -1);
+    msg.clear();
+    AppendUint32(&msg, PROP_MSG_SETPROP_BATCH);
+    AppendUint32(&msg, 1);
+    AppendString(&msg, name);
+    AppendString(&msg, "B");
+    ASSERT_EQ(static_cast<ssize_t>(msg.size()), send(batch_fd, msg.data(), msg.size(), 0));
+
+    uint32_t result = 0;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(result)),
+              TEMP_FAILURE_RETRY(recv(batch_fd, &result, sizeof(result), MSG_WAITALL)));
+    EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), result);
+
+    // Replies are only sent once the value is on disk, so the single set, which was queued
+    // first, must have been stored and replied to before the batch that overrides it.
+    result = 0;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(result)),
+              TEMP_FAILURE_RETRY(recv(single_fd, &result, sizeof(result), MSG_DONTWAIT)));
+    EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), result);
+    ASSERT_EQ(0, close(single_fd));
+    ASSERT_EQ(0, close(batch_fd));
+
+    EXPECT_EQ("B", GetProperty(name, ""));
+}
+
 TEST(property_service, non_utf8_value) {
     if (getuid() != 0) {
         GTEST_SKIP() << "Skipping test, must be run as root.";
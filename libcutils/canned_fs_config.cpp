@@ -27,10 +27,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using android::base::ConsumePrefix;
@@ -38,14 +38,14 @@ using android::base::StartsWith;
 using android::base::Tokenize;
 
 struct Entry {
-    std::string path;
     unsigned uid;
     unsigned gid;
     unsigned mode;
     uint64_t capabilities;
 };
 
-static std::vector<Entry> canned_data;
+// Entries by path, without the leading '/'.
+static std::unordered_map<std::string, Entry> canned_data;
 
 int load_canned_fs_config(const char* fn) {
     std::ifstream input(fn);
@@ -69,7 +69,6 @@ int load_canned_fs_config(const char* fn) {
         std::string path(tokens[0].front() == '/' ? std::string(tokens[0], 1) : tokens[0]);
 
         Entry e{
-                .path = std::move(path),
                 .uid = static_cast<unsigned int>(atoi(tokens[1].c_str())),
                 .gid = static_cast<unsigned int>(atoi(tokens[2].c_str())),
                 // mode is in octal
@@ -89,19 +88,12 @@ int load_canned_fs_config(const char* fn) {
             std::cerr << "info: ignored token \"" << sv << "\" in " << fn << std::endl;
         }
 
-        canned_data.emplace_back(std::move(e));
+        // There can be multiple entries for the same path. Then the one that comes the last wins.
+        // This is to allow overriding platform provided fs_config with a user provided fs_config
+        // by appending the latter to the former.
+        canned_data.insert_or_assign(std::move(path), e);
     }
 
-    // Note: we used to sort the entries by path names. This was to improve the lookup performance
-    // by doing binary search. However, this is no longer the case. The lookup performance is not
-    // critical because this tool runs on the host, not on the device. Now, there can be multiple
-    // entries for the same path. Then the one that comes the last wins. This is to allow overriding
-    // platform provided fs_config with a user provided fs_config by appending the latter to the
-    // former.
-    //
-    // To implement the strategy, reverse the entries order, and search from the top.
-    std::reverse(canned_data.begin(), canned_data.end());
-
     std::cout << "loaded " << canned_data.size() << " fs_config entries" << std::endl;
     return 0;
 }
@@ -111,23 +103,14 @@ void canned_fs_config(const char* path, [[maybe_unused]] int dir,
                       unsigned* mode, uint64_t* capabilities) {
     if (path != nullptr && path[0] == '/') path++;  // canned paths lack the leading '/'
 
-    const Entry* found = nullptr;
-    // canned_data is already reversed. First match wins.
-    for (const auto& entry : canned_data) {
-        if (path == entry.path) {
-            found = &entry;
-            break;
-        }
-        continue;
-    }
-
-    if (found == nullptr) {
+    auto found = canned_data.find(path);
+    if (found == canned_data.end()) {
         std::cerr << "failed to find " << path << " in canned fs_config" << std::endl;
         exit(1);
     }
 
-    *uid = found->uid;
-    *gid = found->gid;
-    *mode = found->mode;
-    *capabilities = found->capabilities;
+    *uid = found->second.uid;
+    *gid = found->second.gid;
+    *mode = found->second.mode;
+    *capabilities = found->second.capabilities;
 }
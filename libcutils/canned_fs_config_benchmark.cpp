@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <private/canned_fs_config.h>
+
+using android::base::StringPrintf;
+
+// Roughly models the file list of a system image: apps, libraries and
+// binaries, with a directory entry for every directory.
+static std::vector<std::string> BuildFileList(size_t num_files) {
+    static const char* kDirs[] = {
+            "system/app",  "system/priv-app", "system/lib64", "system/lib",
+            "system/bin",  "system/etc",      "system/framework",
+            "system/usr/share/zoneinfo",
+    };
+    std::mt19937 gen(11);
+    std::vector<std::string> files = {"system"};
+    for (const char* dir : kDirs) {
+        files.emplace_back(dir);
+    }
+    while (files.size() < num_files) {
+        const std::string dir = kDirs[gen() % std::size(kDirs)];
+        const uint32_t id = gen();
+        if (dir == "system/app" || dir == "system/priv-app") {
+            auto app = StringPrintf("%s/App%08x", dir.c_str(), id);
+            files.emplace_back(app);
+            files.emplace_back(StringPrintf("%s/App%08x.apk", app.c_str(), id));
+            files.emplace_back(app + "/oat");
+            files.emplace_back(app + "/oat/arm64");
+            files.emplace_back(StringPrintf("%s/oat/arm64/App%08x.odex", app.c_str(), id));
+            files.emplace_back(StringPrintf("%s/oat/arm64/App%08x.vdex", app.c_str(), id));
+        } else {
+            files.emplace_back(StringPrintf("%s/file%08x", dir.c_str(), id));
+        }
+    }
+    return files;
+}
+
+// Writes the fs_config of |files| to |fd|, followed by |overrides| entries
+// overriding earlier ones, as appended by a product specific fs_config.
+static void WriteFsConfig(int fd, const std::vector<std::string>& files, size_t overrides) {
+    std::string config;
+    for (const auto& file : files) {
+        config += StringPrintf("%s 0 0 0644\n", file.c_str());
+    }
+    for (size_t i = 0; i < overrides; i++) {
+        config += StringPrintf("%s 1000 1000 0755 capabilities=0x0\n",
+                               files[i * files.size() / overrides].c_str());
+    }
+    CHECK(android::base::WriteStringToFd(config, fd));
+}
+
+static void BM_LoadCannedFsConfig(benchmark::State& state) {
+    auto files = BuildFileList(state.range(0));
+    TemporaryFile config;
+    WriteFsConfig(config.fd, files, files.size() / 100);
+
+    for (auto _ : state) {
+        CHECK_EQ(load_canned_fs_config(config.path), 0);
+    }
+    state.SetItemsProcessed(state.iterations() * files.size());
+}
+BENCHMARK(BM_LoadCannedFsConfig)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// Equivalent of e2fsdroid or mkbootfs looking up every file of an image.
+static void BM_CannedFsConfigLookup(benchmark::State& state) {
+    auto files = BuildFileList(state.range(0));
+    TemporaryFile config;
+    WriteFsConfig(config.fd, files, files.size() / 100);
+    CHECK_EQ(load_canned_fs_config(config.path), 0);
+
+    for (auto _ : state) {
+        for (const auto& file : files) {
+            unsigned uid, gid, mode;
+            uint64_t capabilities;
+            canned_fs_config(("/" + file).c_str(), 0, nullptr, &uid, &gid, &mode, &capabilities);
+            benchmark::DoNotOptimize(mode);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * files.size());
+}
+BENCHMARK(BM_CannedFsConfigLookup)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -29,10 +29,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <android-base/strings.h>
 #include <cutils/fs.h>
@@ -279,116 +286,219 @@ static bool is_partition(const std::string& path) {
     return false;
 }
 
-// alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
-// "system/<partition>/<stuff>" to "<partition>/<stuff>"
-static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
-    std::string pattern(prefix, len);
-    std::string input(path, plen);
-
-    // Massage pattern and input so that they can be used by fnmatch where
-    // directories have to end with /.
-    if (dir) {
-        if (!EndsWith(input, "/")) {
-            input.append("/");
-        }
+// A fs_config rule, compiled once so that matching a path against it does not
+// allocate or rebuild its pattern.
+struct CompiledRule {
+    // Pattern as passed to fnmatch(). Directory patterns end with "/*".
+    std::string pattern;
+    // Length of the leading part of pattern without wildcards, which every
+    // matching path starts with.
+    size_t literal_len;
+    bool wildcard;
+    struct fs_config conf;
+};
 
-        if (!EndsWith(pattern, "/*")) {
-            if (EndsWith(pattern, "/")) {
-                pattern.append("*");
-            } else {
-                pattern.append("/*");
-            }
-        }
+static CompiledRule compile_rule(bool dir, const char* prefix, size_t len,
+                                 const struct fs_config& conf) {
+    CompiledRule rule;
+    rule.pattern.assign(prefix, len);
+    // Massage pattern so that it can be used by fnmatch where directories
+    // have to end with /.
+    if (dir && !EndsWith(rule.pattern, "/*")) {
+        rule.pattern.append(EndsWith(rule.pattern, "/") ? "*" : "/*");
     }
+    rule.literal_len = std::min(rule.pattern.find_first_of("*?["), rule.pattern.size());
+    rule.wildcard = rule.literal_len < rule.pattern.size();
+    rule.conf = conf;
+    return rule;
+}
 
-    // no FNM_PATHNAME is set in order to match a/b/c/d with a/*
-    // FNM_ESCAPE is set in order to prevent using \\? and \\* and maintenance issues.
-    const int fnm_flags = FNM_NOESCAPE;
-    if (fnmatch(pattern.c_str(), input.c_str(), fnm_flags) == 0) return true;
+// Returns the forms of path that rules are matched against: path itself, with
+// a trailing / for directories, and the path within the partition of files of
+// logical partitions.
+static std::vector<std::string> match_inputs(bool dir, const char* path, size_t plen) {
+    std::vector<std::string> inputs;
+    std::string& input = inputs.emplace_back(path, plen);
+    if (dir && !EndsWith(input, "/")) {
+        input.append("/");
+    }
 
-    // Check match between logical partition's files and patterns.
+    // alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
+    // "system/<partition>/<stuff>" to "<partition>/<stuff>"
     static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
                                                          "system/vendor/", "vendor/odm/"};
     for (auto& logical_partition : kLogicalPartitions) {
-        if (StartsWith(input, logical_partition)) {
-            std::string input_in_partition = input.substr(input.find('/') + 1);
+        if (StartsWith(inputs.front(), logical_partition)) {
+            std::string input_in_partition = inputs.front().substr(inputs.front().find('/') + 1);
             if (!is_partition(input_in_partition)) continue;
-            if (fnmatch(pattern.c_str(), input_in_partition.c_str(), fnm_flags) == 0) {
-                return true;
-            }
+            inputs.emplace_back(std::move(input_in_partition));
         }
     }
+    return inputs;
+}
+
+static bool rule_matches(const CompiledRule& rule, const std::string& input) {
+    // no FNM_PATHNAME is set in order to match a/b/c/d with a/*
+    // FNM_ESCAPE is set in order to prevent using \\? and \\* and maintenance issues.
+    const int fnm_flags = FNM_NOESCAPE;
+    if (!rule.wildcard) {
+        return input == rule.pattern;
+    }
+    return input.compare(0, rule.literal_len, rule.pattern, 0, rule.literal_len) == 0 &&
+           fnmatch(rule.pattern.c_str(), input.c_str(), fnm_flags) == 0;
+}
+
+static bool rule_matches(const CompiledRule& rule, const std::vector<std::string>& inputs) {
+    for (const auto& input : inputs) {
+        if (rule_matches(rule, input)) return true;
+    }
     return false;
 }
+
+static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
+    return rule_matches(compile_rule(dir, prefix, len, {}), match_inputs(dir, path, plen));
+}
 #ifndef __ANDROID_VNDK__
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
-bool get_fs_config(const char* path, bool dir, const char* target_out_path,
-                   struct fs_config* fs_conf) {
-    const struct fs_path_config* pc;
-    size_t which, plen;
+// The rules for directories or for files, in the order in which they are
+// tried: those of the override files, then android_dirs or android_files.
+// The first rule which matches wins, and the indexes below find it without
+// trying every rule.
+struct CompiledRules {
+    std::vector<CompiledRule> rules;
+    // Index of the first rule without wildcards, by pattern.
+    std::unordered_map<std::string, size_t> literal_rules;
+    // Indexes of the rules with wildcards, in order, by their literal prefix
+    // up to and including its last '/'. Such a rule can only match paths which
+    // start with that directory.
+    std::unordered_map<std::string, std::vector<size_t>> wildcard_rules;
+
+    void add(CompiledRule&& rule) {
+        const size_t index = rules.size();
+        if (!rule.wildcard) {
+            literal_rules.emplace(rule.pattern, index);
+        } else {
+            const size_t slash = rule.literal_len ? rule.pattern.rfind('/', rule.literal_len - 1)
+                                                  : std::string::npos;
+            const size_t dir_len = slash == std::string::npos ? 0 : slash + 1;
+            wildcard_rules[rule.pattern.substr(0, dir_len)].push_back(index);
+        }
+        rules.emplace_back(std::move(rule));
+    }
 
-    if (path[0] == '/') {
-        path++;
+    // Returns the first rule which matches any of inputs, or nullptr.
+    const CompiledRule* find(const std::vector<std::string>& inputs) const {
+        size_t first = rules.size();
+        for (const auto& input : inputs) {
+            auto it = literal_rules.find(input);
+            if (it != literal_rules.end()) first = std::min(first, it->second);
+        }
+        // Only the wildcard rules of the directories of the inputs, which come
+        // before the first matching rule found so far, are tried.
+        for (const auto& input : inputs) {
+            for (size_t dir_len = 0;;) {
+                auto it = wildcard_rules.find(input.substr(0, dir_len));
+                if (it != wildcard_rules.end()) {
+                    for (size_t index : it->second) {
+                        if (index >= first) break;
+                        if (rule_matches(rules[index], input)) {
+                            first = index;
+                            break;
+                        }
+                    }
+                }
+                const size_t slash = input.find('/', dir_len);
+                if (slash == std::string::npos) break;
+                dir_len = slash + 1;
+            }
+        }
+        return first < rules.size() ? &rules[first] : nullptr;
     }
+};
 
-    plen = strlen(path);
+// Appends the rules of the fs_config_dirs or fs_config_files file conf[which]
+// to rules.
+static void load_config_file(bool dir, size_t which, const char* target_out_path,
+                             CompiledRules* rules) {
+    int fd = fs_config_open(dir, which, target_out_path);
+    if (fd < 0) return;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return;
 
-    for (which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+    const char* p = static_cast<const char*>(map);
+    const char* end = p + st.st_size;
+    while (static_cast<size_t>(end - p) >= sizeof(fs_path_config_from_file)) {
         struct fs_path_config_from_file header;
+        memcpy(&header, p, sizeof(header));
+        ssize_t len, remainder = header.len - sizeof(header);
+        if (remainder <= 0) {
+            ALOGE("%s len is corrupted", conf[which][dir]);
+            break;
+        }
+        if (end - p - static_cast<ssize_t>(sizeof(header)) < remainder) {
+            ALOGE("%s prefix is truncated", conf[which][dir]);
+            break;
+        }
+        const char* prefix = p + sizeof(header);
+        len = strnlen(prefix, remainder);
+        if (len >= remainder) {  // missing a terminating null
+            ALOGE("%s is corrupted", conf[which][dir]);
+            break;
+        }
+        rules->add(compile_rule(dir, prefix, len,
+                                {header.uid, header.gid, header.mode, header.capabilities}));
+        p += header.len;
+    }
+    munmap(map, st.st_size);
+}
 
-        int fd = fs_config_open(dir, which, target_out_path);
-        if (fd < 0) continue;
+struct CompiledConfig {
+    CompiledRules rules[2];
+};
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
-            uint16_t host_len = header.len;
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
-                break;
-            }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
-                break;
-            }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
-                close(fd);
-                fs_conf->uid = header.uid;
-                fs_conf->gid = header.gid;
-                fs_conf->mode = header.mode;
-                fs_conf->capabilities = header.capabilities;
-                return true;
-            }
-            free(prefix);
+// The override files are read once for each target_out_path, as image builders
+// look up every file of an image.
+static const CompiledConfig& get_compiled_config(const char* target_out_path) {
+    static std::mutex lock;
+    static auto* cache = new std::map<std::string, std::unique_ptr<CompiledConfig>>();
+
+    std::lock_guard guard(lock);
+    auto& config = (*cache)[target_out_path ? target_out_path : ""];
+    if (config) return *config;
+
+    config = std::make_unique<CompiledConfig>();
+    for (bool dir : {false, true}) {
+        auto& rules = config->rules[dir];
+        for (size_t which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+            load_config_file(dir, which, target_out_path, &rules);
+        }
+        for (auto pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+            rules.add(compile_rule(dir, pc->prefix, strlen(pc->prefix),
+                                   {pc->uid, pc->gid, pc->mode, pc->capabilities}));
         }
-        close(fd);
     }
+    return *config;
+}
 
-    for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
-        if (fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path, plen)) {
-            fs_conf->uid = pc->uid;
-            fs_conf->gid = pc->gid;
-            fs_conf->mode = pc->mode;
-            fs_conf->capabilities = pc->capabilities;
-            return true;
-        }
+bool get_fs_config(const char* path, bool dir, const char* target_out_path,
+                   struct fs_config* fs_conf) {
+    if (path[0] == '/') {
+        path++;
     }
-    return false;
+
+    auto inputs = match_inputs(dir, path, strlen(path));
+    const CompiledRule* rule = get_compiled_config(target_out_path).rules[dir].find(inputs);
+    if (!rule) return false;
+    *fs_conf = rule->conf;
+    return true;
 }
 
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
@@ -15,6 +15,7 @@
  */
 
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #include <string>
 
@@ -25,6 +26,7 @@
 #include <android-base/strings.h>
 
 #include <private/android_filesystem_config.h>
+#include <private/fs_config.h>
 
 #include "fs_config.h"
 
@@ -258,3 +260,65 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+static std::string make_override_entry(uint16_t mode, uint16_t uid, uint16_t gid,
+                                       uint64_t capabilities, const std::string& prefix) {
+    size_t len = (sizeof(fs_path_config_from_file) + prefix.size() + 1 + sizeof(uint64_t) - 1) &
+                 ~(sizeof(uint64_t) - 1);
+    std::string entry(len, '\0');
+    fs_path_config_from_file header = {static_cast<uint16_t>(len), mode, uid, gid, capabilities};
+    memcpy(entry.data(), &header, sizeof(header));
+    memcpy(entry.data() + sizeof(header), prefix.data(), prefix.size());
+    return entry;
+}
+
+TEST(fs_config, target_out_path_overrides) {
+    TemporaryDir dir;
+    std::string target_out_path = std::string(dir.path) + "/system";
+    ASSERT_EQ(mkdir(target_out_path.c_str(), 0755), 0);
+    ASSERT_EQ(mkdir((target_out_path + "/etc").c_str(), 0755), 0);
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            make_override_entry(00700, AID_SYSTEM, AID_SHELL, 0x10, "system/bin/foo*"),
+            target_out_path + "/etc/fs_config_files"));
+
+    struct fs_config conf;
+    // Overrides are tried before the rules of android_files.
+    ASSERT_TRUE(get_fs_config("system/bin/foobar", false, target_out_path.c_str(), &conf));
+    EXPECT_EQ(conf.mode, 00700u);
+    EXPECT_EQ(conf.uid, AID_SYSTEM);
+    EXPECT_EQ(conf.gid, AID_SHELL);
+    EXPECT_EQ(conf.capabilities, 0x10u);
+
+    ASSERT_TRUE(get_fs_config("/system/bin/sh", false, target_out_path.c_str(), &conf));
+    EXPECT_EQ(conf.mode, 00755u);
+    EXPECT_EQ(conf.gid, AID_SHELL);
+
+    // Directories only use the rules of fs_config_dirs.
+    ASSERT_TRUE(get_fs_config("system/bin/foo", true, target_out_path.c_str(), &conf));
+    EXPECT_NE(conf.mode, 00700u);
+}
+
+TEST(fs_config, target_out_path_first_rule_wins) {
+    TemporaryDir dir;
+    std::string target_out_path = std::string(dir.path) + "/system";
+    ASSERT_EQ(mkdir(target_out_path.c_str(), 0755), 0);
+    ASSERT_EQ(mkdir((target_out_path + "/etc").c_str(), 0755), 0);
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            make_override_entry(00700, AID_SYSTEM, AID_SYSTEM, 0, "system/bin/log?") +
+                    make_override_entry(00711, AID_SYSTEM, AID_SYSTEM, 0, "system/bin/logd") +
+                    make_override_entry(00755, AID_SHELL, AID_SHELL, 0, "system/bin/sh") +
+                    make_override_entry(00750, AID_SHELL, AID_SHELL, 0, "system/*"),
+            target_out_path + "/etc/fs_config_files"));
+
+    struct fs_config conf;
+    // An earlier wildcard rule wins over a later literal one.
+    ASSERT_TRUE(get_fs_config("system/bin/logd", false, target_out_path.c_str(), &conf));
+    EXPECT_EQ(conf.mode, 00700u);
+    // An earlier literal rule wins over later wildcard ones.
+    ASSERT_TRUE(get_fs_config("system/bin/sh", false, target_out_path.c_str(), &conf));
+    EXPECT_EQ(conf.mode, 00755u);
+    EXPECT_EQ(conf.uid, AID_SHELL);
+    // Wildcard rules of parent directories still apply.
+    ASSERT_TRUE(get_fs_config("system/etc/foo/bar", false, target_out_path.c_str(), &conf));
+    EXPECT_EQ(conf.mode, 00750u);
+}
@@ -21,7 +21,10 @@
 #include <sys/syscall.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -351,6 +354,12 @@ std::vector<std::string> Modprobe::GetDependencies(const std::string& module) {
     return it->second;
 }
 
+bool Modprobe::IsLoaded(const std::string& canonical_name) {
+    // LoadModulesParallel() loads modules from several threads.
+    std::lock_guard guard(module_loaded_lock_);
+    return module_loaded_.count(canonical_name) > 0;
+}
+
 bool Modprobe::InsmodWithDeps(const std::string& module_name, const std::string& parameters) {
     if (module_name.empty()) {
         LOG(ERROR) << "Need valid module name, given: " << module_name;
@@ -398,7 +407,7 @@ bool Modprobe::InsmodWithDeps(const std::string& module_name, const std::string&
 bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
                                const std::string& parameters) {
     auto canonical_name = MakeCanonical(module_name);
-    if (module_loaded_.count(canonical_name)) {
+    if (IsLoaded(canonical_name)) {
         return true;
     }
 
@@ -410,7 +419,7 @@ bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
     for (const auto& [alias, aliased_module] : module_aliases_) {
         if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
         LOG(VERBOSE) << "Found alias for '" << module_name << "': '" << aliased_module;
-        if (module_loaded_.count(MakeCanonical(aliased_module))) continue;
+        if (IsLoaded(MakeCanonical(aliased_module))) continue;
         modules_to_load.emplace(aliased_module);
     }
 
@@ -440,14 +449,34 @@ bool Modprobe::IsBlocklisted(const std::string& module_name) {
     return module_blocklist_.count(canonical_name) > 0;
 }
 
-// Another option to load kernel modules. load independent modules dependencies
-// in parallel and then update dependency list of other remaining modules,
-// repeat these steps until all modules are loaded.
+// Another option to load kernel modules. Modules listed in modules.load and
+// their hard dependencies form a graph, which is loaded by a pool of
+// num_threads threads. Each module is dispatched as soon as its last hard
+// dependency has been loaded, so a slow module only delays the modules that
+// depend on it. Modules with the load_sequential=1 option are loaded while no
+// other module is being loaded.
 // Discard all blocklist.
 // Softdeps are taken care in InsmodWithDeps().
 bool Modprobe::LoadModulesParallel(int num_threads) {
-    bool ret = true;
-    std::unordered_map<std::string, std::vector<std::string>> mod_with_deps;
+    static const std::string kLoadSequential = "load_sequential=1";
+
+    struct Node {
+        std::string name;
+        // Modules waiting on this one.
+        std::vector<size_t> dependents;
+        size_t pending_deps = 0;
+        bool sequential = false;
+    };
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, size_t> node_index;
+
+    auto add_node = [&](const std::string& name) -> size_t {
+        auto [it, inserted] = node_index.emplace(name, nodes.size());
+        if (inserted) {
+            nodes.emplace_back().name = name;
+        }
+        return it->second;
+    };
 
     // Get dependencies
     for (const auto& module : module_load_) {
@@ -456,94 +485,127 @@ bool Modprobe::LoadModulesParallel(int num_threads) {
             LOG(VERBOSE) << "LMP: Blocklist: Module " << module << " skipping...";
             continue;
         }
-        auto dependencies = GetDependencies(MakeCanonical(module));
-        if (dependencies.empty()) {
+        auto canonical_name = MakeCanonical(module);
+        if (GetDependencies(canonical_name).empty()) {
             LOG(ERROR) << "LMP: Hard-dep: Module " << module
                        << " not in .dep file";
             return false;
         }
-        mod_with_deps[MakeCanonical(module)] = dependencies;
+        add_node(canonical_name);
     }
 
-    while (!mod_with_deps.empty()) {
-        std::vector<std::thread> threads;
-        std::vector<std::string> mods_path_to_load;
-        std::mutex vector_lock;
-
-        // Find independent modules
-        for (const auto& [it_mod, it_dep] : mod_with_deps) {
-            auto itd_last = it_dep.rbegin();
-            if (itd_last == it_dep.rend())
-                continue;
-
-            auto cnd_last = MakeCanonical(*itd_last);
+    // Build the graph. Nodes of hard dependencies are appended as they are found.
+    for (size_t i = 0; i < nodes.size(); i++) {
+        auto dependencies = GetDependencies(nodes[i].name);
+        for (auto dep = dependencies.begin() + std::min<size_t>(1, dependencies.size());
+             dep != dependencies.end(); ++dep) {
+            auto cnd_dep = MakeCanonical(*dep);
             // Hard-dependencies cannot be blocklisted
-            if (IsBlocklisted(cnd_last)) {
-                LOG(ERROR) << "LMP: Blocklist: Module-dep " << cnd_last
-                           << " : failed to load module " << it_mod;
+            if (IsBlocklisted(cnd_dep)) {
+                LOG(ERROR) << "LMP: Blocklist: Module-dep " << cnd_dep
+                           << " : failed to load module " << nodes[i].name;
                 return false;
             }
-
-            std::string str = "load_sequential=1";
-            auto it = module_options_[cnd_last].find(str);
-            if (it != std::string::npos) {
-                module_options_[cnd_last].erase(it, it + str.size());
-
-                if (!LoadWithAliases(cnd_last, true)) {
-                    return false;
-                }
-            } else {
-                if (std::find(mods_path_to_load.begin(), mods_path_to_load.end(),
-                            cnd_last) == mods_path_to_load.end()) {
-                    mods_path_to_load.emplace_back(cnd_last);
-                }
-            }
+            auto dep_index = add_node(cnd_dep);
+            nodes[dep_index].dependents.emplace_back(i);
+            nodes[i].pending_deps++;
         }
 
-        // Load independent modules in parallel
-        auto thread_function = [&] {
-            std::unique_lock lk(vector_lock);
-            while (!mods_path_to_load.empty()) {
-                auto ret_load = true;
-                auto mod_to_load = std::move(mods_path_to_load.back());
-                mods_path_to_load.pop_back();
-
-                lk.unlock();
-                ret_load &= LoadWithAliases(mod_to_load, true);
-                lk.lock();
-                if (!ret_load) {
-                    ret &= ret_load;
-                }
+        auto options = module_options_.find(nodes[i].name);
+        if (options != module_options_.end()) {
+            auto pos = options->second.find(kLoadSequential);
+            if (pos != std::string::npos) {
+                options->second.erase(pos, kLoadSequential.size());
+                nodes[i].sequential = true;
             }
-        };
-
-        std::generate_n(std::back_inserter(threads), num_threads,
-                        [&] { return std::thread(thread_function); });
-
-        // Wait for the threads.
-        for (auto& thread : threads) {
-            thread.join();
         }
+    }
 
-        if (!ret) return ret;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<size_t> ready;
+    std::deque<size_t> ready_sequential;
+    size_t running = 0;
+    size_t remaining = nodes.size();
+    bool sequential_running = false;
+    bool failed = false;
+
+    auto push_ready = [&](size_t index) {
+        (nodes[index].sequential ? ready_sequential : ready).emplace_back(index);
+    };
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].pending_deps == 0) push_ready(i);
+    }
+
+    auto thread_function = [&] {
+        std::unique_lock lk(lock);
+        while (!failed && remaining > 0) {
+            size_t index;
+            bool sequential = false;
+            if (!ready_sequential.empty() && running == 0) {
+                index = ready_sequential.front();
+                ready_sequential.pop_front();
+                sequential = true;
+            } else if (ready_sequential.empty() && !ready.empty() && !sequential_running) {
+                index = ready.front();
+                ready.pop_front();
+            } else if (running == 0) {
+                // Nothing is ready and nothing is being loaded: the remaining
+                // modules depend on each other.
+                break;
+            } else {
+                cv.wait(lk);
+                continue;
+            }
 
-        std::lock_guard guard(module_loaded_lock_);
-        // Remove loaded module form mod_with_deps and soft dependencies of other modules
-        for (const auto& module_loaded : module_loaded_)
-            mod_with_deps.erase(module_loaded);
+            running++;
+            sequential_running = sequential;
+            lk.unlock();
+
+            const auto& name = nodes[index].name;
+            auto start = android::base::boot_clock::now();
+            bool ret_load = LoadWithAliases(name, true);
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                    android::base::boot_clock::now() - start);
+            if (ret_load) {
+                LOG(VERBOSE) << "LMP: Loaded module " << name << " in " << duration.count() << "us";
+            }
 
-        // Remove loaded module form dependencies of other modules which are not loaded yet
-        for (const auto& module_loaded_path : module_loaded_paths_) {
-            for (auto& [mod, deps] : mod_with_deps) {
-                auto it = std::find(deps.begin(), deps.end(), module_loaded_path);
-                if (it != deps.end()) {
-                    deps.erase(it);
+            lk.lock();
+            running--;
+            sequential_running = false;
+            remaining--;
+            if (!ret_load) {
+                failed = true;
+            } else {
+                for (auto dependent : nodes[index].dependents) {
+                    if (--nodes[dependent].pending_deps == 0) push_ready(dependent);
                 }
             }
+            cv.notify_all();
         }
+        cv.notify_all();
+    };
+
+    android::base::Timer t;
+    num_threads = std::clamp<int>(num_threads, 1, std::max<size_t>(nodes.size(), 1));
+    std::vector<std::thread> threads;
+    std::generate_n(std::back_inserter(threads), num_threads,
+                    [&] { return std::thread(thread_function); });
+
+    // Wait for the threads.
+    for (auto& thread : threads) {
+        thread.join();
     }
 
-    return ret;
+    if (failed) return false;
+    if (remaining > 0) {
+        LOG(ERROR) << "LMP: Hard-dep: " << remaining << " modules have circular dependencies";
+        return false;
+    }
+    LOG(INFO) << "LMP: Loaded " << nodes.size() << " modules with " << num_threads
+              << " threads in " << t;
+    return true;
 }
 
 bool Modprobe::LoadListedModules(bool strict) {
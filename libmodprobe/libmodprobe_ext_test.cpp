@@ -17,6 +17,10 @@
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -29,6 +33,9 @@
 
 #include "libmodprobe_test.h"
 
+// Signaled whenever a module is added to modules_loaded.
+static std::condition_variable module_loaded_cv;
+
 std::string Modprobe::GetKernelCmdline(void) {
     return kernel_cmdline;
 }
@@ -41,11 +48,25 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     if (std::find(test_modules.begin(), test_modules.end(), deps.front()) == test_modules.end()) {
         return false;
     }
+
+    std::unique_lock lock(module_loaded_lock_);
     for (auto it = modules_loaded.begin(); it != modules_loaded.end(); ++it) {
         if (android::base::StartsWith(*it, path_name)) {
             return true;
         }
     }
+
+    // Simulate a slow init_module(), which lasts until another module is loaded. The
+    // timeout only keeps a broken scheduler from hanging the test.
+    auto after = module_load_after.find(path_name);
+    if (after != module_load_after.end()) {
+        module_loaded_cv.wait_for(lock, std::chrono::seconds(10), [&] {
+            return std::any_of(modules_loaded.begin(), modules_loaded.end(), [&](const auto& m) {
+                return android::base::StartsWith(m, after->second);
+            });
+        });
+    }
+
     std::string options;
     auto options_iter = module_options_.find(MakeCanonical(path_name));
     if (options_iter != module_options_.end()) {
@@ -57,6 +78,7 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
 
     modules_loaded.emplace_back(path_name + options);
     module_count_++;
+    module_loaded_cv.notify_all();
     return true;
 }
 
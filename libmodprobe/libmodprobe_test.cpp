@@ -14,10 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <functional>
 
 #include <android-base/file.h>
 #include <android-base/macros.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 
@@ -34,6 +36,9 @@ std::vector<std::string> modules_loaded;
 // Used by libmodprobe_ext_test to fake a kernel commandline
 std::string kernel_cmdline;
 
+// Used by libmodprobe_ext_test to hold back loading a module until another one is loaded.
+std::map<std::string, std::string> module_load_after;
+
 TEST(libmodprobe, Test) {
     kernel_cmdline =
             "flag1 flag2 test1.option1=50 test4.option3=\"set x\" test1.option2=60 "
@@ -219,3 +224,110 @@ TEST(libmodprobe, ModuleDepLineWithoutColonIsSkipped) {
     Modprobe m({dir.path});
     EXPECT_FALSE(m.LoadWithAliases("no_colon", true));
 }
+
+static size_t LoadedIndex(const std::string& module) {
+    auto it = std::find_if(modules_loaded.begin(), modules_loaded.end(), [&](const auto& entry) {
+        return entry == module || android::base::StartsWith(entry, module + " ");
+    });
+    return it - modules_loaded.begin();
+}
+
+TEST(libmodprobe, LoadModulesParallel) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+
+    const std::string modules_dep =
+            "mod_a.ko:\n"
+            "mod_b.ko: mod_a.ko\n"
+            "mod_c.ko: mod_b.ko mod_a.ko\n"
+            "mod_slow.ko:\n"
+            "mod_d.ko: mod_slow.ko\n"
+            "mod_e.ko:\n";
+    const std::string modules_options = "options mod_e.ko load_sequential=1 param=1\n";
+    const std::string modules_load =
+            "mod_c.ko\n"
+            "mod_d.ko\n"
+            "mod_e.ko\n";
+
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_dep, dir_path + "/modules.dep", 0600,
+                                                 getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_options, dir_path + "/modules.options",
+                                                 0600, getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_load, dir_path + "/modules.load", 0600,
+                                                 getuid(), getgid()));
+
+    kernel_cmdline = "";
+    modules_loaded.clear();
+    test_modules.clear();
+    for (const auto& module : {"a", "b", "c", "slow", "d", "e"}) {
+        test_modules.emplace_back(dir_path + "/mod_" + module + ".ko");
+    }
+    // The slow module is still being loaded when mod_c is, which only works if the chain
+    // a -> b -> c does not wait for it.
+    module_load_after = {{dir_path + "/mod_slow.ko", dir_path + "/mod_c.ko"}};
+
+    Modprobe m({dir.path});
+    EXPECT_TRUE(m.LoadModulesParallel(2));
+    module_load_after.clear();
+
+    for (auto i = modules_loaded.begin(); i != modules_loaded.end(); ++i) {
+        GTEST_LOG_(INFO) << "\"" << *i << "\"";
+    }
+    ASSERT_EQ(modules_loaded.size(), 6u);
+    EXPECT_EQ(m.GetModuleCount(), 6);
+
+    auto a = LoadedIndex(dir_path + "/mod_a.ko");
+    auto b = LoadedIndex(dir_path + "/mod_b.ko");
+    auto c = LoadedIndex(dir_path + "/mod_c.ko");
+    auto slow = LoadedIndex(dir_path + "/mod_slow.ko");
+    auto d = LoadedIndex(dir_path + "/mod_d.ko");
+    EXPECT_LT(a, b);
+    EXPECT_LT(b, c);
+    EXPECT_LT(slow, d);
+    // The chain a -> b -> c does not wait for the slow module.
+    EXPECT_LT(c, slow);
+
+    auto e = LoadedIndex(dir_path + "/mod_e.ko");
+    ASSERT_LT(e, modules_loaded.size());
+    EXPECT_EQ(modules_loaded[e].find("load_sequential"), std::string::npos);
+    EXPECT_NE(modules_loaded[e].find("param=1"), std::string::npos);
+}
+
+TEST(libmodprobe, LoadModulesParallelMissingDependency) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile("mod_a.ko:\nmod_b.ko: mod_a.ko\nmod_c.ko:\n",
+                                                 dir_path + "/modules.dep", 0600, getuid(),
+                                                 getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("mod_b.ko\n", dir_path + "/modules.load", 0600,
+                                                 getuid(), getgid()));
+
+    kernel_cmdline = "";
+    modules_loaded.clear();
+    test_modules = {dir_path + "/mod_b.ko", dir_path + "/mod_c.ko"};
+
+    Modprobe m({dir.path});
+    EXPECT_FALSE(m.LoadModulesParallel(4));
+    EXPECT_TRUE(modules_loaded.empty());
+}
+
+TEST(libmodprobe, LoadModulesParallelCircularDependency) {
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    const std::string modules_dep =
+            "mod_a.ko: mod_b.ko\n"
+            "mod_b.ko: mod_a.ko\n"
+            "mod_c.ko:\n";
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_dep, dir_path + "/modules.dep", 0600,
+                                                 getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile("mod_a.ko\nmod_c.ko\n", dir_path + "/modules.load",
+                                                 0600, getuid(), getgid()));
+
+    kernel_cmdline = "";
+    modules_loaded.clear();
+    test_modules = {dir_path + "/mod_a.ko", dir_path + "/mod_b.ko", dir_path + "/mod_c.ko"};
+
+    Modprobe m({dir.path});
+    EXPECT_FALSE(m.LoadModulesParallel(2));
+    EXPECT_EQ(modules_loaded, std::vector<std::string>{dir_path + "/mod_c.ko"});
+}
@@ -16,9 +16,11 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
 extern std::string kernel_cmdline;
 extern std::vector<std::string> test_modules;
 extern std::vector<std::string> modules_loaded;
+extern std::map<std::string, std::string> module_load_after;
@@ -20,6 +20,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <iterator>
+#include <map>
+#include <new>
+
 #include "backed_block.h"
 #include "sparse_defs.h"
 
@@ -46,14 +50,19 @@ struct backed_block {
   struct backed_block* next;
 };
 
+/* Backed blocks ordered by their first block, which makes inserting, splitting
+ * and moving ranges of blocks O(log n). Nodes are moved between lists with
+ * extract(), so a backed_block never moves in memory while it exists. The next
+ * pointers follow the map order so that iterating stays O(1) per block. */
+typedef std::multimap<unsigned int, struct backed_block> backed_block_map;
+
 struct backed_block_list {
-  struct backed_block* data_blocks;
-  struct backed_block* last_used;
+  backed_block_map blocks;
   unsigned int block_size;
 };
 
 struct backed_block* backed_block_iter_new(struct backed_block_list* bbl) {
-  return bbl->data_blocks;
+  return bbl->blocks.empty() ? nullptr : &bbl->blocks.begin()->second;
 }
 
 struct backed_block* backed_block_iter_next(struct backed_block* bb) {
@@ -101,87 +110,96 @@ enum backed_block_type backed_block_type(struct backed_block* bb) {
   return bb->type;
 }
 
-void backed_block_destroy(struct backed_block* bb) {
+static void backed_block_free_data(struct backed_block* bb) {
   if (bb->type == BACKED_BLOCK_FILE) {
     free(bb->file.filename);
   }
+}
+
+static backed_block_map::iterator find_bb(struct backed_block_list* bbl, struct backed_block* bb) {
+  auto range = bbl->blocks.equal_range(bb->block);
+  for (auto it = range.first; it != range.second; it++) {
+    if (&it->second == bb) {
+      return it;
+    }
+  }
+  return bbl->blocks.end();
+}
+
+/* Links a newly inserted block with its neighbours */
+static void link_bb(struct backed_block_list* bbl, backed_block_map::iterator it) {
+  auto next = std::next(it);
+  it->second.next = next == bbl->blocks.end() ? nullptr : &next->second;
+  if (it != bbl->blocks.begin()) {
+    std::prev(it)->second.next = &it->second;
+  }
+}
 
-  free(bb);
+/* Unlinks and frees a block */
+static void erase_bb(struct backed_block_list* bbl, backed_block_map::iterator it) {
+  if (it != bbl->blocks.begin()) {
+    std::prev(it)->second.next = it->second.next;
+  }
+  backed_block_free_data(&it->second);
+  bbl->blocks.erase(it);
 }
 
 struct backed_block_list* backed_block_list_new(unsigned int block_size) {
-  struct backed_block_list* b =
-      reinterpret_cast<backed_block_list*>(calloc(sizeof(struct backed_block_list), 1));
-  b->block_size = block_size;
+  struct backed_block_list* b = new (std::nothrow) backed_block_list;
+  if (b) {
+    b->block_size = block_size;
+  }
   return b;
 }
 
 void backed_block_list_destroy(struct backed_block_list* bbl) {
-  if (bbl->data_blocks) {
-    struct backed_block* bb = bbl->data_blocks;
-    while (bb) {
-      struct backed_block* next = bb->next;
-      backed_block_destroy(bb);
-      bb = next;
-    }
+  for (auto& entry : bbl->blocks) {
+    backed_block_free_data(&entry.second);
   }
 
-  free(bbl);
+  delete bbl;
 }
 
 void backed_block_list_move(struct backed_block_list* from, struct backed_block_list* to,
                             struct backed_block* start, struct backed_block* end) {
-  struct backed_block* bb;
-
   if (start == nullptr) {
-    start = from->data_blocks;
+    start = backed_block_iter_new(from);
   }
 
-  if (!end) {
-    for (end = start; end && end->next; end = end->next)
-      ;
+  if (start == nullptr) {
+    return;
   }
 
-  if (start == nullptr || end == nullptr) {
+  auto it = find_bb(from, start);
+  if (it == from->blocks.end()) {
     return;
   }
-
-  from->last_used = nullptr;
-  to->last_used = nullptr;
-  if (from->data_blocks == start) {
-    from->data_blocks = end->next;
-  } else {
-    for (bb = from->data_blocks; bb; bb = bb->next) {
-      if (bb->next == start) {
-        bb->next = end->next;
-        break;
-      }
+  struct backed_block* prev = it == from->blocks.begin() ? nullptr : &std::prev(it)->second;
+
+  /* Blocks are moved in order, so each one goes right after the previous */
+  auto hint = to->blocks.upper_bound(start->block);
+  while (it != from->blocks.end()) {
+    bool last = &it->second == end;
+    auto to_it = to->blocks.insert(hint, from->blocks.extract(it++));
+    link_bb(to, to_it);
+    hint = std::next(to_it);
+    if (last) {
+      break;
     }
   }
 
-  if (!to->data_blocks) {
-    to->data_blocks = start;
-    end->next = nullptr;
-  } else {
-    for (bb = to->data_blocks; bb; bb = bb->next) {
-      if (!bb->next || bb->next->block > start->block) {
-        end->next = bb->next;
-        bb->next = start;
-        break;
-      }
-    }
+  if (prev) {
+    prev->next = it == from->blocks.end() ? nullptr : &it->second;
   }
 }
 
 /* may free b */
-static int merge_bb(struct backed_block_list* bbl, struct backed_block* a, struct backed_block* b) {
+static int merge_bb(struct backed_block_list* bbl, backed_block_map::iterator a_it,
+                    backed_block_map::iterator b_it) {
+  struct backed_block* a = &a_it->second;
+  struct backed_block* b = &b_it->second;
   unsigned int block_len;
 
-  /* Block doesn't exist (possible if one block is the last block) */
-  if (!a || !b) {
-    return -EINVAL;
-  }
-
   assert(a->block < b->block);
 
   /* Blocks are of different types */
@@ -220,50 +238,30 @@ static int merge_bb(struct backed_block_list* bbl, struct backed_block* a, struc
   /* Blocks are compatible and adjacent, with a before b.  Merge b into a,
    * and free b */
   a->len += b->len;
-  a->next = b->next;
-
-  backed_block_destroy(b);
+  erase_bb(bbl, b_it);
 
   return 0;
 }
 
-static int queue_bb(struct backed_block_list* bbl, struct backed_block* new_bb) {
-  struct backed_block* bb;
-
-  if (bbl->data_blocks == nullptr) {
-    bbl->data_blocks = new_bb;
-    return 0;
-  }
-
-  if (bbl->data_blocks->block > new_bb->block) {
-    new_bb->next = bbl->data_blocks;
-    bbl->data_blocks = new_bb;
-    return 0;
+static int queue_bb(struct backed_block_list* bbl, const struct backed_block& new_bb) {
+  /* Optimization: blocks are mostly queued in sequence, so check for an
+     append before searching */
+  backed_block_map::iterator hint;
+  if (bbl->blocks.empty() || std::prev(bbl->blocks.end())->first < new_bb.block) {
+    hint = bbl->blocks.end();
+  } else {
+    hint = bbl->blocks.lower_bound(new_bb.block);
   }
 
-  /* Optimization: blocks are mostly queued in sequence, so save the
-     pointer to the last bb that was added, and start searching from
-     there if the next block number is higher */
-  if (bbl->last_used && new_bb->block > bbl->last_used->block)
-    bb = bbl->last_used;
-  else
-    bb = bbl->data_blocks;
-  bbl->last_used = new_bb;
-
-  for (; bb->next && bb->next->block < new_bb->block; bb = bb->next)
-    ;
+  auto it = bbl->blocks.emplace_hint(hint, new_bb.block, new_bb);
+  link_bb(bbl, it);
 
-  if (bb->next == nullptr) {
-    bb->next = new_bb;
-  } else {
-    new_bb->next = bb->next;
-    bb->next = new_bb;
+  auto next = std::next(it);
+  if (next != bbl->blocks.end()) {
+    merge_bb(bbl, it, next);
   }
-
-  merge_bb(bbl, new_bb, new_bb->next);
-  if (!merge_bb(bbl, bb, new_bb)) {
-    /* new_bb destroyed, point to retained as last_used */
-    bbl->last_used = bb;
+  if (it != bbl->blocks.begin()) {
+    merge_bb(bbl, std::prev(it), it);
   }
 
   return 0;
@@ -272,16 +270,12 @@ static int queue_bb(struct backed_block_list* bbl, struct backed_block* new_bb)
 /* Queues a fill block of memory to be written to the specified data blocks */
 int backed_block_add_fill(struct backed_block_list* bbl, unsigned int fill_val, uint64_t len,
                           unsigned int block) {
-  struct backed_block* bb = reinterpret_cast<backed_block*>(calloc(1, sizeof(struct backed_block)));
-  if (bb == nullptr) {
-    return -ENOMEM;
-  }
+  struct backed_block bb = {};
 
-  bb->block = block;
-  bb->len = len;
-  bb->type = BACKED_BLOCK_FILL;
-  bb->fill.val = fill_val;
-  bb->next = nullptr;
+  bb.block = block;
+  bb.len = len;
+  bb.type = BACKED_BLOCK_FILL;
+  bb.fill.val = fill_val;
 
   return queue_bb(bbl, bb);
 }
@@ -289,16 +283,12 @@ int backed_block_add_fill(struct backed_block_list* bbl, unsigned int fill_val,
 /* Queues a block of memory to be written to the specified data blocks */
 int backed_block_add_data(struct backed_block_list* bbl, void* data, uint64_t len,
                           unsigned int block) {
-  struct backed_block* bb = reinterpret_cast<backed_block*>(calloc(1, sizeof(struct backed_block)));
-  if (bb == nullptr) {
-    return -ENOMEM;
-  }
+  struct backed_block bb = {};
 
-  bb->block = block;
-  bb->len = len;
-  bb->type = BACKED_BLOCK_DATA;
-  bb->data.data = data;
-  bb->next = nullptr;
+  bb.block = block;
+  bb.len = len;
+  bb.type = BACKED_BLOCK_DATA;
+  bb.data.data = data;
 
   return queue_bb(bbl, bb);
 }
@@ -306,21 +296,16 @@ int backed_block_add_data(struct backed_block_list* bbl, void* data, uint64_t le
 /* Queues a chunk of a file on disk to be written to the specified data blocks */
 int backed_block_add_file(struct backed_block_list* bbl, const char* filename, int64_t offset,
                           uint64_t len, unsigned int block) {
-  struct backed_block* bb = reinterpret_cast<backed_block*>(calloc(1, sizeof(struct backed_block)));
-  if (bb == nullptr) {
-    return -ENOMEM;
-  }
+  struct backed_block bb = {};
 
-  bb->block = block;
-  bb->len = len;
-  bb->type = BACKED_BLOCK_FILE;
-  bb->file.filename = strdup(filename);
-  if (!bb->file.filename) {
-    free(bb);
+  bb.block = block;
+  bb.len = len;
+  bb.type = BACKED_BLOCK_FILE;
+  bb.file.filename = strdup(filename);
+  if (!bb.file.filename) {
     return -ENOMEM;
   }
-  bb->file.offset = offset;
-  bb->next = nullptr;
+  bb.file.offset = offset;
 
   return queue_bb(bbl, bb);
 }
@@ -328,24 +313,20 @@ int backed_block_add_file(struct backed_block_list* bbl, const char* filename, i
 /* Queues a chunk of a fd to be written to the specified data blocks */
 int backed_block_add_fd(struct backed_block_list* bbl, int fd, int64_t offset, uint64_t len,
                         unsigned int block) {
-  struct backed_block* bb = reinterpret_cast<backed_block*>(calloc(1, sizeof(struct backed_block)));
-  if (bb == nullptr) {
-    return -ENOMEM;
-  }
+  struct backed_block bb = {};
 
-  bb->block = block;
-  bb->len = len;
-  bb->type = BACKED_BLOCK_FD;
-  bb->fd.fd = fd;
-  bb->fd.offset = offset;
-  bb->next = nullptr;
+  bb.block = block;
+  bb.len = len;
+  bb.type = BACKED_BLOCK_FD;
+  bb.fd.fd = fd;
+  bb.fd.offset = offset;
 
   return queue_bb(bbl, bb);
 }
 
 int backed_block_split(struct backed_block_list* bbl, struct backed_block* bb,
                        unsigned int max_len) {
-  struct backed_block* new_bb;
+  struct backed_block new_bb;
 
   max_len = ALIGN_DOWN(max_len, bbl->block_size);
 
@@ -353,37 +334,35 @@ int backed_block_split(struct backed_block_list* bbl, struct backed_block* bb,
     return 0;
   }
 
-  new_bb = reinterpret_cast<backed_block*>(malloc(sizeof(struct backed_block)));
-  if (new_bb == nullptr) {
-    return -ENOMEM;
+  auto it = find_bb(bbl, bb);
+  if (it == bbl->blocks.end()) {
+    return -EINVAL;
   }
 
-  *new_bb = *bb;
+  new_bb = *bb;
 
-  new_bb->len = bb->len - max_len;
-  new_bb->block = bb->block + max_len / bbl->block_size;
-  new_bb->next = bb->next;
+  new_bb.len = bb->len - max_len;
+  new_bb.block = bb->block + max_len / bbl->block_size;
 
   switch (bb->type) {
     case BACKED_BLOCK_DATA:
-      new_bb->data.data = (char*)bb->data.data + max_len;
+      new_bb.data.data = (char*)bb->data.data + max_len;
       break;
     case BACKED_BLOCK_FILE:
-      new_bb->file.filename = strdup(bb->file.filename);
-      if (!new_bb->file.filename) {
-        free(new_bb);
+      new_bb.file.filename = strdup(bb->file.filename);
+      if (!new_bb.file.filename) {
         return -ENOMEM;
       }
-      new_bb->file.offset += max_len;
+      new_bb.file.offset += max_len;
       break;
     case BACKED_BLOCK_FD:
-      new_bb->fd.offset += max_len;
+      new_bb.fd.offset += max_len;
       break;
     case BACKED_BLOCK_FILL:
       break;
   }
 
-  bb->next = new_bb;
   bb->len = max_len;
+  link_bb(bbl, bbl->blocks.emplace_hint(std::next(it), new_bb.block, new_bb));
   return 0;
 }
@@ -38,7 +38,10 @@
 #endif
 
 void usage() {
-  fprintf(stderr, "Usage: img2simg [-s] <raw_image_file> <sparse_image_file> [<block_size>]\n");
+  fprintf(stderr,
+          "Usage: img2simg [-s] [-j <threads>] <raw_image_file> <sparse_image_file> "
+          "[<block_size>]\n");
+  fprintf(stderr, "  -j <threads>  scan the input on several threads (0 for one per CPU)\n");
 }
 
 int main(int argc, char* argv[]) {
@@ -53,12 +56,18 @@ int main(int argc, char* argv[]) {
   struct sparse_file* s;
   unsigned int block_size = 4096;
   off64_t len;
+  bool parallel = false;
+  unsigned int threads = 0;
 
-  while ((opt = getopt(argc, argv, "s")) != -1) {
+  while ((opt = getopt(argc, argv, "sj:")) != -1) {
     switch (opt) {
       case 's':
         mode = SPARSE_READ_MODE_HOLE;
         break;
+      case 'j':
+        parallel = true;
+        threads = atoi(optarg);
+        break;
       default:
         usage();
         exit(EXIT_FAILURE);
@@ -80,6 +89,11 @@ int main(int argc, char* argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  if (parallel && mode != SPARSE_READ_MODE_NORMAL) {
+    fprintf(stderr, "-j cannot be used with -s\n");
+    exit(EXIT_FAILURE);
+  }
+
   arg_in = argv[optind];
   if (strcmp(arg_in, "-") == 0) {
     in = STDIN_FILENO;
@@ -105,6 +119,18 @@ int main(int argc, char* argv[]) {
   len = lseek64(in, 0, SEEK_END);
   lseek64(in, 0, SEEK_SET);
 
+  /* Stream the output while the input is scanned, if the output is seekable. */
+  if (parallel && lseek64(out, 0, SEEK_CUR) >= 0) {
+    ret = sparse_file_write_raw(in, out, block_size, len, threads, false);
+    if (ret) {
+      fprintf(stderr, "Failed to convert file\n");
+      exit(EXIT_FAILURE);
+    }
+    close(in);
+    close(out);
+    exit(EXIT_SUCCESS);
+  }
+
   s = sparse_file_new(block_size, len);
   if (!s) {
     fprintf(stderr, "Failed to create sparse file\n");
@@ -112,7 +138,11 @@ int main(int argc, char* argv[]) {
   }
 
   sparse_file_verbose(s);
-  ret = sparse_file_read(s, in, mode, false);
+  if (parallel) {
+    ret = sparse_file_read_parallel(s, in, threads);
+  } else {
+    ret = sparse_file_read(s, in, mode, false);
+  }
   if (ret) {
     fprintf(stderr, "Failed to read file\n");
     exit(EXIT_FAILURE);
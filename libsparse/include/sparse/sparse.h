@@ -262,6 +262,43 @@ enum sparse_read_mode {
  */
 int sparse_file_read(struct sparse_file *s, int fd, enum sparse_read_mode mode, bool crc);
 
+/**
+ * sparse_file_read_parallel - read a regular file into a sparse file cookie
+ * using multiple threads
+ *
+ * @s - sparse file cookie
+ * @fd - file descriptor to read from, must support positional reads
+ * @threads - number of threads to use, or 0 for one per CPU
+ *
+ * Same as sparse_file_read with %SPARSE_READ_MODE_NORMAL, but reads the input
+ * in large windows, looks for constant blocks in several windows in parallel
+ * and adds already merged runs of blocks to the sparse file cookie.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_read_parallel(struct sparse_file *s, int fd, unsigned int threads);
+
+/**
+ * sparse_file_write_raw - convert a regular file to an Android sparse file
+ *
+ * @in_fd - file descriptor to read from, must support positional reads
+ * @out_fd - file descriptor to write to, must be seekable
+ * @block_size - block size of the sparse file
+ * @len - length of the input to convert
+ * @threads - number of threads to use, or 0 for one per CPU
+ * @crc - append a crc chunk
+ *
+ * Equivalent to reading @in_fd with sparse_file_read_parallel and writing the
+ * result with sparse_file_write, except that chunks are written as soon as the
+ * blocks they cover have been scanned, instead of after the whole input has
+ * been read. The chunk count in the sparse header is filled in at the end,
+ * which is why @out_fd must be seekable.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_write_raw(int in_fd, int out_fd, unsigned int block_size, int64_t len,
+		unsigned int threads, bool crc);
+
 /**
  * sparse_file_import - import an existing sparse file
  *
@@ -310,6 +347,58 @@ struct sparse_file* sparse_file_import_buf(char* buf, size_t len, bool verbose,
  */
 struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 
+struct sparse_stream;
+
+/**
+ * sparse_stream_new - create a decoder for a sparse file received in pieces
+ *
+ * @write - function to call with the expanded data
+ * @priv - value that will be passed as the first argument to write
+ *
+ * Creates a cookie that expands a file in the Android sparse file format as it
+ * is passed to sparse_stream_write, without needing the whole file in memory.
+ * The callback 'write' is called in order with the expanded data, as with
+ * sparse_file_callback with sparse set to false: with data==NULL to skip over
+ * a "don't care" region.  The callback should return negative on error, 0 on
+ * success.
+ *
+ * Returns the stream cookie, or NULL on error.
+ */
+struct sparse_stream *sparse_stream_new(int (*write)(void *priv, const void *data, size_t len),
+		void *priv);
+
+/**
+ * sparse_stream_write - decode the next bytes of a sparse file
+ *
+ * @s - stream cookie
+ * @data - next bytes of the sparse file
+ * @len - number of bytes in data
+ *
+ * Raw chunk data is passed to the callback without being copied.
+ *
+ * Returns 0 on success, negative errno if the sparse file is invalid, or the
+ * value returned by a failing callback.  The stream cannot be used after an
+ * error.
+ */
+int sparse_stream_write(struct sparse_stream *s, const void *data, size_t len);
+
+/**
+ * sparse_stream_finish - check that a complete sparse file was decoded
+ *
+ * @s - stream cookie
+ *
+ * Returns 0 if every chunk of the sparse file was received and expanded to the
+ * number of blocks given in its header, -EINVAL otherwise.
+ */
+int sparse_stream_finish(struct sparse_stream *s);
+
+/**
+ * sparse_stream_destroy - destroy a stream cookie
+ *
+ * @s - stream cookie
+ */
+void sparse_stream_destroy(struct sparse_stream *s);
+
 /** sparse_file_resparse - rechunk an existing sparse file into smaller files
  *
  * @in_s - sparse file cookie of the existing sparse file
@@ -100,6 +100,8 @@ struct output_file_gz {
 struct output_file_normal {
   struct output_file out;
   int fd;
+  /* Offset of the sparse header, -1 if the fd is not seekable */
+  off64_t start;
 };
 
 #define to_output_file_normal(_o) container_of((_o), struct output_file_normal, out)
@@ -116,6 +118,7 @@ static int file_open(struct output_file* out, int fd) {
   struct output_file_normal* outn = to_output_file_normal(out);
 
   outn->fd = fd;
+  outn->start = lseek64(fd, 0, SEEK_CUR);
   return 0;
 }
 
@@ -607,8 +610,7 @@ static struct sparse_file_ops normal_file_ops = {
     .write_fd_chunk = write_normal_fd_chunk,
 };
 
-void output_file_close(struct output_file* out) {
-  out->sparse_ops->write_end_chunk(out);
+static void output_file_free(struct output_file* out) {
   free(out->zero_buf);
   free(out->fill_buf);
   out->zero_buf = nullptr;
@@ -616,6 +618,55 @@ void output_file_close(struct output_file* out) {
   out->ops->close(out);
 }
 
+void output_file_close(struct output_file* out) {
+  out->sparse_ops->write_end_chunk(out);
+  output_file_free(out);
+}
+
+/* Rewrites the chunk count in the sparse header of a file output */
+static int file_update_chunk_count(struct output_file* out) {
+  struct output_file_normal* outn = to_output_file_normal(out);
+  uint32_t total_chunks = out->chunk_cnt;
+  off64_t end;
+  int ret;
+
+  if (outn->start < 0) {
+    return -ESPIPE;
+  }
+  end = lseek64(outn->fd, 0, SEEK_CUR);
+  if (end < 0 ||
+      lseek64(outn->fd, outn->start + offsetof(sparse_header_t, total_chunks), SEEK_SET) < 0) {
+    error_errno("lseek64");
+    return -errno;
+  }
+  ret = file_write(out, &total_chunks, sizeof(total_chunks));
+  if (ret < 0) {
+    return ret;
+  }
+  if (lseek64(outn->fd, end, SEEK_SET) < 0) {
+    error_errno("lseek64");
+    return -errno;
+  }
+  return 0;
+}
+
+/*
+ * Closes a sparse file output that was opened on an fd with 0 chunks, writing
+ * the actual number of chunks into the sparse header.
+ */
+int output_file_close_streaming(struct output_file* out) {
+  int ret = -EINVAL;
+
+  if (out->ops == &file_ops && out->sparse_ops == &sparse_file_ops) {
+    ret = out->sparse_ops->write_end_chunk(out);
+    if (!ret) {
+      ret = file_update_chunk_count(out);
+    }
+  }
+  output_file_free(out);
+  return ret;
+}
+
 static int output_file_init(struct output_file* out, int block_size, int64_t len, bool sparse,
                             int chunks, bool crc) {
   int ret;
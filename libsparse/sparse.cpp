@@ -17,6 +17,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include <sparse/sparse.h>
 
 #include "defs.h"
@@ -26,6 +28,7 @@
 #include "output_file.h"
 #include "sparse_defs.h"
 #include "sparse_format.h"
+#include "sparse_scan.h"
 
 struct sparse_file* sparse_file_new(unsigned int block_size, int64_t len) {
   struct sparse_file* s = reinterpret_cast<sparse_file*>(calloc(sizeof(struct sparse_file), 1));
@@ -165,6 +168,48 @@ int sparse_file_write(struct sparse_file* s, int fd, bool gz, bool sparse, bool
   return ret;
 }
 
+int sparse_file_write_raw(int in_fd, int out_fd, unsigned int block_size, int64_t len,
+                          unsigned int threads, bool crc) {
+  struct output_file* out;
+  unsigned int last_block = 0;
+  int64_t pad;
+  int ret;
+
+  out = output_file_open_fd(out_fd, block_size, len, false, true, 0, crc);
+  if (!out) return -ENOMEM;
+
+  ret = sparse_scan_raw(in_fd, len, block_size, threads, [&](const sparse_run& run) {
+    int err;
+
+    if (run.block > last_block) {
+      err = write_skip_chunk(out, (int64_t)(run.block - last_block) * block_size);
+      if (err) return err;
+    }
+    for (uint64_t done = 0; done < run.len; done += MAX_BACKED_BLOCK_SIZE) {
+      uint64_t chunk_len = std::min(run.len - done, (uint64_t)MAX_BACKED_BLOCK_SIZE);
+      if (run.type == BACKED_BLOCK_FILL) {
+        err = write_fill_chunk(out, chunk_len, run.fill_val);
+      } else {
+        err = write_fd_chunk(out, chunk_len, in_fd, run.offset + done);
+      }
+      if (err) return err;
+    }
+    last_block = run.block + DIV_ROUND_UP(run.len, block_size);
+    return 0;
+  });
+
+  pad = len - (int64_t)last_block * block_size;
+  if (!ret && pad > 0) {
+    ret = write_skip_chunk(out, pad);
+  }
+
+  if (ret) {
+    output_file_close(out);
+    return ret;
+  }
+  return output_file_close_streaming(out);
+}
+
 int sparse_file_callback(struct sparse_file* s, bool sparse, bool crc,
                          int (*write)(void* priv, const void* data, size_t len), void* priv) {
   int ret;
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <sparse/sparse.h>
+
+#include "sparse_crc32.h"
+
+static constexpr size_t kBlockSize = 4096;
+static constexpr size_t kPatternSize = 64 * 1024 * 1024;
+
+// A raw image and its sparse conversion, created once per image size.
+struct TestImages {
+  TemporaryFile raw;
+  TemporaryFile sparse;
+};
+
+static std::map<int64_t, std::unique_ptr<TestImages>> sImages;
+
+// Roughly models a filesystem image: runs of data blocks, zeroed blocks and
+// blocks filled with a repeated word. The same 64MB pattern is repeated to
+// build multi-GB images quickly.
+static std::vector<uint32_t> BuildPattern() {
+  std::mt19937 gen(7);
+  std::discrete_distribution<int> kind({50, 35, 15});
+  std::uniform_int_distribution<size_t> run_length(1, 256);
+
+  std::vector<uint32_t> pattern(kPatternSize / sizeof(uint32_t));
+  const size_t words_per_block = kBlockSize / sizeof(uint32_t);
+  size_t block = 0;
+  const size_t num_blocks = kPatternSize / kBlockSize;
+  while (block < num_blocks) {
+    const int k = kind(gen);
+    const uint32_t fill = gen();
+    for (size_t n = run_length(gen); n && block < num_blocks; n--, block++) {
+      uint32_t* p = &pattern[block * words_per_block];
+      for (size_t i = 0; i < words_per_block; i++) {
+        p[i] = k == 0 ? gen() : (k == 1 ? 0 : fill);
+      }
+    }
+  }
+  return pattern;
+}
+
+static TestImages* GetImages(int64_t size) {
+  auto it = sImages.find(size);
+  if (it != sImages.end()) {
+    return it->second.get();
+  }
+
+  static const std::vector<uint32_t> pattern = BuildPattern();
+  auto images = std::make_unique<TestImages>();
+  for (int64_t written = 0; written < size; written += kPatternSize) {
+    CHECK(android::base::WriteFully(images->raw.fd, pattern.data(), kPatternSize));
+  }
+
+  struct sparse_file* s = sparse_file_new(kBlockSize, size);
+  CHECK(s);
+  CHECK_EQ(sparse_file_read(s, images->raw.fd, SPARSE_READ_MODE_NORMAL, false), 0);
+  CHECK_EQ(sparse_file_write(s, images->sparse.fd, false, true, false), 0);
+  sparse_file_destroy(s);
+
+  TestImages* result = images.get();
+  sImages.emplace(size, std::move(images));
+  return result;
+}
+
+static void ResetFile(int fd) {
+  CHECK_EQ(ftruncate(fd, 0), 0);
+  CHECK_EQ(lseek(fd, 0, SEEK_SET), 0);
+}
+
+static void BM_Crc32(benchmark::State& state) {
+  std::vector<uint8_t> buffer(state.range(0));
+  std::mt19937 gen(3);
+  for (auto& b : buffer) {
+    b = gen();
+  }
+
+  uint32_t crc = 0;
+  for (auto _ : state) {
+    crc = sparse_crc32(crc, buffer.data(), buffer.size());
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_Crc32)->Arg(4096)->Arg(1 << 20);
+
+// Equivalent of "img2simg raw sparse".
+static void BM_Img2Simg(benchmark::State& state) {
+  const int64_t size = state.range(0) << 20;
+  TestImages* images = GetImages(size);
+  TemporaryFile out;
+
+  for (auto _ : state) {
+    ResetFile(out.fd);
+    CHECK_EQ(lseek(images->raw.fd, 0, SEEK_SET), 0);
+
+    struct sparse_file* s = sparse_file_new(kBlockSize, size);
+    CHECK_EQ(sparse_file_read(s, images->raw.fd, SPARSE_READ_MODE_NORMAL, false), 0);
+    CHECK_EQ(sparse_file_write(s, out.fd, false, true, false), 0);
+    sparse_file_destroy(s);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_Img2Simg)->Arg(1024)->Arg(4096)->Unit(benchmark::kMillisecond);
+
+// Equivalent of "img2simg -j <threads> raw sparse".
+static void BM_Img2SimgParallel(benchmark::State& state) {
+  const int64_t size = state.range(0) << 20;
+  const unsigned int threads = state.range(1);
+  TestImages* images = GetImages(size);
+  TemporaryFile out;
+
+  for (auto _ : state) {
+    ResetFile(out.fd);
+    CHECK_EQ(sparse_file_write_raw(images->raw.fd, out.fd, kBlockSize, size, threads, false), 0);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_Img2SimgParallel)
+    ->ArgsProduct({{1024, 4096}, {1, 4, 0}})
+    ->Unit(benchmark::kMillisecond);
+
+// Equivalent of "simg2img sparse raw", with CRC checking.
+static void BM_Simg2Img(benchmark::State& state) {
+  const int64_t size = state.range(0) << 20;
+  TestImages* images = GetImages(size);
+  TemporaryFile out;
+
+  for (auto _ : state) {
+    ResetFile(out.fd);
+    CHECK_EQ(lseek(images->sparse.fd, 0, SEEK_SET), 0);
+
+    struct sparse_file* s = sparse_file_import(images->sparse.fd, false, true);
+    CHECK(s);
+    CHECK_EQ(sparse_file_write(s, out.fd, false, false, false), 0);
+    sparse_file_destroy(s);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_Simg2Img)->Arg(1024)->Arg(4096)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
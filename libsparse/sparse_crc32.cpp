@@ -45,8 +45,24 @@
 /* Code taken from FreeBSD 8 */
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-static uint32_t crc32_tab[] = {
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <immintrin.h>
+#define SPARSE_CRC32_PCLMUL 1
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define SPARSE_CRC32_ARMV8 1
+#endif
+
+#include "sparse_crc32.h"
+
+static constexpr uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
     0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
     0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
@@ -81,17 +97,209 @@ static uint32_t crc32_tab[] = {
     0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
 
 /*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
+ * Tables for the slice-by-8 variant: crc32_slice_tab[k][b] is the CRC of
+ * byte b followed by k zero bytes, which lets eight input bytes be folded
+ * into the CRC with eight independent table lookups.
+ */
+struct Crc32SliceTables {
+  uint32_t tab[8][256];
+
+  constexpr Crc32SliceTables() : tab() {
+    for (int i = 0; i < 256; i++) {
+      tab[0][i] = crc32_tab[i];
+    }
+    for (int k = 1; k < 8; k++) {
+      for (int i = 0; i < 256; i++) {
+        tab[k][i] = (tab[k - 1][i] >> 8) ^ crc32_tab[tab[k - 1][i] & 0xFF];
+      }
+    }
+  }
+};
+
+static constexpr Crc32SliceTables crc32_slice_tab;
+
+/*
+ * The implementations below work on the pre- and post-inverted CRC
+ * register, see sparse_crc32().
+ */
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t* p, size_t size) {
+  while (size--) crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t* p, size_t size) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const auto& t = crc32_slice_tab.tab;
+  while (size >= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, sizeof(lo));
+    memcpy(&hi, p + 4, sizeof(hi));
+    lo ^= crc;
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+          t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    p += 8;
+    size -= 8;
+  }
+#endif
+  return crc32_bytes(crc, p, size);
+}
+
+#ifdef SPARSE_CRC32_PCLMUL
+/*
+ * Folds 64 bytes at a time with carry-less multiplication, then reduces to
+ * 32 bits with Barrett reduction. |size| must be at least 64 and a multiple
+ * of 16. Based on "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction", V. Gopal, E. Ozturk, et al., 2009; the constants
+ * are the bit-reflected ones given at the end of the paper.
  */
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_pclmul_fold(uint32_t crc,
+                                                                           const uint8_t* p,
+                                                                           size_t size) {
+  alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+  x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+  x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+  x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+  p += 64;
+  size -= 64;
+
+  /* Fold four lanes of 16 bytes in parallel. */
+  while (size >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+    y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+    y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+    y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+    y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+    p += 64;
+    size -= 64;
+  }
+
+  /* Fold the four lanes into one. */
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  /* Fold the remaining blocks of 16 bytes. */
+  while (size >= 16) {
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    p += 16;
+    size -= 16;
+  }
+
+  /* Fold 128 bits down to 64 bits. */
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+
+  x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /* Barrett reduction to 32 bits. */
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* p, size_t size) {
+  if (size >= 64) {
+    size_t fold_size = size & ~static_cast<size_t>(15);
+    crc = crc32_pclmul_fold(crc, p, fold_size);
+    p += fold_size;
+    size -= fold_size;
+  }
+  return crc32_slice8(crc, p, size);
+}
+#endif
+
+#ifdef SPARSE_CRC32_ARMV8
+/* ARMv8 CRC32 instructions implement the same (IEEE 802.3) polynomial. */
+__attribute__((target("crc"))) static uint32_t crc32_armv8(uint32_t crc, const uint8_t* p,
+                                                           size_t size) {
+  while (size && (reinterpret_cast<uintptr_t>(p) & 7)) {
+    crc = __builtin_arm_crc32b(crc, *p++);
+    size--;
+  }
+  while (size >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    crc = __builtin_arm_crc32d(crc, v);
+    p += 8;
+    size -= 8;
+  }
+  while (size--) crc = __builtin_arm_crc32b(crc, *p++);
+  return crc;
+}
+#endif
+
+using crc32_impl_t = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+static crc32_impl_t select_crc32_impl() {
+#ifdef SPARSE_CRC32_PCLMUL
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    return crc32_pclmul;
+  }
+#endif
+#ifdef SPARSE_CRC32_ARMV8
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    return crc32_armv8;
+  }
+#endif
+  return crc32_slice8;
+}
 
 uint32_t sparse_crc32(uint32_t crc_in, const void* buf, size_t size) {
+  static const crc32_impl_t impl = select_crc32_impl();
   const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
-  uint32_t crc;
 
-  crc = crc_in ^ ~0U;
-  while (size--) crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-  return crc ^ ~0U;
+  return impl(crc_in ^ ~0U, p, size) ^ ~0U;
 }
@@ -26,16 +26,28 @@
 #include <string.h>
 #include <unistd.h>
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include <sparse/sparse.h>
 
+#include "android-base/file.h"
 #include "android-base/stringprintf.h"
 #include "defs.h"
 #include "output_file.h"
 #include "sparse_crc32.h"
 #include "sparse_file.h"
 #include "sparse_format.h"
+#include "sparse_scan.h"
 
 #if defined(__APPLE__) && defined(__MACH__)
 #define lseek64 lseek
@@ -49,6 +61,8 @@
 static constexpr int64_t COPY_BUF_SIZE = 1024 * 1024;
 static char* copybuf;
 
+static constexpr int64_t SCAN_WINDOW_SIZE = 16 * 1024 * 1024;
+
 static std::string ErrorString(int err) {
   if (err == -EOVERFLOW) return "EOF while reading file";
   if (err == -EINVAL) return "Invalid sparse file format";
@@ -457,12 +471,54 @@ static int sparse_file_read_sparse(struct sparse_file* s, SparseFileSource* sour
   return 0;
 }
 
+/* Returns true if all the 32-bit words in buf[0..len) are equal to buf[0].
+ * len must be a multiple of 4. */
+static bool is_fill_block(const uint32_t* buf, size_t len) {
+  const size_t words = len / sizeof(uint32_t);
+  /* Each iteration of the vector loops checks 64 bytes. */
+  const size_t vector_words = words & ~static_cast<size_t>(15);
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i pattern = _mm_set1_epi32(buf[0]);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i < vector_words; i += 16) {
+    const __m128i* p = reinterpret_cast<const __m128i*>(buf + i);
+    __m128i a = _mm_xor_si128(_mm_loadu_si128(p), pattern);
+    __m128i b = _mm_xor_si128(_mm_loadu_si128(p + 1), pattern);
+    __m128i c = _mm_xor_si128(_mm_loadu_si128(p + 2), pattern);
+    __m128i d = _mm_xor_si128(_mm_loadu_si128(p + 3), pattern);
+    __m128i diff = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF) {
+      return false;
+    }
+  }
+#elif defined(__aarch64__)
+  const uint32x4_t pattern = vdupq_n_u32(buf[0]);
+  for (; i < vector_words; i += 16) {
+    uint32x4_t a = veorq_u32(vld1q_u32(buf + i), pattern);
+    uint32x4_t b = veorq_u32(vld1q_u32(buf + i + 4), pattern);
+    uint32x4_t c = veorq_u32(vld1q_u32(buf + i + 8), pattern);
+    uint32x4_t d = veorq_u32(vld1q_u32(buf + i + 12), pattern);
+    if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d)))) {
+      return false;
+    }
+  }
+#endif
+
+  for (; i < words; i++) {
+    if (buf[i] != buf[0]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* buf, int64_t offset,
                                       int64_t remain) {
   int ret;
   unsigned int block = offset / s->block_size;
   unsigned int to_read;
-  unsigned int i;
   bool sparse_block;
 
   if (!buf) {
@@ -477,17 +533,7 @@ static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* b
       return ret;
     }
 
-    if (to_read == s->block_size) {
-      sparse_block = true;
-      for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-        if (buf[0] != buf[i]) {
-          sparse_block = false;
-          break;
-        }
-      }
-    } else {
-      sparse_block = false;
-    }
+    sparse_block = to_read == s->block_size && is_fill_block(buf, to_read);
 
     if (sparse_block) {
       /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
@@ -516,6 +562,164 @@ static int sparse_file_read_normal(struct sparse_file* s, int fd) {
   return ret;
 }
 
+static bool sparse_run_append(sparse_run* run, const sparse_run& next, unsigned int block_size) {
+  if (run->type != next.type || run->len % block_size ||
+      run->block + run->len / block_size != next.block) {
+    return false;
+  }
+  if (run->type == BACKED_BLOCK_FILL ? run->fill_val != next.fill_val
+                                     : run->offset + (int64_t)run->len != next.offset) {
+    return false;
+  }
+  run->len += next.len;
+  return true;
+}
+
+/* Classifies the blocks of len bytes of data read from offset, appending
+ * merged runs to runs. */
+static void scan_window(const uint32_t* buf, int64_t offset, size_t len, unsigned int block_size,
+                        std::vector<sparse_run>* runs) {
+  for (size_t pos = 0; pos < len; pos += block_size) {
+    const uint32_t* block_buf = buf + pos / sizeof(uint32_t);
+    size_t block_len = std::min(len - pos, (size_t)block_size);
+    sparse_run run = {};
+    run.block = (offset + pos) / block_size;
+    run.offset = offset + pos;
+    run.len = block_len;
+    if (block_len == block_size && is_fill_block(block_buf, block_len)) {
+      run.type = BACKED_BLOCK_FILL;
+      run.fill_val = block_buf[0];
+    } else {
+      run.type = BACKED_BLOCK_FD;
+    }
+    if (runs->empty() || !sparse_run_append(&runs->back(), run, block_size)) {
+      runs->push_back(run);
+    }
+  }
+}
+
+int sparse_scan_raw(int fd, int64_t len, unsigned int block_size, unsigned int threads,
+                    const std::function<int(const sparse_run&)>& run_cb) {
+  const int64_t window = std::max((int64_t)block_size, ALIGN_DOWN(SCAN_WINDOW_SIZE, block_size));
+  const size_t num_windows = DIV_ROUND_UP(len, window);
+  if (!num_windows) {
+    return 0;
+  }
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min((size_t)threads, num_windows);
+
+  /* Windows are classified out of order, but at most max_ahead windows past
+   * the oldest one not yet handed to run_cb, which bounds memory use. */
+  struct window_result {
+    bool done = false;
+    int error = 0;
+    std::vector<sparse_run> runs;
+  };
+  const size_t max_ahead = 2 * threads;
+  std::vector<window_result> results(max_ahead);
+  std::mutex lock;
+  std::condition_variable cv;
+  size_t next_window = 0;
+  size_t consumed = 0;
+  bool stop = false;
+
+  auto worker = [&]() {
+    std::vector<uint32_t> buf(window / sizeof(uint32_t) + 1);
+    while (true) {
+      size_t idx;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        cv.wait(l, [&] {
+          return stop || next_window >= num_windows || next_window < consumed + max_ahead;
+        });
+        if (stop || next_window >= num_windows) {
+          return;
+        }
+        idx = next_window++;
+      }
+
+      window_result result;
+      const int64_t offset = idx * window;
+      const size_t size = std::min(window, len - offset);
+      if (android::base::ReadFullyAtOffset(fd, buf.data(), size, offset)) {
+        scan_window(buf.data(), offset, size, block_size, &result.runs);
+      } else {
+        result.error = errno ? -errno : -EINVAL;
+      }
+      result.done = true;
+
+      {
+        std::lock_guard<std::mutex> l(lock);
+        results[idx % max_ahead] = std::move(result);
+      }
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+
+  int ret = 0;
+  sparse_run pending = {};
+  bool has_pending = false;
+  for (size_t idx = 0; idx < num_windows && !ret; idx++) {
+    window_result result;
+    {
+      std::unique_lock<std::mutex> l(lock);
+      window_result* slot = &results[idx % max_ahead];
+      cv.wait(l, [&] { return slot->done; });
+      result = std::move(*slot);
+      *slot = window_result();
+      consumed++;
+    }
+    cv.notify_all();
+
+    if (result.error) {
+      error("failed to read sparse file");
+      ret = result.error;
+      break;
+    }
+    for (const auto& run : result.runs) {
+      if (has_pending && sparse_run_append(&pending, run, block_size)) {
+        continue;
+      }
+      if (has_pending) {
+        ret = run_cb(pending);
+        if (ret) break;
+      }
+      pending = run;
+      has_pending = true;
+    }
+  }
+  if (!ret && has_pending) {
+    ret = run_cb(pending);
+  }
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stop = true;
+  }
+  cv.notify_all();
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  return ret;
+}
+
+int sparse_file_read_parallel(struct sparse_file* s, int fd, unsigned int threads) {
+  return sparse_scan_raw(fd, s->len, s->block_size, threads, [s, fd](const sparse_run& run) {
+    if (run.type == BACKED_BLOCK_FILL) {
+      return sparse_file_add_fill(s, run.fill_val, run.len, run.block);
+    }
+    return sparse_file_add_fd(s, fd, run.offset, run.len, run.block);
+  });
+}
+
 #ifdef __linux__
 static int sparse_file_read_hole(struct sparse_file* s, int fd) {
   int ret;
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBSPARSE_SPARSE_SCAN_H_
+#define _LIBSPARSE_SPARSE_SCAN_H_
+
+#include <stdint.h>
+
+#include <functional>
+
+#include "backed_block.h"
+
+/* A run of consecutive blocks of a raw file, either all filled with the same
+ * 32 bit value or all backed by the file itself. */
+struct sparse_run {
+  enum backed_block_type type; /* BACKED_BLOCK_FILL or BACKED_BLOCK_FD */
+  uint32_t fill_val;
+  unsigned int block;
+  int64_t offset;
+  uint64_t len;
+};
+
+/* Scans the first len bytes of the raw file fd in large windows, classifying
+ * the blocks of several windows in parallel on up to threads threads (0 for
+ * one per CPU). Calls run_cb, on the calling thread and in block order, with
+ * maximal runs of blocks. Stops early if run_cb returns non-zero.
+ *
+ * Returns 0 on success, the value returned by run_cb, or negative errno on
+ * read error. */
+int sparse_scan_raw(int fd, int64_t len, unsigned int block_size, unsigned int threads,
+                    const std::function<int(const sparse_run&)>& run_cb);
+
+#endif
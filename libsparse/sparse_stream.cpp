@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+#include <sparse/sparse.h>
+
+#include "sparse_format.h"
+
+#define SPARSE_HEADER_MAJOR_VER 1
+#define SPARSE_HEADER_LEN (sizeof(sparse_header_t))
+#define CHUNK_HEADER_LEN (sizeof(chunk_header_t))
+
+/* Size of the buffer used to expand fill chunks. */
+static constexpr size_t FILL_BUF_SIZE = 64 * 1024;
+
+enum stream_state {
+  STREAM_FILE_HEADER,
+  STREAM_CHUNK_HEADER,
+  STREAM_CHUNK_DATA,
+  STREAM_DONE,
+  STREAM_ERROR,
+};
+
+struct sparse_stream {
+  int (*write)(void* priv, const void* data, size_t len);
+  void* priv;
+
+  enum stream_state state;
+  sparse_header_t sparse_header;
+  chunk_header_t chunk_header;
+
+  /* Fixed size part of the header being received. */
+  uint8_t hdr_buf[std::max(SPARSE_HEADER_LEN, CHUNK_HEADER_LEN)];
+  size_t hdr_len;
+  /* Bytes of a header longer than we expect, still to be skipped. */
+  size_t hdr_skip;
+
+  /* Bytes of the current chunk's data still to be received. */
+  uint64_t data_remaining;
+  /* Value of a fill or crc32 chunk, as it is received. */
+  uint32_t value;
+
+  unsigned int chunks_done;
+  unsigned int cur_block;
+  uint32_t* fill_buf;
+};
+
+struct sparse_stream* sparse_stream_new(int (*write)(void* priv, const void* data, size_t len),
+                                        void* priv) {
+  struct sparse_stream* s = new (std::nothrow) sparse_stream();
+  if (!s) {
+    return nullptr;
+  }
+  s->write = write;
+  s->priv = priv;
+  s->state = STREAM_FILE_HEADER;
+  return s;
+}
+
+void sparse_stream_destroy(struct sparse_stream* s) {
+  free(s->fill_buf);
+  delete s;
+}
+
+/* Copies up to need - hdr_len bytes of a header. Returns the number of bytes
+ * consumed. */
+static size_t gather(struct sparse_stream* s, const uint8_t* data, size_t len, size_t need) {
+  size_t n = std::min(len, need - s->hdr_len);
+  memcpy(s->hdr_buf + s->hdr_len, data, n);
+  s->hdr_len += n;
+  return n;
+}
+
+static int parse_file_header(struct sparse_stream* s) {
+  sparse_header_t* header = &s->sparse_header;
+  memcpy(header, s->hdr_buf, SPARSE_HEADER_LEN);
+
+  if (header->magic != SPARSE_HEADER_MAGIC ||
+      header->major_version != SPARSE_HEADER_MAJOR_VER ||
+      header->file_hdr_sz < SPARSE_HEADER_LEN || header->chunk_hdr_sz < CHUNK_HEADER_LEN ||
+      header->blk_sz == 0 || header->blk_sz % 4 != 0) {
+    return -EINVAL;
+  }
+
+  s->hdr_skip = header->file_hdr_sz - SPARSE_HEADER_LEN;
+  s->state = header->total_chunks ? STREAM_CHUNK_HEADER : STREAM_DONE;
+  return 0;
+}
+
+static int emit_fill(struct sparse_stream* s, uint64_t len) {
+  if (!s->fill_buf) {
+    s->fill_buf = static_cast<uint32_t*>(malloc(FILL_BUF_SIZE));
+    if (!s->fill_buf) {
+      return -ENOMEM;
+    }
+  }
+  std::fill_n(s->fill_buf, FILL_BUF_SIZE / sizeof(uint32_t), s->value);
+
+  while (len) {
+    size_t chunk = std::min<uint64_t>(len, FILL_BUF_SIZE);
+    int ret = s->write(s->priv, s->fill_buf, chunk);
+    if (ret < 0) {
+      return ret;
+    }
+    len -= chunk;
+  }
+  return 0;
+}
+
+static void next_chunk(struct sparse_stream* s) {
+  s->cur_block += s->chunk_header.chunk_sz;
+  s->chunks_done++;
+  s->state = s->chunks_done == s->sparse_header.total_chunks ? STREAM_DONE : STREAM_CHUNK_HEADER;
+}
+
+/* Called once a chunk's data has been received. */
+static int end_chunk(struct sparse_stream* s) {
+  uint64_t len = (uint64_t)s->chunk_header.chunk_sz * s->sparse_header.blk_sz;
+  int ret = 0;
+
+  switch (s->chunk_header.chunk_type) {
+    case CHUNK_TYPE_FILL:
+      ret = emit_fill(s, len);
+      break;
+    case CHUNK_TYPE_DONT_CARE:
+      if (len) {
+        ret = s->write(s->priv, nullptr, len);
+      }
+      break;
+    case CHUNK_TYPE_CRC32:
+      /* Not verified, as that would need the crc of the "don't care" regions. */
+      s->chunk_header.chunk_sz = 0;
+      break;
+  }
+  if (ret < 0) {
+    return ret;
+  }
+
+  next_chunk(s);
+  return 0;
+}
+
+static int parse_chunk_header(struct sparse_stream* s) {
+  chunk_header_t* chunk = &s->chunk_header;
+  memcpy(chunk, s->hdr_buf, CHUNK_HEADER_LEN);
+
+  if (chunk->total_sz < s->sparse_header.chunk_hdr_sz) {
+    return -EINVAL;
+  }
+  uint64_t data_size = chunk->total_sz - s->sparse_header.chunk_hdr_sz;
+
+  switch (chunk->chunk_type) {
+    case CHUNK_TYPE_RAW:
+      if (data_size != (uint64_t)chunk->chunk_sz * s->sparse_header.blk_sz) {
+        return -EINVAL;
+      }
+      break;
+    case CHUNK_TYPE_FILL:
+    case CHUNK_TYPE_CRC32:
+      if (data_size != sizeof(s->value)) {
+        return -EINVAL;
+      }
+      break;
+    case CHUNK_TYPE_DONT_CARE:
+      if (data_size != 0) {
+        return -EINVAL;
+      }
+      break;
+    default:
+      return -EINVAL;
+  }
+
+  s->hdr_skip = s->sparse_header.chunk_hdr_sz - CHUNK_HEADER_LEN;
+  s->data_remaining = data_size;
+  s->state = STREAM_CHUNK_DATA;
+  return 0;
+}
+
+static int stream_write(struct sparse_stream* s, const uint8_t* data, size_t len) {
+  int ret;
+
+  while (len) {
+    if (s->hdr_skip) {
+      size_t n = std::min(len, s->hdr_skip);
+      s->hdr_skip -= n;
+      data += n;
+      len -= n;
+    } else {
+      switch (s->state) {
+        case STREAM_FILE_HEADER:
+        case STREAM_CHUNK_HEADER: {
+          size_t need = s->state == STREAM_FILE_HEADER ? SPARSE_HEADER_LEN : CHUNK_HEADER_LEN;
+          size_t n = gather(s, data, len, need);
+          data += n;
+          len -= n;
+          if (s->hdr_len < need) {
+            break;
+          }
+          s->hdr_len = 0;
+          ret = s->state == STREAM_FILE_HEADER ? parse_file_header(s) : parse_chunk_header(s);
+          if (ret < 0) {
+            return ret;
+          }
+          break;
+        }
+        case STREAM_CHUNK_DATA: {
+          size_t n = std::min<uint64_t>(len, s->data_remaining);
+          if (s->chunk_header.chunk_type == CHUNK_TYPE_RAW) {
+            ret = s->write(s->priv, data, n);
+            if (ret < 0) {
+              return ret;
+            }
+          } else {
+            /* Fill value or crc32, in little endian order. */
+            size_t offset = sizeof(s->value) - s->data_remaining;
+            memcpy(reinterpret_cast<uint8_t*>(&s->value) + offset, data, n);
+          }
+          data += n;
+          len -= n;
+          s->data_remaining -= n;
+          break;
+        }
+        case STREAM_DONE:
+        case STREAM_ERROR:
+          /* Trailing data after the last chunk. */
+          return -EINVAL;
+      }
+    }
+
+    /* A chunk ends once the rest of its header and all its data are received. */
+    if (s->state == STREAM_CHUNK_DATA && !s->data_remaining && !s->hdr_skip) {
+      ret = end_chunk(s);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int sparse_stream_write(struct sparse_stream* s, const void* data, size_t len) {
+  if (s->state == STREAM_ERROR) {
+    return -EINVAL;
+  }
+  int ret = stream_write(s, static_cast<const uint8_t*>(data), len);
+  if (ret < 0) {
+    s->state = STREAM_ERROR;
+  }
+  return ret;
+}
+
+int sparse_stream_finish(struct sparse_stream* s) {
+  if (s->state != STREAM_DONE || s->hdr_skip ||
+      s->cur_block != s->sparse_header.total_blks) {
+    return -EINVAL;
+  }
+  return 0;
+}
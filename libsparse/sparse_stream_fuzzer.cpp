@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <fuzzer/FuzzedDataProvider.h>
+
+#include "include/sparse/sparse.h"
+
+/* Stop expanding fill and "don't care" chunks past this many bytes. */
+static constexpr uint64_t kMaxOutput = 64 * 1024 * 1024;
+
+static volatile int count;
+
+static int WriteCallback(void* priv, const void* data, size_t len) {
+  uint64_t* written = static_cast<uint64_t*>(priv);
+  *written += len;
+  if (*written > kMaxOutput) {
+    return -1;
+  }
+  if (!data || len == 0) {
+    return 0;
+  }
+
+  const char* p = (const char*)data;
+  // Just to make sure the data is accessible
+  // We only check the head and tail to save time
+  count += *p;
+  count += *(p + len - 1);
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  FuzzedDataProvider provider(data, size);
+  uint64_t written = 0;
+  struct sparse_stream* s = sparse_stream_new(WriteCallback, &written);
+  if (!s) {
+    return 0;
+  }
+
+  // Feed the image in pieces of fuzzed sizes, to split headers and chunk
+  // data at arbitrary points.
+  while (provider.remaining_bytes()) {
+    size_t len = provider.ConsumeIntegralInRange<size_t>(1, 4096);
+    std::vector<uint8_t> piece = provider.ConsumeBytes<uint8_t>(len);
+    if (sparse_stream_write(s, piece.data(), piece.size()) < 0) {
+      break;
+    }
+  }
+  sparse_stream_finish(s);
+  sparse_stream_destroy(s);
+  return 0;
+}
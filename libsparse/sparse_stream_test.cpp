@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <sparse/sparse.h>
+
+#include "sparse_format.h"
+
+static constexpr uint32_t kBlockSize = 64;
+
+/* Builds a sparse image by hand, along with the data it expands to. */
+class SparseImage {
+ public:
+  explicit SparseImage(uint16_t file_hdr_sz = sizeof(sparse_header_t),
+                       uint16_t chunk_hdr_sz = sizeof(chunk_header_t))
+      : file_hdr_sz_(file_hdr_sz), chunk_hdr_sz_(chunk_hdr_sz) {}
+
+  void Raw(uint32_t blocks) {
+    std::vector<uint8_t> data(blocks * kBlockSize);
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<uint8_t>(i * 7 + total_chunks_);
+    }
+    AddChunk(CHUNK_TYPE_RAW, blocks, data.data(), data.size());
+    expanded_.insert(expanded_.end(), data.begin(), data.end());
+  }
+
+  void Fill(uint32_t blocks, uint32_t value) {
+    AddChunk(CHUNK_TYPE_FILL, blocks, &value, sizeof(value));
+    for (size_t i = 0; i < blocks * kBlockSize / sizeof(value); i++) {
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+      expanded_.insert(expanded_.end(), bytes, bytes + sizeof(value));
+    }
+  }
+
+  void DontCare(uint32_t blocks) {
+    AddChunk(CHUNK_TYPE_DONT_CARE, blocks, nullptr, 0);
+    expanded_.resize(expanded_.size() + blocks * kBlockSize);
+  }
+
+  void Crc32(uint32_t crc) { AddChunk(CHUNK_TYPE_CRC32, 0, &crc, sizeof(crc)); }
+
+  std::vector<uint8_t> Build() const {
+    sparse_header_t header = {};
+    header.magic = SPARSE_HEADER_MAGIC;
+    header.major_version = 1;
+    header.file_hdr_sz = file_hdr_sz_;
+    header.chunk_hdr_sz = chunk_hdr_sz_;
+    header.blk_sz = kBlockSize;
+    header.total_blks = total_blks_;
+    header.total_chunks = total_chunks_;
+
+    std::vector<uint8_t> image(file_hdr_sz_, 0xee);
+    memcpy(image.data(), &header, std::min<size_t>(sizeof(header), file_hdr_sz_));
+    image.insert(image.end(), chunks_.begin(), chunks_.end());
+    return image;
+  }
+
+  const std::vector<uint8_t>& expanded() const { return expanded_; }
+
+ private:
+  void AddChunk(uint16_t type, uint32_t blocks, const void* data, size_t len) {
+    chunk_header_t chunk = {};
+    chunk.chunk_type = type;
+    chunk.chunk_sz = blocks;
+    chunk.total_sz = chunk_hdr_sz_ + len;
+
+    size_t offset = chunks_.size();
+    chunks_.resize(offset + chunk_hdr_sz_, 0xee);
+    memcpy(chunks_.data() + offset, &chunk, std::min<size_t>(sizeof(chunk), chunk_hdr_sz_));
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    chunks_.insert(chunks_.end(), bytes, bytes + len);
+
+    total_blks_ += blocks;
+    total_chunks_++;
+  }
+
+  uint16_t file_hdr_sz_;
+  uint16_t chunk_hdr_sz_;
+  uint32_t total_blks_ = 0;
+  uint32_t total_chunks_ = 0;
+  std::vector<uint8_t> chunks_;
+  std::vector<uint8_t> expanded_;
+};
+
+static int AppendOutput(void* priv, const void* data, size_t len) {
+  auto output = static_cast<std::vector<uint8_t>*>(priv);
+  if (data) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    output->insert(output->end(), bytes, bytes + len);
+  } else {
+    output->resize(output->size() + len);
+  }
+  return 0;
+}
+
+class SparseStreamTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    stream_.reset(sparse_stream_new(AppendOutput, &output_));
+    ASSERT_NE(stream_, nullptr);
+  }
+
+  /* Writes the image in pieces of at most piece_size bytes. */
+  int WriteInPieces(const std::vector<uint8_t>& image, size_t piece_size) {
+    for (size_t offset = 0; offset < image.size(); offset += piece_size) {
+      size_t len = std::min(piece_size, image.size() - offset);
+      int ret = sparse_stream_write(stream_.get(), image.data() + offset, len);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+
+  std::unique_ptr<sparse_stream, decltype(&sparse_stream_destroy)> stream_{nullptr,
+                                                                           sparse_stream_destroy};
+  std::vector<uint8_t> output_;
+};
+
+static SparseImage AllChunkTypes(uint16_t file_hdr_sz = sizeof(sparse_header_t),
+                                 uint16_t chunk_hdr_sz = sizeof(chunk_header_t)) {
+  SparseImage image(file_hdr_sz, chunk_hdr_sz);
+  image.Raw(3);
+  image.Fill(2, 0x12345678);
+  image.DontCare(4);
+  image.Raw(1);
+  image.Crc32(0xdeadbeef);
+  image.Fill(1, 0xcafef00d);
+  return image;
+}
+
+TEST_F(SparseStreamTest, WholeImage) {
+  SparseImage image = AllChunkTypes();
+  std::vector<uint8_t> bytes = image.Build();
+  ASSERT_EQ(0, sparse_stream_write(stream_.get(), bytes.data(), bytes.size()));
+  ASSERT_EQ(0, sparse_stream_finish(stream_.get()));
+  EXPECT_EQ(image.expanded(), output_);
+}
+
+TEST_F(SparseStreamTest, ByteByByte) {
+  SparseImage image = AllChunkTypes();
+  ASSERT_EQ(0, WriteInPieces(image.Build(), 1));
+  ASSERT_EQ(0, sparse_stream_finish(stream_.get()));
+  EXPECT_EQ(image.expanded(), output_);
+}
+
+TEST(SparseStreamSplitTest, OddPieceSizes) {
+  SparseImage image = AllChunkTypes();
+  std::vector<uint8_t> bytes = image.Build();
+  for (size_t piece_size : {3, 5, 7, 11, 13, 27, 29, 63, 65, 4097}) {
+    SCOPED_TRACE(piece_size);
+    std::vector<uint8_t> output;
+    std::unique_ptr<sparse_stream, decltype(&sparse_stream_destroy)> stream(
+        sparse_stream_new(AppendOutput, &output), sparse_stream_destroy);
+    for (size_t offset = 0; offset < bytes.size(); offset += piece_size) {
+      size_t len = std::min(piece_size, bytes.size() - offset);
+      ASSERT_EQ(0, sparse_stream_write(stream.get(), bytes.data() + offset, len));
+    }
+    ASSERT_EQ(0, sparse_stream_finish(stream.get()));
+    EXPECT_EQ(image.expanded(), output);
+  }
+}
+
+TEST(SparseStreamSplitTest, EverySplitPoint) {
+  SparseImage image = AllChunkTypes();
+  std::vector<uint8_t> bytes = image.Build();
+  for (size_t split = 0; split <= bytes.size(); split++) {
+    SCOPED_TRACE(split);
+    std::vector<uint8_t> output;
+    std::unique_ptr<sparse_stream, decltype(&sparse_stream_destroy)> stream(
+        sparse_stream_new(AppendOutput, &output), sparse_stream_destroy);
+    ASSERT_EQ(0, sparse_stream_write(stream.get(), bytes.data(), split));
+    ASSERT_EQ(0, sparse_stream_write(stream.get(), bytes.data() + split, bytes.size() - split));
+    ASSERT_EQ(0, sparse_stream_finish(stream.get()));
+    EXPECT_EQ(image.expanded(), output);
+  }
+}
+
+TEST(SparseStreamSplitTest, Truncated) {
+  // Every prefix ends within the file header, a chunk header or chunk data.
+  std::vector<uint8_t> bytes = AllChunkTypes().Build();
+  for (size_t len = 0; len < bytes.size(); len++) {
+    SCOPED_TRACE(len);
+    std::vector<uint8_t> output;
+    std::unique_ptr<sparse_stream, decltype(&sparse_stream_destroy)> stream(
+        sparse_stream_new(AppendOutput, &output), sparse_stream_destroy);
+    ASSERT_EQ(0, sparse_stream_write(stream.get(), bytes.data(), len));
+    EXPECT_EQ(-EINVAL, sparse_stream_finish(stream.get()));
+  }
+}
+
+TEST_F(SparseStreamTest, OversizedHeaders) {
+  // Longer headers than this version knows about are skipped.
+  SparseImage image = AllChunkTypes(sizeof(sparse_header_t) + 20, sizeof(chunk_header_t) + 9);
+  ASSERT_EQ(0, WriteInPieces(image.Build(), 5));
+  ASSERT_EQ(0, sparse_stream_finish(stream_.get()));
+  EXPECT_EQ(image.expanded(), output_);
+}
+
+TEST_F(SparseStreamTest, OversizedFileHeaderOnly) {
+  // The extra bytes of the file header are still expected without any chunk.
+  std::vector<uint8_t> bytes = SparseImage(UINT16_MAX).Build();
+  ASSERT_EQ(0, sparse_stream_write(stream_.get(), bytes.data(), bytes.size() - 1));
+  EXPECT_EQ(-EINVAL, sparse_stream_finish(stream_.get()));
+  ASSERT_EQ(0, sparse_stream_write(stream_.get(), bytes.data() + bytes.size() - 1, 1));
+  EXPECT_EQ(0, sparse_stream_finish(stream_.get()));
+  EXPECT_TRUE(output_.empty());
+}
+
+TEST_F(SparseStreamTest, FileHeaderTooShort) {
+  std::vector<uint8_t> bytes = SparseImage(sizeof(sparse_header_t) - 1).Build();
+  // Also pad it to a full header, which the parser reads first.
+  bytes.resize(sizeof(sparse_header_t));
+  EXPECT_EQ(-EINVAL, sparse_stream_write(stream_.get(), bytes.data(), bytes.size()));
+}
+
+TEST_F(SparseStreamTest, ChunkHeaderTooShort) {
+  SparseImage image(sizeof(sparse_header_t), sizeof(chunk_header_t) - 1);
+  image.DontCare(1);
+  std::vector<uint8_t> bytes = image.Build();
+  bytes.resize(sizeof(sparse_header_t) + sizeof(chunk_header_t));
+  EXPECT_EQ(-EINVAL, sparse_stream_write(stream_.get(), bytes.data(), bytes.size()));
+}
+
+TEST_F(SparseStreamTest, ChunkSizeMismatch) {
+  SparseImage image;
+  image.Raw(2);
+  std::vector<uint8_t> bytes = image.Build();
+  // Claim one more block than the chunk carries.
+  chunk_header_t chunk;
+  memcpy(&chunk, bytes.data() + sizeof(sparse_header_t), sizeof(chunk));
+  chunk.chunk_sz++;
+  memcpy(bytes.data() + sizeof(sparse_header_t), &chunk, sizeof(chunk));
+  EXPECT_EQ(-EINVAL, sparse_stream_write(stream_.get(), bytes.data(), bytes.size()));
+}
+
+TEST_F(SparseStreamTest, TrailingData) {
+  SparseImage image = AllChunkTypes();
+  std::vector<uint8_t> bytes = image.Build();
+  bytes.push_back(0);
+  EXPECT_EQ(-EINVAL, sparse_stream_write(stream_.get(), bytes.data(), bytes.size()));
+  // The stream cannot be used after an error.
+  EXPECT_EQ(-EINVAL, sparse_stream_write(stream_.get(), bytes.data(), 0));
+  EXPECT_EQ(-EINVAL, sparse_stream_finish(stream_.get()));
+}
+
+TEST_F(SparseStreamTest, TrailingDataInNextWrite) {
+  std::vector<uint8_t> bytes = AllChunkTypes().Build();
+  ASSERT_EQ(0, sparse_stream_write(stream_.get(), bytes.data(), bytes.size()));
+  ASSERT_EQ(0, sparse_stream_finish(stream_.get()));
+  uint8_t extra = 0;
+  EXPECT_EQ(-EINVAL, sparse_stream_write(stream_.get(), &extra, 1));
+  EXPECT_EQ(-EINVAL, sparse_stream_finish(stream_.get()));
+}
+
+static int FailingWrite(void*, const void*, size_t) {
+  return -ENOSPC;
+}
+
+TEST(SparseStreamCallbackTest, CallbackError) {
+  std::vector<uint8_t> bytes = AllChunkTypes().Build();
+  std::unique_ptr<sparse_stream, decltype(&sparse_stream_destroy)> stream(
+      sparse_stream_new(FailingWrite, nullptr), sparse_stream_destroy);
+  EXPECT_EQ(-ENOSPC, sparse_stream_write(stream.get(), bytes.data(), bytes.size()));
+  EXPECT_EQ(-EINVAL, sparse_stream_finish(stream.get()));
+}
+
+TEST_F(SparseStreamTest, MatchesSparseFile) {
+  // An image written by libsparse itself, with a crc32 chunk.
+  std::vector<uint8_t> data(10 * 4096);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint8_t>(i * 13);
+  }
+  std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)> file(
+      sparse_file_new(4096, 64 * 4096), sparse_file_destroy);
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(0, sparse_file_add_data(file.get(), data.data(), data.size(), 2));
+  ASSERT_EQ(0, sparse_file_add_fill(file.get(), 0x55aa55aa, 3 * 4096, 20));
+
+  std::vector<uint8_t> sparse_image;
+  ASSERT_EQ(0, sparse_file_callback(file.get(), true, true, AppendOutput, &sparse_image));
+  std::vector<uint8_t> expanded;
+  ASSERT_EQ(0, sparse_file_callback(file.get(), false, false, AppendOutput, &expanded));
+
+  ASSERT_EQ(0, WriteInPieces(sparse_image, 1000));
+  ASSERT_EQ(0, sparse_stream_finish(stream_.get()));
+  EXPECT_EQ(expanded, output_);
+}
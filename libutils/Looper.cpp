@@ -20,13 +20,18 @@
 #include <utils/Looper.h>
 
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
 #include <cinttypes>
+#include <unordered_map>
+#include <vector>
 
 namespace android {
 
 namespace {
 
 constexpr uint64_t WAKE_EVENT_FD_SEQ = 1;
+constexpr uint64_t TIMER_FD_SEQ = 2;
 
 epoll_event createEpollEvent(uint32_t events, uint64_t seq) {
     return {.events = events, .data = {.u64 = seq}};
@@ -65,6 +70,219 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 }
 
 
+// --- Looper::State ---
+
+class Looper::State : public MessageHandler {
+  public:
+    State(const Looper* owner, bool preciseTimers);
+
+    // Never called, the envelope which holds the State is not a message.
+    void handleMessage(const Message&) override {}
+
+    // The uptime of the envelope which holds the State, at position 0 of the envelopes.
+    // Only stateLocked() casts its handler back to a State, after checking both this
+    // and mOwner.
+    static constexpr nsecs_t ENVELOPE_UPTIME = LLONG_MIN;
+    const Looper* const mOwner;
+
+    // Adds a message to the heap, and returns its position.  Only removable messages
+    // can be found by remove().
+    size_t push(Vector<MessageEnvelope>& envelopes, nsecs_t uptime,
+                const sp<MessageHandler>& handler, const Message& message, MessageToken token,
+                bool removable);
+    bool remove(Vector<MessageEnvelope>& envelopes, MessageToken token);
+    void removeAt(Vector<MessageEnvelope>& envelopes, size_t index);
+    template <typename Predicate>
+    void removeIf(Vector<MessageEnvelope>& envelopes, Predicate predicate);
+
+    void armTimerFd(nsecs_t uptime);
+
+    // Returns the request with the given sequence number, or nullptr if it was removed
+    // or replaced.
+    Request* findRequest(SequenceNumber seq) {
+        const uint32_t slot = static_cast<uint32_t>(seq);
+        if (slot >= mRequestSlots.size() || mRequestSlots[slot].seq != seq) {
+            return nullptr;
+        }
+        return &mRequestSlots[slot].request;
+    }
+
+    // A registered request, or a free slot when seq is 0.
+    struct RequestSlot {
+        SequenceNumber seq;
+        Request request;
+    };
+
+    MessageToken mNextMessageToken;
+    android::base::unique_fd mTimerFd;  // only opened for precise timers
+    nsecs_t mTimerFdUptime;  // set to LLONG_MAX when the timerfd is disarmed
+    std::vector<RequestSlot> mRequestSlots;
+    std::vector<uint32_t> mFreeRequestSlots;
+
+  private:
+    static constexpr MessageToken REMOVABLE_TOKEN = 1ull << 63;
+
+    // Messages are sent in order of uptime, then in the order they were enqueued.
+    bool isBefore(const MessageEnvelope* heap, size_t a, size_t b) const {
+        return heap[a].uptime < heap[b].uptime ||
+                (heap[a].uptime == heap[b].uptime &&
+                 (mTokens[a] & ~REMOVABLE_TOKEN) < (mTokens[b] & ~REMOVABLE_TOKEN));
+    }
+
+    void updateIndex(size_t index);
+    void swap(MessageEnvelope* heap, size_t a, size_t b);
+    size_t siftUp(MessageEnvelope* heap, size_t index);
+    void siftDown(MessageEnvelope* heap, size_t count, size_t index);
+
+    // The token of the message at each position of the heap, marked with REMOVABLE_TOKEN
+    // for those whose position is kept in mIndexByToken.  Other messages never pay for
+    // the index.
+    std::vector<MessageToken> mTokens;
+    std::unordered_map<MessageToken, size_t> mIndexByToken;
+};
+
+Looper::State::State(const Looper* owner, bool preciseTimers)
+    : mOwner(owner), mNextMessageToken(1), mTimerFdUptime(LLONG_MAX), mTokens(1) {
+    if (preciseTimers) {
+        mTimerFd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+        LOG_ALWAYS_FATAL_IF(mTimerFd.get() < 0, "Could not make timer fd: %s", strerror(errno));
+    }
+}
+
+size_t Looper::State::push(Vector<MessageEnvelope>& envelopes, nsecs_t uptime,
+                           const sp<MessageHandler>& handler, const Message& message,
+                           MessageToken token, bool removable) {
+    const size_t index = envelopes.add();
+    MessageEnvelope* heap = envelopes.editArray();
+    heap[index].uptime = uptime;
+    heap[index].handler = handler;
+    heap[index].message = message;
+    mTokens.push_back(removable ? token | REMOVABLE_TOKEN : token);
+    updateIndex(index);
+    return siftUp(heap, index);
+}
+
+bool Looper::State::remove(Vector<MessageEnvelope>& envelopes, MessageToken token) {
+    const auto& it = mIndexByToken.find(token);
+    if (it == mIndexByToken.end()) {
+        return false;
+    }
+    removeAt(envelopes, it->second);
+    return true;
+}
+
+void Looper::State::removeAt(Vector<MessageEnvelope>& envelopes, size_t index) {
+    // Position 0 holds the State itself and must never be removed or overwritten.
+    LOG_ALWAYS_FATAL_IF(index == 0 || index >= envelopes.size(),
+                        "Removing message %zu of a heap of %zu", index, envelopes.size());
+    if (mTokens[index] & REMOVABLE_TOKEN) {
+        mIndexByToken.erase(mTokens[index] & ~REMOVABLE_TOKEN);
+    }
+
+    // Fill the hole with the last message, which may belong above or below it.
+    const size_t last = envelopes.size() - 1;
+    if (index != last) {
+        MessageEnvelope* heap = envelopes.editArray();
+        heap[index] = std::move(heap[last]);
+        mTokens[index] = mTokens[last];
+        updateIndex(index);
+    }
+    envelopes.removeAt(last);
+    mTokens.pop_back();
+    if (index != last) {
+        MessageEnvelope* heap = envelopes.editArray();
+        if (siftUp(heap, index) == index) {
+            siftDown(heap, last, index);
+        }
+    }
+}
+
+template <typename Predicate>
+void Looper::State::removeIf(Vector<MessageEnvelope>& envelopes, Predicate predicate) {
+    const size_t count = envelopes.size();
+    MessageEnvelope* heap = envelopes.editArray();
+    // Skip position 0, which holds the State.
+    size_t kept = 1;
+    for (size_t i = 1; i < count; i++) {
+        if (predicate(heap[i])) {
+            if (mTokens[i] & REMOVABLE_TOKEN) {
+                mIndexByToken.erase(mTokens[i] & ~REMOVABLE_TOKEN);
+            }
+            continue;
+        }
+        if (kept != i) {
+            heap[kept] = std::move(heap[i]);
+            mTokens[kept] = mTokens[i];
+            updateIndex(kept);
+        }
+        kept++;
+    }
+    if (kept == count) {
+        return;
+    }
+    envelopes.removeItemsAt(kept, count - kept);
+    mTokens.resize(kept);
+
+    // Removing several messages at once is rare enough to rebuild the heap in O(n).
+    heap = envelopes.editArray();
+    for (size_t i = (kept - 1) / 2; i > 0; i--) {
+        siftDown(heap, kept, i);
+    }
+}
+
+void Looper::State::armTimerFd(nsecs_t uptime) {
+    // A zero expiration disarms the timer, so uptimes up to 0 are clamped to 1ns.
+    itimerspec spec = {};
+    if (uptime != LLONG_MAX) {
+        uptime = std::max<nsecs_t>(uptime, 1);
+        spec.it_value.tv_sec = uptime / 1000000000;
+        spec.it_value.tv_nsec = uptime % 1000000000;
+    }
+    int result = timerfd_settime(mTimerFd.get(), TFD_TIMER_ABSTIME, &spec, nullptr);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not arm timer fd: %s", strerror(errno));
+    mTimerFdUptime = uptime;
+}
+
+void Looper::State::updateIndex(size_t index) {
+    if (mTokens[index] & REMOVABLE_TOKEN) {
+        mIndexByToken[mTokens[index] & ~REMOVABLE_TOKEN] = index;
+    }
+}
+
+void Looper::State::swap(MessageEnvelope* heap, size_t a, size_t b) {
+    std::swap(heap[a], heap[b]);
+    std::swap(mTokens[a], mTokens[b]);
+    updateIndex(a);
+    updateIndex(b);
+}
+
+// The heap starts at position 1, below the envelope of the State.
+size_t Looper::State::siftUp(MessageEnvelope* heap, size_t index) {
+    while (index > 1 && isBefore(heap, index, index / 2)) {
+        swap(heap, index, index / 2);
+        index /= 2;
+    }
+    return index;
+}
+
+void Looper::State::siftDown(MessageEnvelope* heap, size_t count, size_t index) {
+    for (;;) {
+        size_t child = index * 2;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && isBefore(heap, child + 1, child)) {
+            child += 1;
+        }
+        if (!isBefore(heap, child, index)) {
+            break;
+        }
+        swap(heap, index, child);
+        index = child;
+    }
+}
+
+
 // --- Looper ---
 
 // Maximum number of file descriptors for which to retrieve poll events each iteration.
@@ -73,18 +291,23 @@ static const int EPOLL_MAX_EVENTS = 16;
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
-Looper::Looper(bool allowNonCallbacks)
+Looper::Looper(bool allowNonCallbacks) : Looper(allowNonCallbacks, false) {}
+
+Looper::Looper(bool allowNonCallbacks, bool preciseTimers)
     : mAllowNonCallbacks(allowNonCallbacks),
       mSendingMessage(false),
       mPolling(false),
       mEpollRebuildRequired(false),
-      mNextRequestSeq(WAKE_EVENT_FD_SEQ + 1),
+      mNextRequestSeq(1),
       mResponseIndex(0),
       mNextMessageUptime(LLONG_MAX) {
     mWakeEventFd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
     LOG_ALWAYS_FATAL_IF(mWakeEventFd.get() < 0, "Could not make wake event fd: %s", strerror(errno));
 
     AutoMutex _l(mLock);
+    // The State is only reached through stateLocked(), which checks this envelope.
+    mMessageEnvelopes.push(MessageEnvelope(State::ENVELOPE_UPTIME,
+                                           sp<State>::make(this, preciseTimers), Message()));
     rebuildEpollLocked();
 }
 
@@ -127,9 +350,10 @@ sp<Looper> Looper::getForThread() {
 
 sp<Looper> Looper::prepare(int opts) {
     bool allowNonCallbacks = opts & PREPARE_ALLOW_NON_CALLBACKS;
+    bool preciseTimers = opts & PREPARE_PRECISE_TIMERS;
     sp<Looper> looper = Looper::getForThread();
     if (looper == nullptr) {
-        looper = sp<Looper>::make(allowNonCallbacks);
+        looper = sp<Looper>::make(allowNonCallbacks, preciseTimers);
         Looper::setForThread(looper);
     }
     if (looper->getAllowNonCallbacks() != allowNonCallbacks) {
@@ -143,6 +367,19 @@ bool Looper::getAllowNonCallbacks() const {
     return mAllowNonCallbacks;
 }
 
+// The State is the handler of the first envelope.  Nothing else may ever be cast to
+// a State: a heap which moved a message to position 0 is corrupted, so abort.
+Looper::State& Looper::stateLocked() {
+    LOG_ALWAYS_FATAL_IF(mMessageEnvelopes.isEmpty(), "Looper %p has no State", this);
+    const MessageEnvelope& envelope = mMessageEnvelopes.itemAt(0);
+    LOG_ALWAYS_FATAL_IF(envelope.uptime != State::ENVELOPE_UPTIME || envelope.handler == nullptr,
+                        "Looper %p: message envelope 0 does not hold the State", this);
+    State* state = static_cast<State*>(envelope.handler.get());
+    LOG_ALWAYS_FATAL_IF(state->mOwner != this, "Looper %p: State belongs to Looper %p", this,
+                        state->mOwner);
+    return *state;
+}
+
 void Looper::rebuildEpollLocked() {
     // Close old epoll instance if we have one.
     if (mEpollFd >= 0) {
@@ -161,7 +398,16 @@ void Looper::rebuildEpollLocked() {
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance: %s",
                         strerror(errno));
 
-    for (const auto& [seq, request] : mRequests) {
+    const State& state = stateLocked();
+    if (state.mTimerFd >= 0) {
+        epoll_event timerEvent = createEpollEvent(EPOLLIN, TIMER_FD_SEQ);
+        result = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, state.mTimerFd.get(), &timerEvent);
+        LOG_ALWAYS_FATAL_IF(result != 0, "Could not add timer fd to epoll instance: %s",
+                            strerror(errno));
+    }
+
+    for (const auto& [seq, request] : state.mRequestSlots) {
+        if (seq == 0) continue;
         epoll_event eventItem = createEpollEvent(request.getEpollEvents(), seq);
 
         int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, request.fd, &eventItem);
@@ -223,7 +469,8 @@ int Looper::pollInner(int timeoutMillis) {
     ALOGD("%p ~ pollOnce - waiting: timeoutMillis=%d", this, timeoutMillis);
 #endif
 
-    // Adjust the timeout based on when the next message is due.
+    // Adjust the timeout based on when the next message is due.  With precise timers,
+    // the timerfd wakes the poll before this timeout, which is rounded up.
     if (timeoutMillis != 0 && mNextMessageUptime != LLONG_MAX) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
         int messageTimeoutMillis = toMillisecondTimeoutDelay(now, mNextMessageUptime);
@@ -286,6 +533,7 @@ int Looper::pollInner(int timeoutMillis) {
 #endif
 
     for (int i = 0; i < eventCount; i++) {
+        State& state = stateLocked();
         const SequenceNumber seq = eventItems[i].data.u64;
         uint32_t epollEvents = eventItems[i].events;
         if (seq == WAKE_EVENT_FD_SEQ) {
@@ -294,16 +542,26 @@ int Looper::pollInner(int timeoutMillis) {
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
+        } else if (seq == TIMER_FD_SEQ) {
+            // The timer is one-shot, so it is disarmed once it expired.  The messages
+            // that are now due are sent below.
+            uint64_t expirations;
+            TEMP_FAILURE_RETRY(read(state.mTimerFd.get(), &expirations, sizeof(uint64_t)));
+            state.mTimerFdUptime = LLONG_MAX;
         } else {
-            const auto& request_it = mRequests.find(seq);
-            if (request_it != mRequests.end()) {
-                const auto& request = request_it->second;
+            const Request* request = state.findRequest(seq);
+            if (request != nullptr) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
-                mResponses.push({.seq = seq, .events = events, .request = request});
+                // The response holds the only extra reference to the callback, which
+                // keeps it alive if the fd is removed while the callback runs.
+                Response& response = mResponses.editItemAt(mResponses.add());
+                response.seq = seq;
+                response.events = events;
+                response.request = *request;
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x for sequence number %" PRIu64
                       " that is no longer registered.",
@@ -314,19 +572,21 @@ int Looper::pollInner(int timeoutMillis) {
 Done: ;
 
     // Invoke pending message callbacks.
+    State& state = stateLocked();
     mNextMessageUptime = LLONG_MAX;
-    while (mMessageEnvelopes.size() != 0) {
+    // Envelope 0 holds the State, the earliest message is at position 1.
+    while (mMessageEnvelopes.size() > 1) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
+        MessageEnvelope& messageEnvelope = mMessageEnvelopes.editItemAt(1);
         if (messageEnvelope.uptime <= now) {
-            // Remove the envelope from the list.
+            // Remove the envelope from the heap.
             // We keep a strong reference to the handler until the call to handleMessage
             // finishes.  Then we drop it so that the handler can be deleted *before*
             // we reacquire our lock.
             { // obtain handler
-                sp<MessageHandler> handler = messageEnvelope.handler;
+                sp<MessageHandler> handler = std::move(messageEnvelope.handler);
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                state.removeAt(mMessageEnvelopes, 1);
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -347,6 +607,14 @@ Done: ;
         }
     }
 
+    // Let the timerfd wake the poll exactly when the next message is due.
+    if (state.mTimerFd >= 0 && state.mTimerFdUptime != mNextMessageUptime) {
+#if DEBUG_POLL_AND_WAKE
+        ALOGD("%p ~ pollOnce - arming timer fd: uptime=%" PRId64, this, mNextMessageUptime);
+#endif
+        state.armTimerFd(mNextMessageUptime);
+    }
+
     // Release lock.
     mLock.unlock();
 
@@ -459,9 +727,20 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
 
     { // acquire lock
         AutoMutex _l(mLock);
-        // There is a sequence number reserved for the WakeEventFd.
-        if (mNextRequestSeq == WAKE_EVENT_FD_SEQ) mNextRequestSeq++;
-        const SequenceNumber seq = mNextRequestSeq++;
+        State& state = stateLocked();
+        // A replaced request keeps its slot, with a new generation.
+        auto seq_it = mSequenceNumberByFd.find(fd);
+        uint32_t slot;
+        if (seq_it != mSequenceNumberByFd.end()) {
+            slot = static_cast<uint32_t>(seq_it->second);
+        } else if (!state.mFreeRequestSlots.empty()) {
+            slot = state.mFreeRequestSlots.back();
+        } else {
+            slot = state.mRequestSlots.size();
+        }
+        // Generation 0 is reserved for the WakeEventFd and the TimerFd.
+        if (static_cast<uint32_t>(mNextRequestSeq) == 0) mNextRequestSeq++;
+        const SequenceNumber seq = (mNextRequestSeq++ << 32) | slot;
 
         Request request;
         request.fd = fd;
@@ -471,14 +750,18 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         request.data = data;
 
         epoll_event eventItem = createEpollEvent(request.getEpollEvents(), seq);
-        auto seq_it = mSequenceNumberByFd.find(fd);
         if (seq_it == mSequenceNumberByFd.end()) {
             int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, fd, &eventItem);
             if (epollResult < 0) {
                 ALOGE("Error adding epoll events for fd %d: %s", fd, strerror(errno));
                 return -1;
             }
-            mRequests.emplace(seq, request);
+            if (slot == state.mRequestSlots.size()) {
+                state.mRequestSlots.push_back({.seq = seq, .request = std::move(request)});
+            } else {
+                state.mFreeRequestSlots.pop_back();
+                state.mRequestSlots[slot] = {.seq = seq, .request = std::move(request)};
+            }
             mSequenceNumberByFd.emplace(fd, seq);
         } else {
             int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_MOD, fd, &eventItem);
@@ -514,9 +797,7 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     return -1;
                 }
             }
-            const SequenceNumber oldSeq = seq_it->second;
-            mRequests.erase(oldSeq);
-            mRequests.emplace(seq, request);
+            state.mRequestSlots[slot] = {.seq = seq, .request = std::move(request)};
             seq_it->second = seq;
         }
     } // release lock
@@ -539,18 +820,18 @@ int Looper::repoll(int fd) {
         return 0;
     }
 
-    const auto& request_it = mRequests.find(it->second);
-    if (request_it == mRequests.end()) {
+    const SequenceNumber seq = it->second;
+    const Request* request = stateLocked().findRequest(seq);
+    if (request == nullptr) {
         return 0;
     }
-    const auto& [seq, request] = *request_it;
 
     LOG_ALWAYS_FATAL_IF(
-            fd != request.fd,
+            fd != request->fd,
             "Looper has inconsistent data structure. When looking up FD %d found FD %d.", fd,
-            request_it->second.fd);
+            request->fd);
 
-    epoll_event eventItem = createEpollEvent(request.getEpollEvents(), seq);
+    epoll_event eventItem = createEpollEvent(request->getEpollEvents(), seq);
     if (epoll_ctl(mEpollFd.get(), EPOLL_CTL_MOD, fd, &eventItem) == -1) return 0;
 
     return 1;  // success
@@ -561,15 +842,18 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
     ALOGD("%p ~ removeFd - seq=%" PRIu64, this, seq);
 #endif
 
-    const auto& request_it = mRequests.find(seq);
-    if (request_it == mRequests.end()) {
+    State& state = stateLocked();
+    Request* request = state.findRequest(seq);
+    if (request == nullptr) {
         return 0;
     }
-    const int fd = request_it->second.fd;
+    const int fd = request->fd;
 
-    // Always remove the FD from the request map even if an error occurs while
+    // Always remove the FD from the request table even if an error occurs while
     // updating the epoll set so that we avoid accidentally leaking callbacks.
-    mRequests.erase(request_it);
+    const uint32_t slot = static_cast<uint32_t>(seq);
+    state.mRequestSlots[slot] = {};
+    state.mFreeRequestSlots.push_back(slot);
     mSequenceNumberByFd.erase(fd);
 
     int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, fd, nullptr);
@@ -617,36 +901,56 @@ void Looper::sendMessageDelayed(nsecs_t uptimeDelay, const sp<MessageHandler>& h
 
 void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
         const Message& message) {
+    enqueueMessage(uptime, handler, message, false);
+}
+
+Looper::MessageToken Looper::enqueueMessageAtTime(nsecs_t uptime,
+        const sp<MessageHandler>& handler, const Message& message) {
+    return enqueueMessage(uptime, handler, message, true);
+}
+
+Looper::MessageToken Looper::enqueueMessage(nsecs_t uptime, const sp<MessageHandler>& handler,
+        const Message& message, bool removable) {
 #if DEBUG_CALLBACKS
     ALOGD("%p ~ sendMessageAtTime - uptime=%" PRId64 ", handler=%p, what=%d",
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    MessageToken token;
+    size_t i;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        State& state = stateLocked();
+        token = state.mNextMessageToken++;
+        i = state.push(mMessageEnvelopes, uptime, handler, message, token, removable);
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
         // messages is to decide when the next wakeup time should be.  In fact, it does
         // not even matter whether this code is running on the Looper thread.
         if (mSendingMessage) {
-            return;
+            return token;
         }
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (i == 1) {
         wake();
     }
+    return token;
+}
+
+bool Looper::removeMessage(MessageToken token) {
+#if DEBUG_CALLBACKS
+    ALOGD("%p ~ removeMessage - token=%" PRIu64, this, token);
+#endif
+
+    { // acquire lock
+        AutoMutex _l(mLock);
+
+        return stateLocked().remove(mMessageEnvelopes, token);
+    } // release lock
 }
 
 void Looper::removeMessages(const sp<MessageHandler>& handler) {
@@ -657,12 +961,10 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        stateLocked().removeIf(mMessageEnvelopes,
+                [&handler](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler;
+        });
     } // release lock
 }
 
@@ -674,13 +976,10 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        stateLocked().removeIf(mMessageEnvelopes,
+                [&handler, what](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler && messageEnvelope.message.what == what;
+        });
     } // release lock
 }
 
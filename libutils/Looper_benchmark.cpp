@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <utils/Looper.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+namespace {
+
+class CountingMessageHandler : public MessageHandler {
+  public:
+    void handleMessage(const Message&) override { count++; }
+
+    size_t count = 0;
+};
+
+class CountingLooperCallback : public LooperCallback {
+  public:
+    int handleEvent(int, int, void*) override {
+        count++;
+        return 1;
+    }
+
+    size_t count = 0;
+};
+
+// Spreads the uptimes of consecutive messages over one second.
+nsecs_t scatteredUptime(nsecs_t base, int i) {
+    return base + us2ns((i * 7919) % 1000000);
+}
+
+}  // namespace
+
+// Enqueues range(0) delayed messages, then removes them all.
+static void BM_SendMessageDelayed(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    sp<MessageHandler> handler = sp<CountingMessageHandler>::make();
+    const int count = state.range(0);
+
+    for (auto _ : state) {
+        nsecs_t base = systemTime(SYSTEM_TIME_MONOTONIC) + s2ns(10);
+        for (int i = 0; i < count; i++) {
+            looper->sendMessageAtTime(scatteredUptime(base, i), handler, Message(i));
+        }
+        looper->removeMessages(handler);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_SendMessageDelayed)->Arg(100)->Arg(10000);
+
+// Enqueues and cancels one message while range(0) delayed messages are pending.
+static void BM_EnqueueAndRemoveMessage(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    sp<MessageHandler> handler = sp<CountingMessageHandler>::make();
+    nsecs_t base = systemTime(SYSTEM_TIME_MONOTONIC) + s2ns(10);
+    for (int i = 0; i < state.range(0); i++) {
+        looper->sendMessageAtTime(scatteredUptime(base, i), handler, Message(i));
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        Looper::MessageToken token =
+                looper->enqueueMessageAtTime(scatteredUptime(base, i++), handler, Message(0));
+        benchmark::DoNotOptimize(looper->removeMessage(token));
+    }
+    looper->removeMessages(handler);
+}
+BENCHMARK(BM_EnqueueAndRemoveMessage)->Arg(100)->Arg(10000);
+
+// Sends range(0) messages which are already due from a single poll.
+static void BM_PollOnceMessages(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    sp<CountingMessageHandler> handler = sp<CountingMessageHandler>::make();
+    const int count = state.range(0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        nsecs_t base = systemTime(SYSTEM_TIME_MONOTONIC) - s2ns(1);
+        for (int i = 0; i < count; i++) {
+            looper->sendMessageAtTime(scatteredUptime(base, i), handler, Message(i));
+        }
+        state.ResumeTiming();
+        looper->pollOnce(0);
+    }
+    state.SetItemsProcessed(handler->count);
+}
+BENCHMARK(BM_PollOnceMessages)->Arg(100)->Arg(10000);
+
+// Delivers a message 100us in the future, with the millisecond poll timeout (0)
+// or a timerfd (1).  The reported time includes the lateness of the wakeup.
+static void BM_SendMessageDelayedWakeup(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false, state.range(0) != 0);
+    sp<CountingMessageHandler> handler = sp<CountingMessageHandler>::make();
+
+    for (auto _ : state) {
+        size_t count = handler->count;
+        looper->sendMessageDelayed(us2ns(100), handler, Message(0));
+        while (handler->count == count) {
+            looper->pollOnce(-1);
+        }
+    }
+}
+BENCHMARK(BM_SendMessageDelayedWakeup)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// Dispatches the events of range(0) pipes which are always readable.
+static void BM_PollOnceFds(benchmark::State& state) {
+    sp<Looper> looper = sp<Looper>::make(false);
+    sp<CountingLooperCallback> callback = sp<CountingLooperCallback>::make();
+    std::vector<android::base::unique_fd> fds;
+    for (int i = 0; i < state.range(0); i++) {
+        int pipeFds[2];
+        if (pipe2(pipeFds, O_CLOEXEC) != 0 || write(pipeFds[1], "x", 1) != 1) {
+            state.SkipWithError("Could not create pipe");
+            return;
+        }
+        fds.emplace_back(pipeFds[0]);
+        fds.emplace_back(pipeFds[1]);
+        looper->addFd(pipeFds[0], 0, Looper::EVENT_INPUT, callback, nullptr);
+    }
+
+    for (auto _ : state) {
+        looper->pollOnce(0);
+    }
+    state.SetItemsProcessed(callback->count);
+}
+BENCHMARK(BM_PollOnceFds)->Arg(1)->Arg(16)->Arg(256);
+
+BENCHMARK_MAIN();
@@ -8,9 +8,12 @@
 #include <utils/Looper.h>
 #include <utils/StopWatch.h>
 #include <utils/Timers.h>
+#include <algorithm>
+#include <memory>
 #include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 #include "Looper_test_pipe.h"
 
 #include <utils/threads.h>
@@ -385,6 +388,34 @@ TEST_F(LooperTest, PollOnce_WhenNonCallbackFdIsSignalled_ReturnsIdent) {
             << "pollOnce should have returned the data";
 }
 
+TEST_F(LooperTest, PollAll_WhenManyFdsAreSignalled_InvokesEachCallbackOnce) {
+    constexpr size_t kFdCount = 300;
+    for (int round = 0; round < 2; round++) {
+        // The second round reuses the request slots freed by the first one.
+        std::vector<std::unique_ptr<Pipe>> pipes;
+        std::vector<std::unique_ptr<StubCallbackHandler>> handlers;
+        for (size_t i = 0; i < kFdCount; i++) {
+            pipes.push_back(std::make_unique<Pipe>());
+            handlers.push_back(std::make_unique<StubCallbackHandler>(0));
+            ASSERT_EQ(OK, pipes[i]->writeSignal());
+            handlers[i]->setCallback(mLooper, pipes[i]->receiveFd, Looper::EVENT_INPUT);
+        }
+
+        int result = mLooper->pollAll(0);
+
+        EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+                << "pollAll result should be Looper::POLL_TIMEOUT once all callbacks were removed";
+        for (size_t i = 0; i < kFdCount; i++) {
+            EXPECT_EQ(1, handlers[i]->callbackCount)
+                    << "callback should be invoked exactly once";
+            EXPECT_EQ(pipes[i]->receiveFd, handlers[i]->fd)
+                    << "callback should have received its own pipe fd as parameter";
+            EXPECT_EQ(0, mLooper->removeFd(pipes[i]->receiveFd))
+                    << "callback should have been removed because it returned 0";
+        }
+    }
+}
+
 TEST_F(LooperTest, AddFd_WhenCallbackAdded_ReturnsOne) {
     Pipe pipe;
     int result = mLooper->addFd(pipe.receiveFd, 0, Looper::EVENT_INPUT, nullptr, nullptr);
@@ -713,6 +744,121 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WhenManyMessagesAreEnqueued_ShouldInvokeHandlersInUptimeOrder) {
+    constexpr int kMessageCount = 10000;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    std::vector<std::pair<nsecs_t, int>> expected;
+    for (int i = 0; i < kMessageCount; i++) {
+        // Scattered uptimes in the past, with many messages sharing the same uptime.
+        nsecs_t uptime = now - ms2ns(1000) + us2ns((i * 7919) % 1000);
+        mLooper->sendMessageAtTime(uptime, handler, Message(i));
+        expected.emplace_back(uptime, i);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(kMessageCount), handler->messages.size())
+            << "handled messages";
+    for (int i = 0; i < kMessageCount; i++) {
+        ASSERT_EQ(expected[i].second, handler->messages[i].what)
+                << "messages should be handled by uptime, then in the order they were sent";
+    }
+}
+
+TEST_F(LooperTest, RemoveMessage_WhenRemovingByToken_ShouldRemoveOnlyThatMessage) {
+    constexpr int kMessageCount = 10000;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    std::vector<Looper::MessageToken> tokens;
+    for (int i = 0; i < kMessageCount; i++) {
+        nsecs_t uptime = now - ms2ns(1000) + us2ns((i * 7919) % kMessageCount);
+        tokens.push_back(mLooper->enqueueMessageAtTime(uptime, handler, Message(i)));
+    }
+    for (int i = 0; i < kMessageCount; i += 2) {
+        EXPECT_TRUE(mLooper->removeMessage(tokens[i]))
+                << "pending message should be removed";
+    }
+    EXPECT_FALSE(mLooper->removeMessage(tokens[0]))
+            << "message should not be removed twice";
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(kMessageCount / 2), handler->messages.size())
+            << "handled messages";
+    nsecs_t lastUptime = 0;
+    for (size_t i = 0; i < handler->messages.size(); i++) {
+        int what = handler->messages[i].what;
+        EXPECT_EQ(1, what % 2)
+                << "only the messages that were not removed should be handled";
+        nsecs_t uptime = us2ns((what * 7919) % kMessageCount);
+        EXPECT_LE(lastUptime, uptime)
+                << "messages should be handled by uptime";
+        lastUptime = uptime;
+    }
+    EXPECT_FALSE(mLooper->removeMessage(tokens[1]))
+            << "message should not be removed once it was sent";
+}
+
+TEST(LooperPreciseTimersTest, SendMessageDelayed_ShouldInvokeHandlerAtDelayTime) {
+    sp<Looper> looper = new Looper(true, true);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    nsecs_t uptime = systemTime(SYSTEM_TIME_MONOTONIC) + us2ns(1500);
+    looper->sendMessageAtTime(uptime, handler, Message(MSG_TEST1));
+
+    int result = looper->pollOnce(1000);
+
+    EXPECT_EQ(Looper::POLL_WAKE, result)
+            << "pollOnce result should be Looper::POLL_WAKE due to wakeup";
+    EXPECT_EQ(size_t(0), handler->messages.size())
+            << "no message handled yet";
+
+    result = looper->pollOnce(1000);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because message was sent";
+    EXPECT_EQ(size_t(1), handler->messages.size())
+            << "handled message";
+    EXPECT_LE(uptime, now)
+            << "message should not be sent before its uptime";
+    EXPECT_NEAR(0, ns2ms(now - uptime), TIMING_TOLERANCE_MS)
+            << "message should be sent around its uptime";
+
+    result = looper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT because there was nothing to do";
+}
+
+TEST(LooperPreciseTimersTest, Prepare_WhenPreciseTimersRequested_ShouldSendDelayedMessages) {
+    sp<Looper> looper = Looper::prepare(Looper::PREPARE_PRECISE_TIMERS);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    Looper::MessageToken removed = looper->enqueueMessageAtTime(
+            systemTime(SYSTEM_TIME_MONOTONIC) + us2ns(500), handler, Message(MSG_TEST1));
+    looper->sendMessageDelayed(us2ns(1000), handler, Message(MSG_TEST2));
+    EXPECT_TRUE(looper->removeMessage(removed));
+
+    StopWatch stopWatch("pollOnce");
+    for (int i = 0; i < 3 && handler->messages.size() == 0; i++) {
+        looper->pollOnce(1000);
+    }
+    int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
+    Looper::setForThread(nullptr);
+
+    EXPECT_NEAR(0, elapsedMillis, TIMING_TOLERANCE_MS)
+            << "delayed message should be sent without waiting for the poll timeout";
+    ASSERT_EQ(size_t(1), handler->messages.size())
+            << "handled message";
+    EXPECT_EQ(MSG_TEST2, handler->messages[0].what)
+            << "removed message should not be handled";
+}
+
 class LooperEventCallback : public LooperCallback {
   public:
     using Callback = std::function<int(int fd, int events)>;
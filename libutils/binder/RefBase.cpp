@@ -19,6 +19,7 @@
 
 #include <memory>
 #include <mutex>
+#include <new>
 
 #include <fcntl.h>
 #include <log/log.h>
@@ -188,14 +189,38 @@ public:
     std::atomic<int32_t>    mWeak;
     RefBase* const          mBase;
     std::atomic<int32_t>    mFlags;
+    // Whether mBase was allocated by sp<T>::makeInline(), right after this.
+    const bool              mInline;
+
+    // Deletes this, along with the storage of mBase if it was allocated
+    // with it.
+    void destroy()
+    {
+        if (mInline) {
+            void* storage = this;
+            this->~weakref_impl();
+            ::operator delete(storage);
+        } else {
+            delete this;
+        }
+    }
+
+    // Objects made by sp<T>::makeInline() start this far into their
+    // allocation, after their weakref_impl.
+    static constexpr size_t inlineSize()
+    {
+        return (sizeof(weakref_impl) + alignof(std::max_align_t) - 1) &
+                ~(alignof(std::max_align_t) - 1);
+    }
 
 #if !DEBUG_REFS
 
-    explicit weakref_impl(RefBase* base)
+    explicit weakref_impl(RefBase* base, bool isInline)
         : mStrong(INITIAL_STRONG_VALUE)
         , mWeak(0)
         , mBase(base)
         , mFlags(OBJECT_LIFETIME_STRONG)
+        , mInline(isInline)
     {
     }
 
@@ -210,11 +235,12 @@ public:
 
 #else
 
-    weakref_impl(RefBase* base)
+    weakref_impl(RefBase* base, bool isInline)
         : mStrong(INITIAL_STRONG_VALUE)
         , mWeak(0)
         , mBase(base)
         , mFlags(OBJECT_LIFETIME_STRONG)
+        , mInline(isInline)
         , mStrongRefs(NULL)
         , mWeakRefs(NULL)
         , mTrackEnabled(!!DEBUG_REFS_ENABLED_BY_DEFAULT)
@@ -445,6 +471,10 @@ private:
 #endif
 };
 
+// Set once sp<T>::makeInline() is first used, so that RefBase() can skip
+// looking for inline storage in processes which never use it.
+static std::atomic<bool> gInlineUsed(false);
+
 // ---------------------------------------------------------------------------
 
 void RefBase::incStrong(const void* id) const
@@ -499,7 +529,12 @@ void RefBase::decStrong(const void* id) const
         refs->mBase->onLastStrongRef(id);
         int32_t flags = refs->mFlags.load(std::memory_order_relaxed);
         if ((flags&OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_STRONG) {
-            delete this;
+            if (refs->mInline) {
+                // The storage is freed along with refs.
+                this->~RefBase();
+            } else {
+                delete this;
+            }
             // The destructor does not delete refs in this case.
         }
     }
@@ -600,13 +635,22 @@ void RefBase::weakref_type::decWeak(const void* id)
                     "before it had a strong reference", impl->mBase);
         } else {
             // ALOGV("Freeing refs %p of old RefBase %p\n", this, impl->mBase);
-            delete impl;
+            impl->destroy();
         }
     } else {
         // This is the OBJECT_LIFETIME_WEAK case. The last weak-reference
         // is gone, we can destroy the object.
         impl->mBase->onLastWeakRef(id);
-        delete impl->mBase;
+        if (impl->mInline) {
+            // The destructor leaves impl alone in this case, as it is also
+            // the storage of mBase.
+            impl->mBase->~RefBase();
+            if (impl->mWeak.load(std::memory_order_relaxed) == 0) {
+                impl->destroy();
+            }
+        } else {
+            delete impl->mBase;
+        }
     }
 }
 
@@ -760,20 +804,77 @@ RefBase::weakref_type* RefBase::getWeakRefs() const
 }
 
 RefBase::RefBase()
-    : mRefs(new weakref_impl(this))
+    : mRefs(createRefs(this))
 {
 }
 
+RefBase::InlineStorage*& RefBase::currentInline()
+{
+    static thread_local InlineStorage* current = nullptr;
+    return current;
+}
+
+void RefBase::beginInline(InlineStorage* storage, size_t size)
+{
+    const size_t refsSize = weakref_impl::inlineSize();
+    LOG_ALWAYS_FATAL_IF(size > SIZE_MAX - refsSize, "makeInline() of %zu bytes", size);
+    char* block = static_cast<char*>(::operator new(refsSize + size));
+    storage->object = block + refsSize;
+    storage->size = size;
+    storage->claimed = false;
+    // makeInline() may be called again from the constructor of the object.
+    InlineStorage*& current = currentInline();
+    storage->previous = current;
+    current = storage;
+    if (!gInlineUsed.load(std::memory_order_relaxed)) {
+        gInlineUsed.store(true, std::memory_order_relaxed);
+    }
+}
+
+void RefBase::endInline(InlineStorage* storage, const RefBase* base)
+{
+    currentInline() = storage->previous;
+    LOG_ALWAYS_FATAL_IF(!storage->claimed, "makeInline() object at %p has no RefBase",
+                        storage->object);
+    // A RefBase member of a base class is constructed before the RefBase of
+    // the object, and would have claimed the storage instead.
+    const weakref_impl* refs = reinterpret_cast<const weakref_impl*>(
+            static_cast<char*>(storage->object) - weakref_impl::inlineSize());
+    LOG_ALWAYS_FATAL_IF(refs->mBase != base,
+                        "makeInline() object at %p: storage claimed by another RefBase %p",
+                        storage->object, refs->mBase);
+}
+
+RefBase::weakref_impl* RefBase::createRefs(RefBase* base)
+{
+    // Only the first RefBase constructed within the storage is the object
+    // itself, anything else is allocated separately.
+    InlineStorage* storage =
+            gInlineUsed.load(std::memory_order_relaxed) ? currentInline() : nullptr;
+    if (storage && !storage->claimed) {
+        const uintptr_t p = reinterpret_cast<uintptr_t>(base);
+        const uintptr_t object = reinterpret_cast<uintptr_t>(storage->object);
+        if (p >= object && p - object < storage->size) {
+            storage->claimed = true;
+            void* refs = static_cast<char*>(storage->object) - weakref_impl::inlineSize();
+            return new (refs) weakref_impl(base, true);
+        }
+    }
+    return new weakref_impl(base, false);
+}
+
 RefBase::~RefBase()
 {
     int32_t flags = mRefs->mFlags.load(std::memory_order_relaxed);
-    // Life-time of this object is extended to WEAK, in
-    // which case weakref_impl doesn't out-live the object and we
-    // can free it now.
     if ((flags & OBJECT_LIFETIME_MASK) == OBJECT_LIFETIME_WEAK) {
+        // Life-time of this object is extended to WEAK, in
+        // which case weakref_impl doesn't out-live the object and we
+        // can free it now.
         // It's possible that the weak count is not 0 if the object
         // re-acquired a weak reference in its destructor
-        if (mRefs->mWeak.load(std::memory_order_relaxed) == 0) {
+        // The weakref_impl of an object made by sp<T>::makeInline() is also
+        // its storage, and is only ever freed by decWeak().
+        if (!mRefs->mInline && mRefs->mWeak.load(std::memory_order_relaxed) == 0) {
             delete mRefs;
         }
     } else {
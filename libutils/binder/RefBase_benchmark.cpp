@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/RefBase.h>
+
+using android::RefBase;
+using android::sp;
+using android::wp;
+
+namespace {
+
+// A small object, such as a binder callback.
+class Foo : public RefBase {
+  public:
+    explicit Foo(int value) : mValue(value) {}
+
+    int mValue;
+};
+
+// Makes an object with sp<>::make() (0) or sp<>::makeInline() (1).
+sp<Foo> makeFoo(const benchmark::State& state, int value) {
+    return state.range(0) ? sp<Foo>::makeInline(value) : sp<Foo>::make(value);
+}
+
+}  // namespace
+
+// Creates and destroys objects, on up to 8 threads at once.
+static void BM_MakeAndDestroy(benchmark::State& state) {
+    int i = 0;
+    for (auto _ : state) {
+        sp<Foo> foo = makeFoo(state, i++);
+        benchmark::DoNotOptimize(foo.get());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeAndDestroy)->Arg(0)->Arg(1)->ThreadRange(1, 8);
+
+// Same, with a wp<> which outlives the last sp<> for a while.
+static void BM_MakeAndDestroyWithWeak(benchmark::State& state) {
+    int i = 0;
+    for (auto _ : state) {
+        sp<Foo> foo = makeFoo(state, i++);
+        wp<Foo> weakFoo = foo;
+        foo = nullptr;
+        benchmark::DoNotOptimize(weakFoo.promote().get());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeAndDestroyWithWeak)->Arg(0)->Arg(1)->ThreadRange(1, 8);
@@ -280,6 +280,94 @@ TEST(RefBase, StackOwnershipDeath) {
     EXPECT_DEATH({ Foo foo(&isDeleted); foo.incStrong(nullptr); }, "");
 }
 
+TEST(RefBase, MakeInline) {
+    bool isDeleted;
+    sp<Foo> foo = sp<Foo>::makeInline(&isDeleted);
+    wp<Foo> weakFoo = foo;
+    ASSERT_EQ(1, foo->getStrongCount());
+    ASSERT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    EXPECT_EQ(foo, weakFoo.promote());
+
+    foo = nullptr;
+    // Destroyed in place, while the weak reference keeps the storage alive.
+    EXPECT_TRUE(isDeleted);
+    EXPECT_EQ(nullptr, weakFoo.promote());
+    weakFoo = nullptr;
+}
+
+TEST(RefBase, MakeInlineDoubleOwnershipDeath) {
+    bool isDeleted;
+    sp<Foo> foo = sp<Foo>::makeInline(&isDeleted);
+
+    // if something else thinks it owns foo, should die
+    EXPECT_DEATH(delete foo.get(), "Double owned");
+
+    EXPECT_FALSE(isDeleted);
+}
+
+class WeakFoo : public Foo {
+public:
+    WeakFoo(bool* deleted_check) : Foo(deleted_check) {
+        extendObjectLifetime(OBJECT_LIFETIME_WEAK);
+    }
+};
+
+TEST(RefBase, MakeInlineExtendedLifetime) {
+    bool isDeleted;
+    sp<WeakFoo> foo = sp<WeakFoo>::makeInline(&isDeleted);
+    wp<WeakFoo> weakFoo = foo;
+
+    foo = nullptr;
+    EXPECT_FALSE(isDeleted);
+    foo = weakFoo.promote();
+    ASSERT_NE(nullptr, foo);
+    foo = nullptr;
+    weakFoo = nullptr;
+    EXPECT_TRUE(isDeleted);
+}
+
+// Makes other inline objects before and after its own RefBase is constructed.
+class InlineMaker {
+public:
+    InlineMaker(bool* deleted_check) : mFirst(sp<Foo>::makeInline(deleted_check)) { }
+    sp<Foo> mFirst;
+};
+
+class NestedInline : public InlineMaker, public RefBase {
+public:
+    NestedInline(bool* first_deleted, bool* second_deleted)
+        : InlineMaker(first_deleted), mSecond(sp<Foo>::makeInline(second_deleted)) { }
+    sp<Foo> mSecond;
+};
+
+TEST(RefBase, MakeInlineNested) {
+    bool firstDeleted, secondDeleted;
+    sp<NestedInline> nested = sp<NestedInline>::makeInline(&firstDeleted, &secondDeleted);
+    ASSERT_EQ(1, nested->getStrongCount());
+    ASSERT_EQ(1, nested->mFirst->getStrongCount());
+    ASSERT_EQ(1, nested->mSecond->getStrongCount());
+
+    nested = nullptr;
+    EXPECT_TRUE(firstDeleted);
+    EXPECT_TRUE(secondDeleted);
+}
+
+// Its base class has a RefBase member, which is constructed before its own RefBase.
+struct FooHolder {
+    FooHolder(bool* deleted_check) : mFoo(deleted_check) { }
+    Foo mFoo;
+};
+
+class HeldFoo : public FooHolder, public RefBase {
+public:
+    HeldFoo(bool* deleted_check) : FooHolder(deleted_check) { }
+};
+
+TEST(RefBase, MakeInlineRefBaseMemberDeath) {
+    bool isDeleted;
+    EXPECT_DEATH(sp<HeldFoo>::makeInline(&isDeleted), "claimed by another RefBase");
+}
+
 // Set up a situation in which we race with visit2AndRremove() to delete
 // 2 strong references.  Bar destructor checks that there are no early
 // deletions and prior updates are visible to destructor.
@@ -36,18 +36,56 @@
 
 namespace android {
 
+// The empty string is shared by all empty String8s and is never freed, so, like the
+// static strings of String16, it is not reference counted.  This keeps the threads
+// creating and destroying empty strings from contending on its reference count.
+// Its buffer is marked in mClientMetadata, which String8 does not otherwise use.
+static constexpr uint32_t kIsImmortalString = 0x80000000;
+
 static inline char* getEmptyString() {
-    static SharedBuffer* gEmptyStringBuf = [] {
+    static char* gEmptyString = [] {
         SharedBuffer* buf = SharedBuffer::alloc(1);
+        buf->mClientMetadata = kIsImmortalString;
         char* str = static_cast<char*>(buf->data());
         *str = 0;
-        return buf;
+        return str;
     }();
 
-    gEmptyStringBuf->acquire();
-    return static_cast<char*>(gEmptyStringBuf->data());
+    return gEmptyString;
+}
+
+static inline bool isImmortalString(const char* str) {
+    return (SharedBuffer::bufferFromData(str)->mClientMetadata & kIsImmortalString) != 0;
+}
+
+static inline void acquireString(const char* str) {
+    if (!isImmortalString(str)) {
+        SharedBuffer::bufferFromData(str)->acquire();
+    }
+}
+
+static inline void releaseString(const char* str) {
+    if (!isImmortalString(str)) {
+        SharedBuffer::bufferFromData(str)->release();
+    }
+}
+
+// Like SharedBuffer::editResize(), but never resizes the empty string in place.
+static SharedBuffer* editResizeString(const char* str, size_t newSize) {
+    if (isImmortalString(str)) {
+        SharedBuffer* buf = SharedBuffer::alloc(newSize);
+        if (buf && newSize > 0) {
+            static_cast<char*>(buf->data())[0] = 0;
+        }
+        return buf;
+    }
+    return SharedBuffer::bufferFromData(str)->editResize(newSize);
 }
 
+// Size of the buffer appendFormatV() formats into before appending.  Longer output is
+// formatted a second time, directly into the string.
+static constexpr size_t kFormatBufferSize = 256;
+
 // ---------------------------------------------------------------------------
 
 static char* allocFromUTF8(const char* in, size_t len)
@@ -124,7 +162,7 @@ String8::String8()
 String8::String8(const String8& o)
     : mString(o.mString)
 {
-    SharedBuffer::bufferFromData(mString)->acquire();
+    acquireString(mString);
 }
 
 String8::String8(const char* o)
@@ -165,7 +203,7 @@ String8::String8(const char32_t* o, size_t len)
 
 String8::~String8()
 {
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseString(mString);
 }
 
 size_t String8::length() const
@@ -192,21 +230,21 @@ String8 String8::formatV(const char* fmt, va_list args)
 }
 
 void String8::clear() {
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseString(mString);
     mString = getEmptyString();
 }
 
 void String8::setTo(const String8& other)
 {
-    SharedBuffer::bufferFromData(other.mString)->acquire();
-    SharedBuffer::bufferFromData(mString)->release();
+    acquireString(other.mString);
+    releaseString(mString);
     mString = other.mString;
 }
 
 status_t String8::setTo(const char* other)
 {
     const char *newString = allocFromUTF8(other, strlen(other));
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseString(mString);
     mString = newString;
     if (mString) return OK;
 
@@ -217,7 +255,7 @@ status_t String8::setTo(const char* other)
 status_t String8::setTo(const char* other, size_t len)
 {
     const char *newString = allocFromUTF8(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseString(mString);
     mString = newString;
     if (mString) return OK;
 
@@ -228,7 +266,7 @@ status_t String8::setTo(const char* other, size_t len)
 status_t String8::setTo(const char16_t* other, size_t len)
 {
     const char *newString = allocFromUTF16(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseString(mString);
     mString = newString;
     if (mString) return OK;
 
@@ -239,7 +277,7 @@ status_t String8::setTo(const char16_t* other, size_t len)
 status_t String8::setTo(const char32_t* other, size_t len)
 {
     const char *newString = allocFromUTF32(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseString(mString);
     mString = newString;
     if (mString) return OK;
 
@@ -291,29 +329,33 @@ status_t String8::appendFormatV(const char* fmt, va_list args)
 {
     int n, result = OK;
     va_list tmp_args;
+    char formatBuffer[kFormatBufferSize];
 
     /* args is undefined after vsnprintf.
      * So we need a copy here to avoid the
      * second vsnprintf access undefined args.
      */
     va_copy(tmp_args, args);
-    n = vsnprintf(nullptr, 0, fmt, tmp_args);
+    n = vsnprintf(formatBuffer, sizeof(formatBuffer), fmt, tmp_args);
     va_end(tmp_args);
 
     if (n < 0) return UNKNOWN_ERROR;
 
-    if (n > 0) {
-        size_t oldLength = length();
-        if (static_cast<size_t>(n) > std::numeric_limits<size_t>::max() - 1 ||
-            oldLength > std::numeric_limits<size_t>::max() - n - 1) {
-            return NO_MEMORY;
-        }
-        char* buf = lockBuffer(oldLength + n);
-        if (buf) {
-            vsnprintf(buf + oldLength, n + 1, fmt, args);
-        } else {
-            result = NO_MEMORY;
-        }
+    // Most output fits in the buffer, and is appended without formatting it again.
+    if (static_cast<size_t>(n) < sizeof(formatBuffer)) {
+        return append(formatBuffer, n);
+    }
+
+    size_t oldLength = length();
+    if (static_cast<size_t>(n) > std::numeric_limits<size_t>::max() - 1 ||
+        oldLength > std::numeric_limits<size_t>::max() - n - 1) {
+        return NO_MEMORY;
+    }
+    char* buf = lockBuffer(oldLength + n);
+    if (buf) {
+        vsnprintf(buf + oldLength, n + 1, fmt, args);
+    } else {
+        result = NO_MEMORY;
     }
     return result;
 }
@@ -325,7 +367,7 @@ status_t String8::real_append(const char* other, size_t otherLen) {
     size_t newLen;
     if (__builtin_add_overflow(myLen, otherLen, &newLen) ||
         __builtin_add_overflow(newLen, 1, &newLen) ||
-        (buf = SharedBuffer::bufferFromData(mString)->editResize(newLen)) == nullptr) {
+        (buf = editResizeString(mString, newLen)) == nullptr) {
         return NO_MEMORY;
     }
 
@@ -339,8 +381,7 @@ status_t String8::real_append(const char* other, size_t otherLen) {
 
 char* String8::lockBuffer(size_t size)
 {
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize(size+1);
+    SharedBuffer* buf = editResizeString(mString, size+1);
     if (buf) {
         char* str = (char*)buf->data();
         mString = str;
@@ -357,8 +398,7 @@ void String8::unlockBuffer()
 status_t String8::unlockBuffer(size_t size)
 {
     if (size != this->size()) {
-        SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-            ->editResize(size+1);
+        SharedBuffer* buf = editResizeString(mString, size+1);
         if (! buf) {
             return NO_MEMORY;
         }
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+using android::String16;
+using android::String8;
+
+// A typical interface descriptor.
+static const char kDescriptor[] = "android.os.IServiceManager";
+
+static void BM_String8_Empty(benchmark::State& state) {
+    for (auto _ : state) {
+        String8 s;
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_Empty)->ThreadRange(1, 8);
+
+static void BM_String8_Short(benchmark::State& state) {
+    for (auto _ : state) {
+        String8 s(kDescriptor);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_Short)->ThreadRange(1, 8);
+
+static void BM_String8_Copy(benchmark::State& state) {
+    static const String8 source(kDescriptor);
+    for (auto _ : state) {
+        String8 s(source);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_Copy);
+
+static void BM_String8_Format(benchmark::State& state) {
+    for (auto _ : state) {
+        String8 s = String8::format("%s: %d", kDescriptor, 42);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_Format);
+
+// Appends range(0) formatted lines to a string, as dump() implementations do.
+static void BM_String8_AppendFormat(benchmark::State& state) {
+    for (auto _ : state) {
+        String8 s;
+        for (int i = 0; i < state.range(0); i++) {
+            s.appendFormat("  %s #%d: %p\n", kDescriptor, i, &s);
+        }
+        benchmark::DoNotOptimize(s.c_str());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_String8_AppendFormat)->Arg(1)->Arg(64);
+
+static void BM_String16_Empty(benchmark::State& state) {
+    for (auto _ : state) {
+        String16 s;
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String16_Empty)->ThreadRange(1, 8);
+
+static void BM_String16_Short(benchmark::State& state) {
+    for (auto _ : state) {
+        String16 s(kDescriptor);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String16_Short);
@@ -20,6 +20,7 @@
 #include <utils/String16.h>
 #include <utils/String8.h>
 #include <compare>
+#include <string>
 #include <utility>
 
 #include <gtest/gtest.h>
@@ -117,6 +118,41 @@ TEST_F(String8Test, append) {
     EXPECT_STREQ("foobar", s.c_str());
 }
 
+TEST_F(String8Test, appendFormat) {
+    String8 s;
+    EXPECT_EQ(OK, s.appendFormat("%s=%d", "foo", 42));
+    EXPECT_STREQ("foo=42", s.c_str());
+    EXPECT_EQ(OK, s.appendFormat("%s", ""));
+    EXPECT_STREQ("foo=42", s.c_str());
+
+    // Output longer than the formatting buffer is formatted directly into the string.
+    std::string longArg(1000, 'x');
+    EXPECT_EQ(OK, s.appendFormat(",%s,", longArg.c_str()));
+    EXPECT_EQ("foo=42," + longArg + ",", std::string(s.c_str()));
+    EXPECT_EQ(6 + 1 + longArg.size() + 1, s.size());
+}
+
+TEST_F(String8Test, emptyStringsAreIndependent) {
+    String8 empty1;
+    String8 empty2(empty1);
+    String8 empty3("");
+
+    char* buf = empty1.lockBuffer(3);
+    ASSERT_NE(nullptr, buf);
+    strcpy(buf, "abc");
+    empty1.unlockBuffer(3);
+    empty3.append("def");
+
+    EXPECT_STREQ("abc", empty1.c_str());
+    EXPECT_STREQ("", empty2.c_str());
+    EXPECT_STREQ("def", empty3.c_str());
+    EXPECT_STREQ("", String8().c_str());
+
+    empty1.clear();
+    EXPECT_TRUE(empty1.empty());
+    EXPECT_EQ(0U, String8().size());
+}
+
 TEST_F(String8Test, removeAll) {
     String8 s("Hello, world!");
 
@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <log/log.h>
 
 #include "SharedBuffer.h"
@@ -339,6 +342,14 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
 
     size_t new_allocation_size = 0;
     LOG_ALWAYS_FATAL_IF(__builtin_mul_overflow(new_capacity, mItemSize, &new_allocation_size));
+    if (mStorage && _can_relocate_storage()) {
+        SharedBuffer* sb = SharedBuffer::bufferFromData(mStorage)->editResize(new_allocation_size);
+        if (!sb) {
+            return NO_MEMORY;
+        }
+        mStorage = sb->data();
+        return new_capacity;
+    }
     SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
@@ -361,6 +372,35 @@ ssize_t VectorImpl::resize(size_t size) {
     return result < 0 ? result : size;
 }
 
+ssize_t VectorImpl::assign_items(const void* const* items, size_t count)
+{
+    size_t new_alloc_size = 0;
+    LOG_ALWAYS_FATAL_IF(
+            __builtin_mul_overflow(max(kMinVectorCapacity, count), mItemSize, &new_alloc_size),
+            "new_alloc_size overflow");
+    SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
+    if (!sb) {
+        return NO_MEMORY;
+    }
+    uint8_t* array = reinterpret_cast<uint8_t*>(sb->data());
+    // copy runs of adjacent items at once, to save on virtual calls
+    size_t i = 0;
+    while (i < count) {
+        const uint8_t* from = reinterpret_cast<const uint8_t*>(items[i]);
+        size_t run = 1;
+        while (i + run < count &&
+                reinterpret_cast<const uint8_t*>(items[i + run]) == from + run*mItemSize) {
+            run++;
+        }
+        _do_copy(array + i*mItemSize, from, run);
+        i += run;
+    }
+    release_storage();
+    mStorage = array;
+    mCount = count;
+    return OK;
+}
+
 void VectorImpl::release_storage()
 {
     if (mStorage) {
@@ -417,6 +457,20 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             } else {
                 return nullptr;
             }
+        } else if (mStorage && _can_relocate_storage()) {
+            // realloc() the buffer, then open the gap in place
+            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+            SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
+            if (sb) {
+                mStorage = sb->data();
+            } else {
+                return nullptr;
+            }
+            if (where != mCount) {
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* to = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (mCount-where)*mItemSize);
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
@@ -463,9 +517,11 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     size_t new_size;
     LOG_ALWAYS_FATAL_IF(__builtin_sub_overflow(mCount, amount, &new_size));
 
-    if (new_size < (capacity() / 2)) {
+    // Leave the new capacity at twice the new size, and only shrink again once the vector
+    // is a quarter full, so that removing items one by one does not reallocate each time.
+    if (new_size < (capacity() / 4)) {
         // NOTE: (new_size * 2) is safe because capacity didn't overflow and
-        // new_size < (capacity / 2)).
+        // new_size < (capacity / 4)).
         const size_t new_capacity = max(kMinVectorCapacity, new_size * 2);
 
         // NOTE: (new_capacity * mItemSize), (where * mItemSize) and
@@ -484,6 +540,20 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             } else {
                 return;
             }
+        } else if (_can_relocate_storage()) {
+            // close the gap in place, then realloc() the buffer
+            void* to = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+            _do_destroy(to, amount);
+            if (where != new_size) {
+                const void* from = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (new_size-where)*mItemSize);
+            }
+            // if this fails, the items just stay in the larger buffer
+            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+            SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
+            if (sb) {
+                mStorage = sb->data();
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
@@ -546,11 +616,30 @@ void VectorImpl::_do_splat(void* dest, const void* item, size_t num) const {
 }
 
 void VectorImpl::_do_move_forward(void* dest, const void* from, size_t num) const {
-    do_move_forward(dest, from, num);
+    if (_is_relocatable()) {
+        memmove(dest, from, num*itemSize());
+    } else {
+        do_move_forward(dest, from, num);
+    }
 }
 
 void VectorImpl::_do_move_backward(void* dest, const void* from, size_t num) const {
-    do_move_backward(dest, from, num);
+    if (_is_relocatable()) {
+        memmove(dest, from, num*itemSize());
+    } else {
+        do_move_backward(dest, from, num);
+    }
+}
+
+bool VectorImpl::_is_relocatable() const {
+    // same rule as use_trivial_move<> in TypeHelpers.h
+    return (mFlags & HAS_TRIVIAL_MOVE) ||
+            ((mFlags & HAS_TRIVIAL_COPY) && (mFlags & HAS_TRIVIAL_DTOR));
+}
+
+bool VectorImpl::_can_relocate_storage() const {
+    // items can only be moved with their buffer when no other vector shares it
+    return _is_relocatable() && SharedBuffer::bufferFromData(mStorage)->onlyOwner();
 }
 
 /*****************************************************************************/
@@ -630,19 +719,29 @@ ssize_t SortedVectorImpl::add(const void* item)
 
 ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
 {
-    // naive merge...
-    if (!vector.isEmpty()) {
-        const void* buffer = vector.arrayImpl();
-        const size_t is = itemSize();
-        size_t s = vector.size();
-        for (size_t i=0 ; i<s ; i++) {
-            ssize_t err = add( reinterpret_cast<const char*>(buffer) + i*is );
-            if (err<0) {
-                return err;
-            }
+    if (vector.isEmpty()) {
+        return OK;
+    }
+    // sort the new items once, rather than inserting them one at a time
+    const char* buffer = reinterpret_cast<const char*>(vector.arrayImpl());
+    const size_t is = itemSize();
+    std::vector<const void*> items(vector.size());
+    for (size_t i=0 ; i<items.size() ; i++) {
+        items[i] = buffer + i*is;
+    }
+    std::stable_sort(items.begin(), items.end(), [this](const void* lhs, const void* rhs) {
+        return do_compare(lhs, rhs) < 0;
+    });
+    // like add(), the last of equal items wins
+    size_t count = 0;
+    for (size_t i=0 ; i<items.size() ; i++) {
+        if (count && do_compare(items[count-1], items[i]) == 0) {
+            items[count-1] = items[i];
+        } else {
+            items[count++] = items[i];
         }
     }
-    return OK;
+    return _merge(items.data(), count);
 }
 
 ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
@@ -651,18 +750,53 @@ ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
     ssize_t err = OK;
     if (!vector.isEmpty()) {
         // first take care of the case where the vectors are sorted together
-        if (do_compare(vector.itemLocation(vector.size()-1), arrayImpl()) <= 0) {
-            err = VectorImpl::insertVectorAt(static_cast<const VectorImpl&>(vector), 0);
-        } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) >= 0) {
+        if (isEmpty() || do_compare(vector.arrayImpl(), itemLocation(size()-1)) > 0) {
             err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
+        } else if (do_compare(vector.itemLocation(vector.size()-1), arrayImpl()) < 0) {
+            err = VectorImpl::insertVectorAt(static_cast<const VectorImpl&>(vector), 0);
         } else {
-            // this could be made a little better
-            err = merge(static_cast<const VectorImpl&>(vector));
+            const char* buffer = reinterpret_cast<const char*>(vector.arrayImpl());
+            const size_t is = itemSize();
+            std::vector<const void*> items(vector.size());
+            for (size_t i=0 ; i<items.size() ; i++) {
+                items[i] = buffer + i*is;
+            }
+            err = _merge(items.data(), items.size());
         }
     }
     return err;
 }
 
+ssize_t SortedVectorImpl::_merge(const void* const* items, size_t count)
+{
+    // items are sorted and unique, and replace the equal items of this vector
+    const char* a = reinterpret_cast<const char*>(arrayImpl());
+    const size_t s = itemSize();
+    const size_t n = size();
+    std::vector<const void*> merged;
+    merged.reserve(n + count);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < n && j < count) {
+        const void* const curr = a + i*s;
+        const int c = do_compare(curr, items[j]);
+        if (c < 0) {
+            merged.push_back(curr);
+            i++;
+        } else {
+            if (c == 0) {
+                i++;
+            }
+            merged.push_back(items[j++]);
+        }
+    }
+    for ( ; i<n ; i++) {
+        merged.push_back(a + i*s);
+    }
+    merged.insert(merged.end(), items + j, items + count);
+    return assign_items(merged.data(), merged.size());
+}
+
 ssize_t SortedVectorImpl::remove(const void* item)
 {
     ssize_t i = indexOf(item);
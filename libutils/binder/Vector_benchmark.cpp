@@ -15,6 +15,8 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <vector>
 
@@ -50,4 +52,55 @@ void BM_prepend_std_vector(benchmark::State& state) {
 }
 BENCHMARK(BM_prepend_std_vector);
 
+// String8 is trivially movable, so growing and inserting memmove()s it.
+void BM_prepend_android_vector_string8(benchmark::State& state) {
+    const android::String8 s("A");
+    while (state.KeepRunning()) {
+        android::Vector<android::String8> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.insertAt(s, 0);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_prepend_android_vector_string8)->Arg(16)->Arg(1024);
+
+void BM_fill_android_vector_string8(benchmark::State& state) {
+    const android::String8 s("A");
+    while (state.KeepRunning()) {
+        android::Vector<android::String8> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.push(s);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_fill_android_vector_string8)->Arg(16)->Arg(1024);
+
+// Builds a sorted vector of range(0) scattered ints, one add() at a time.
+void BM_add_android_sorted_vector(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::SortedVector<int> v;
+        for (int i = 0; i < state.range(0); i++) {
+            v.add((i * 7919) % state.range(0));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_add_android_sorted_vector)->Arg(16)->Arg(1024)->Arg(16384);
+
+// Builds the same sorted vector with a single merge().
+void BM_merge_android_sorted_vector(benchmark::State& state) {
+    android::Vector<int> items;
+    for (int i = 0; i < state.range(0); i++) {
+        items.add((i * 7919) % state.range(0));
+    }
+    while (state.KeepRunning()) {
+        android::SortedVector<int> v;
+        v.merge(items);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_merge_android_sorted_vector)->Arg(16)->Arg(1024)->Arg(16384);
+
 BENCHMARK_MAIN();
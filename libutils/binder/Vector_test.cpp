@@ -19,8 +19,12 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <iterator>
+
 #include <android/log.h>
 #include <gtest/gtest.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -144,4 +148,106 @@ TEST_F(VectorTest, removeItemsAt_overflow) {
     ASSERT_DEATH(v.removeItemsAt(SIZE_MAX, SIZE_MAX), "overflow");
 }
 
+TEST_F(VectorTest, RemoveOneByOne_FewReallocations) {
+    Vector<int> vector;
+    for (int i = 0; i < 1000; i++) vector.add(i);
+
+    // Popping items one at a time must not shrink the storage every few
+    // removals, as a heap kept in a Vector does.
+    size_t shrinks = 0;
+    size_t capacity = vector.capacity();
+    while (!vector.isEmpty()) {
+        vector.removeAt(vector.size() - 1);
+        ASSERT_GE(vector.capacity(), vector.size());
+        if (vector.capacity() != capacity) {
+            shrinks++;
+            capacity = vector.capacity();
+        }
+    }
+    EXPECT_LE(shrinks, 10U);
+}
+
+TEST_F(VectorTest, Relocatable_InsertAndRemove) {
+    // String8 is trivially movable, so its storage is realloc()ed.
+    Vector<String8> vector;
+    for (int i = 0; i < 100; i++) {
+        vector.insertAt(String8::format("%d", i), 0);
+    }
+    Vector<String8> other = vector;
+    vector.insertAt(String8("middle"), 95);
+    vector.removeItemsAt(0, 90);
+
+    ASSERT_EQ(11U, vector.size());
+    EXPECT_EQ(String8("9"), vector[0]);
+    EXPECT_EQ(String8("middle"), vector[5]);
+    EXPECT_EQ(String8("0"), vector[10]);
+
+    // The copy which shared the storage is left alone.
+    ASSERT_EQ(100U, other.size());
+    for (size_t i = 0; i < other.size(); i++) {
+        EXPECT_EQ(String8::format("%zu", 99 - i), other[i]);
+    }
+}
+
+TEST_F(VectorTest, Relocatable_SetCapacity) {
+    Vector<String8> vector;
+    vector.add(String8("a"));
+    vector.add(String8("b"));
+    ASSERT_EQ(64, vector.setCapacity(64));
+    EXPECT_EQ(64U, vector.capacity());
+    ASSERT_EQ(2U, vector.size());
+    EXPECT_EQ(String8("a"), vector[0]);
+    EXPECT_EQ(String8("b"), vector[1]);
+}
+
+TEST_F(VectorTest, SortedVector_MergeUnsorted) {
+    typedef key_value_pair_t<int, int> Pair;
+    SortedVector<Pair> sorted;
+    sorted.add(Pair(2, 0));
+    sorted.add(Pair(4, 0));
+    sorted.add(Pair(6, 0));
+
+    Vector<Pair> vector;
+    vector.add(Pair(5, 1));
+    vector.add(Pair(4, 1));
+    vector.add(Pair(1, 1));
+    vector.add(Pair(5, 2));
+    vector.add(Pair(7, 1));
+    ASSERT_EQ(OK, sorted.merge(vector));
+
+    // Like add(), later items replace equal ones.
+    const Pair expected[] = {Pair(1, 1), Pair(2, 0), Pair(4, 1), Pair(5, 2), Pair(6, 0), Pair(7, 1)};
+    ASSERT_EQ(std::size(expected), sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        EXPECT_EQ(expected[i].key, sorted[i].key);
+        EXPECT_EQ(expected[i].value, sorted[i].value);
+    }
+}
+
+TEST_F(VectorTest, SortedVector_MergeSorted) {
+    SortedVector<String8> sorted;
+    sorted.add(String8("b"));
+    sorted.add(String8("d"));
+
+    SortedVector<String8> other;
+    other.add(String8("a"));
+    other.add(String8("b"));
+    other.add(String8("c"));
+    other.add(String8("e"));
+    ASSERT_GE(sorted.merge(other), 0);
+
+    const char* expected[] = {"a", "b", "c", "d", "e"};
+    ASSERT_EQ(std::size(expected), sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        EXPECT_EQ(String8(expected[i]), sorted[i]);
+    }
+
+    // Merging a vector into itself or into an empty one.
+    ASSERT_GE(sorted.merge(sorted), 0);
+    EXPECT_EQ(std::size(expected), sorted.size());
+    SortedVector<String8> empty;
+    ASSERT_GE(empty.merge(sorted), 0);
+    EXPECT_EQ(std::size(expected), empty.size());
+}
+
 } // namespace android
@@ -150,6 +150,24 @@
 // object while there are still weak references. This is really special purpose
 // functionality to support Binder.
 
+// sp<T>::makeInline() constructs an object in the same allocation as its
+// reference counts, rather than allocating them separately in the RefBase
+// constructor. When the last strong reference goes away, the object is
+// destroyed in place, and the memory is freed along with the reference counts
+// once the last weak reference goes away too. Such an object must never be
+// deleted directly, and its class-specific operator new/delete, if any, are
+// not used. This is worthwhile for small, short-lived objects which are
+// rarely held through wp<>, since a wp<> then keeps the whole allocation
+// alive.
+//
+// The reference counts are handed to the object through a thread-local
+// record of the allocation in progress: the first RefBase constructed within
+// it is taken to be the object's own. makeInline() therefore aborts for a
+// class whose bases construct another RefBase inside the object first, for
+// instance a base class holding a RefBase subclass by value. Such classes
+// must use make(). Deleting an object made by makeInline() while it still
+// has strong references aborts, as it does for make().
+
 // Wp::promote(), implemented via the attemptIncStrong() member function, is
 // used to try to convert a weak pointer back to a strong pointer.  It's the
 // normal way to try to access the fields of an object referenced only through
@@ -209,8 +227,10 @@
 #define ANDROID_REF_BASE_H
 
 #include <atomic>
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <new>
 #include <type_traits>  // for common_type.
 
 #include <stdint.h>
@@ -382,6 +402,23 @@ private:
                             RefBase(const RefBase& o);
             RefBase&        operator=(const RefBase& o);
 
+private:
+    template<typename Y> friend class sp;
+
+    // Storage for an object being constructed by sp<T>::makeInline(), right
+    // after its weakref_impl.
+    struct InlineStorage {
+        void*           object;
+        size_t          size;
+        InlineStorage*  previous;
+        bool            claimed;
+    };
+
+    static  void            beginInline(InlineStorage* storage, size_t size);
+    static  void            endInline(InlineStorage* storage, const RefBase* base);
+    static  InlineStorage*& currentInline();
+    static  weakref_impl*   createRefs(RefBase* base);
+
 private:
     friend class ReferenceMover;
 
@@ -537,6 +574,21 @@ private:
 // Note that the above comparison operations go out of their way to provide an ordering consistent
 // with ordinary pointer comparison; otherwise they could ignore m_ptr, and just compare m_refs.
 
+template <typename T>
+template <typename... Args>
+sp<T> sp<T>::makeInline(Args&&... args) {
+    static_assert(std::is_base_of<RefBase, T>::value, "makeInline() requires a RefBase");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "makeInline() can't over-align");
+    RefBase::InlineStorage storage;
+    RefBase::beginInline(&storage, sizeof(T));
+    T* t = new (storage.object) T(std::forward<Args>(args)...);
+    RefBase::endInline(&storage, static_cast<const RefBase*>(t));
+    sp<T> result;
+    result.m_ptr = t;
+    t->incStrong(t);
+    return result;
+}
+
 template <typename T>
 wp<T> wp<T>::fromExisting(T* other) {
     if (!other) return nullptr;
@@ -50,6 +50,11 @@ public:
     template <typename... Args>
     static inline sp<T> make(Args&&... args);
 
+    // Like make(), but allocates the object together with its reference
+    // counts. Only for RefBase subclasses, see utils/RefBase.h.
+    template <typename... Args>
+    static inline sp<T> makeInline(Args&&... args);
+
     // if nullptr, returns nullptr
     //
     // if a strong pointer is already available, this will retrieve it,
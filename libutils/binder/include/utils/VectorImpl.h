@@ -44,6 +44,7 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        HAS_TRIVIAL_MOVE    = 0x00000008,
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
@@ -99,6 +100,10 @@ protected:
             size_t          itemSize() const;
             void            release_storage();
 
+    /*! replaces the items with copies of the given ones, which may
+     * be items of this vector */
+            ssize_t         assign_items(const void* const* items, size_t count);
+
     virtual void            do_construct(void* storage, size_t num) const = 0;
     virtual void            do_destroy(void* storage, size_t num) const = 0;
     virtual void            do_copy(void* dest, const void* from, size_t num) const = 0;
@@ -116,6 +121,8 @@ private:
         inline void _do_splat(void* dest, const void* item, size_t num) const;
         inline void _do_move_forward(void* dest, const void* from, size_t num) const;
         inline void _do_move_backward(void* dest, const void* from, size_t num) const;
+        inline bool _is_relocatable() const;
+        inline bool _can_relocate_storage() const;
 
             // These 2 fields are exposed in the inlines below,
             // so they're set in stone.
@@ -158,6 +165,7 @@ protected:
 
 private:
             ssize_t         _indexOrderOf(const void* item, size_t* order = nullptr) const;
+            ssize_t         _merge(const void* const* items, size_t count);
 
             // these are made private, because they can't be used on a SortedVector
             // (they don't have an implementation either)
@@ -221,9 +221,22 @@ public:
          * or Looper_pollAll() MUST check the return from these functions to
          * discover when data is available on such fds and process it.
          */
-        PREPARE_ALLOW_NON_CALLBACKS = 1<<0
+        PREPARE_ALLOW_NON_CALLBACKS = 1<<0,
+
+        /**
+         * Option for Looper_prepare: this looper will wake up for delayed messages
+         * using a timerfd, so they are delivered at their exact uptime instead of
+         * at the next millisecond boundary of the poll timeout.
+         */
+        PREPARE_PRECISE_TIMERS = 1<<1
     };
 
+    /**
+     * Identifies a message enqueued by enqueueMessageAtTime(), for removeMessage().
+     * Never 0.
+     */
+    typedef uint64_t MessageToken;
+
     /**
      * Creates a looper.
      *
@@ -233,6 +246,14 @@ public:
      */
     Looper(bool allowNonCallbacks);
 
+    /**
+     * Creates a looper.
+     *
+     * If preciseTimers is true, the looper arms a timerfd for the next pending
+     * message rather than rounding the poll timeout to milliseconds.
+     */
+    Looper(bool allowNonCallbacks, bool preciseTimers);
+
     /**
      * Returns whether this looper instance allows the registration of file descriptors
      * using identifiers instead of callbacks.
@@ -386,6 +407,23 @@ public:
     void sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
             const Message& message);
 
+    /**
+     * Like sendMessageAtTime(), but returns a token which removeMessage() accepts
+     * to remove this one message from the queue.
+     *
+     * This method can be called on any thread.
+     */
+    MessageToken enqueueMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
+            const Message& message);
+
+    /**
+     * Removes the message identified by the given token from the queue.
+     *
+     * Returns true if the message was removed, false if it was already sent or removed.
+     * This method can be called on any thread.
+     */
+    bool removeMessage(MessageToken token);
+
     /**
      * Removes all messages for the specified handler from the queue.
      *
@@ -415,7 +453,8 @@ public:
      * If the thread already has a looper, it is returned.  Otherwise, a new
      * one is created, associated with the thread, and returned.
      *
-     * The opts may be PREPARE_ALLOW_NON_CALLBACKS or 0.
+     * The opts may be a combination of PREPARE_ALLOW_NON_CALLBACKS and
+     * PREPARE_PRECISE_TIMERS, or 0.
      */
     static sp<Looper> prepare(int opts);
 
@@ -463,11 +502,18 @@ private:
         Message message;
     };
 
+    // Message tokens, the timerfd and the table of requests, kept out of line so that
+    // the layout of Looper does not change.  Defined in Looper.cpp.
+    class State;
+
     const bool mAllowNonCallbacks; // immutable
 
     android::base::unique_fd mWakeEventFd;  // immutable
     Mutex mLock;
 
+    // The first envelope holds the State as its handler and is never sent; it is only
+    // accessed through stateLocked(), which aborts if it is not the State.  The
+    // following ones are a binary min-heap of the pending messages.
     Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
@@ -478,13 +524,17 @@ private:
     android::base::unique_fd mEpollFd;  // guarded by mLock but only modified on the looper thread
     bool mEpollRebuildRequired; // guarded by mLock
 
-    // Locked maps of fds and sequence numbers monitoring requests.
-    // Both maps must be kept in sync at all times.
-    std::unordered_map<SequenceNumber, Request> mRequests;               // guarded by mLock
+    // Locked map of fds to the sequence numbers of their requests.  The requests are
+    // in the table of the State, indexed by the slot in the low 32 bits of the sequence
+    // number.  Both must be kept in sync at all times.
+    // The high 32 bits are a non-zero generation, so that events for a request which
+    // was removed or replaced since the poll are not delivered to the request now in
+    // its slot.  The sequence numbers 1 and 2 are reserved for the WakeEventFd and the
+    // TimerFd.
+    std::unordered_map<SequenceNumber, Request> mRequests;               // unused, see State
     std::unordered_map<int /*fd*/, SequenceNumber> mSequenceNumberByFd;  // guarded by mLock
 
-    // The sequence number to use for the next fd that is added to the looper.
-    // The sequence number 0 is reserved for the WakeEventFd.
+    // The generation of the sequence number of the next fd that is added to the looper.
     SequenceNumber mNextRequestSeq;  // guarded by mLock
 
     // This state is only used privately by pollOnce and does not require a lock since
@@ -496,6 +546,9 @@ private:
     int pollInner(int timeoutMillis);
     int removeSequenceNumberLocked(SequenceNumber seq);  // requires mLock
     void awoken();
+    MessageToken enqueueMessage(nsecs_t uptime, const sp<MessageHandler>& handler,
+            const Message& message, bool removable);
+    State& stateLocked();  // requires mLock
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
 
@@ -504,6 +557,11 @@ private:
     static void initEpollEvent(struct epoll_event* eventItem);
 };
 
+// The heap of messages moves envelopes around, let Vector relocate them with memmove().
+ANDROID_TRIVIAL_MOVE_TRAIT(Looper::MessageEnvelope)
+// Likewise for the responses, which grow and shrink with the number of ready fds.
+ANDROID_TRIVIAL_MOVE_TRAIT(Looper::Response)
+
 } // namespace android
 
 #endif // UTILS_LOOPER_H
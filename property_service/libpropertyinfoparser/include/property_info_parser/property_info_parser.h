@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 static constexpr char PROP_TREE_FILE[] = "/dev/__properties__/property_info";
 
@@ -54,8 +55,34 @@ struct TrieNodeInternal {
   // Exact matches are a sorted list of exact matches at this node_; binary search them.
   uint32_t num_exact_matches;
   uint32_t exact_match_entries;
+
+  // Only valid from kPropertyInfoAreaVersionChildFingerprints on: an array of the
+  // TrieNameFingerprint() of each child node's name, in the order of child_nodes.
+  uint32_t child_fingerprints;
 };
 
+// The first version whose trie nodes have child_fingerprints.  Older parsers ignore the field.
+static constexpr uint32_t kPropertyInfoAreaVersionChildFingerprints = 2;
+
+// The first 8 bytes of name, zero padded, as a big endian integer, such that fingerprints sort like
+// the names they come from.  Names never contain '\0', so names shorter than 8 bytes are fully
+// identified by their fingerprint.
+inline uint64_t TrieNameFingerprint(const char* name, uint32_t namelen) {
+  if (namelen >= sizeof(uint64_t)) {
+    uint64_t fingerprint;
+    memcpy(&fingerprint, name, sizeof(fingerprint));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    fingerprint = __builtin_bswap64(fingerprint);
+#endif
+    return fingerprint;
+  }
+  uint64_t fingerprint = 0;
+  for (uint32_t i = 0; i < sizeof(uint64_t); ++i) {
+    fingerprint = (fingerprint << 8) | (i < namelen ? static_cast<unsigned char>(name[i]) : 0);
+  }
+  return fingerprint;
+}
+
 struct PropertyInfoAreaHeader {
   // The current version of this data as created by property service.
   uint32_t current_version;
@@ -88,6 +115,17 @@ class SerializedData {
     return *reinterpret_cast<const uint32_t*>(data_base_ + offset);
   }
 
+  // The arena only aligns to 4 bytes, so this is read with memcpy().
+  uint64_t uint64_array_element(uint32_t offset, uint32_t n) const {
+    uint64_t value;
+    memcpy(&value, data_base_ + offset + n * sizeof(uint64_t), sizeof(value));
+    return value;
+  }
+
+  uint32_t version() const {
+    return reinterpret_cast<const PropertyInfoAreaHeader*>(data_base_)->current_version;
+  }
+
   const char* data_base() const { return data_base_; }
 
  private:
@@ -117,6 +155,13 @@ class TrieNode {
 
   bool FindChildForString(const char* input, uint32_t namelen, TrieNode* child) const;
 
+  bool has_child_fingerprints() const {
+    return serialized_data_->version() >= kPropertyInfoAreaVersionChildFingerprints;
+  }
+  uint64_t child_fingerprint(int n) const {
+    return serialized_data_->uint64_array_element(trie_node_base_->child_fingerprints, n);
+  }
+
   uint32_t num_prefixes() const { return trie_node_base_->num_prefixes; }
   const PropertyEntry* prefix(int n) const {
     uint32_t prefix_entry_offset =
@@ -134,6 +179,8 @@ class TrieNode {
   }
 
  private:
+  bool FindChildByFingerprint(const char* input, uint32_t namelen, TrieNode* child) const;
+
   const PropertyEntry* node_property_entry() const {
     return reinterpret_cast<const PropertyEntry*>(serialized_data_->data_base() +
                                                   trie_node_base_->property_entry);
@@ -65,9 +65,13 @@ int PropertyInfoArea::FindTypeIndex(const char* type) const {
   });
 }
 
-// Binary search the list of children nodes to find a TrieNode for a given property piece.
+// Search the list of children nodes to find a TrieNode for a given property piece.
 // Used to traverse the Trie in GetPropertyInfoIndexes().
 bool TrieNode::FindChildForString(const char* name, uint32_t namelen, TrieNode* child) const {
+  if (has_child_fingerprints()) {
+    return FindChildByFingerprint(name, namelen, child);
+  }
+
   auto node_index = Find(trie_node_base_->num_child_nodes, [this, name, namelen](auto array_offset) {
     const char* child_name = child_node(array_offset).name();
     int cmp = strncmp(child_name, name, namelen);
@@ -88,19 +92,53 @@ bool TrieNode::FindChildForString(const char* name, uint32_t namelen, TrieNode*
   return true;
 }
 
+// Branchless lower bound search of the children's name fingerprints, which only touches the
+// fingerprint array, followed by a comparison of the few children that share the fingerprint of
+// name.  This avoids comparing name against the out of line name of each visited child.
+bool TrieNode::FindChildByFingerprint(const char* name, uint32_t namelen, TrieNode* child) const {
+  const uint64_t fingerprint = TrieNameFingerprint(name, namelen);
+  uint32_t first = 0;
+  uint32_t len = num_child_nodes();
+  if (len == 0) return false;
+  while (len > 1) {
+    uint32_t half = len / 2;
+    first += child_fingerprint(first + half - 1) < fingerprint ? half : 0;
+    len -= half;
+  }
+  if (child_fingerprint(first) < fingerprint) ++first;
+
+  for (uint32_t i = first; i < num_child_nodes() && child_fingerprint(i) == fingerprint; ++i) {
+    TrieNode candidate = child_node(i);
+    // Names shorter than a fingerprint are fully identified by it.
+    if (namelen < sizeof(uint64_t)) {
+      *child = candidate;
+      return true;
+    }
+    const char* child_name = candidate.name();
+    if (!strncmp(child_name + sizeof(uint64_t), name + sizeof(uint64_t),
+                 namelen - sizeof(uint64_t)) &&
+        child_name[namelen] == '\0') {
+      *child = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
 void PropertyInfoArea::CheckPrefixMatch(const char* remaining_name, const TrieNode& trie_node,
                                         uint32_t* context_index, uint32_t* type_index) const {
   const uint32_t remaining_name_size = strlen(remaining_name);
   for (uint32_t i = 0; i < trie_node.num_prefixes(); ++i) {
-    auto prefix_len = trie_node.prefix(i)->namelen;
+    const PropertyEntry* prefix = trie_node.prefix(i);
+    auto prefix_len = prefix->namelen;
     if (prefix_len > remaining_name_size) continue;
 
-    if (!strncmp(c_string(trie_node.prefix(i)->name_offset), remaining_name, prefix_len)) {
-      if (trie_node.prefix(i)->context_index != ~0u) {
-        *context_index = trie_node.prefix(i)->context_index;
+    if (!strncmp(c_string(prefix->name_offset), remaining_name, prefix_len)) {
+      if (prefix->context_index != ~0u) {
+        *context_index = prefix->context_index;
       }
-      if (trie_node.prefix(i)->type_index != ~0u) {
-        *type_index = trie_node.prefix(i)->type_index;
+      if (prefix->type_index != ~0u) {
+        *type_index = prefix->type_index;
       }
       return;
     }
@@ -143,25 +181,27 @@ void PropertyInfoArea::GetPropertyInfoIndexes(const char* name, uint32_t* contex
   }
 
   // We've made it to a leaf node, so check contents and return appropriately.
-  // Check exact matches
-  for (uint32_t i = 0; i < trie_node.num_exact_matches(); ++i) {
-    if (!strcmp(c_string(trie_node.exact_match(i)->name_offset), remaining_name)) {
-      if (context_index != nullptr) {
-        if (trie_node.exact_match(i)->context_index != ~0u) {
-          *context_index = trie_node.exact_match(i)->context_index;
-        } else {
-          *context_index = return_context_index;
-        }
+  // Check exact matches, which are sorted and unique.
+  auto exact_match_index = Find(trie_node.num_exact_matches(), [&](auto array_offset) {
+    return strcmp(c_string(trie_node.exact_match(array_offset)->name_offset), remaining_name);
+  });
+  if (exact_match_index != -1) {
+    const PropertyEntry* exact_match = trie_node.exact_match(exact_match_index);
+    if (context_index != nullptr) {
+      if (exact_match->context_index != ~0u) {
+        *context_index = exact_match->context_index;
+      } else {
+        *context_index = return_context_index;
       }
-      if (type_index != nullptr) {
-        if (trie_node.exact_match(i)->type_index != ~0u) {
-          *type_index = trie_node.exact_match(i)->type_index;
-        } else {
-          *type_index = return_type_index;
-        }
+    }
+    if (type_index != nullptr) {
+      if (exact_match->type_index != ~0u) {
+        *type_index = exact_match->type_index;
+      } else {
+        *type_index = return_type_index;
       }
-      return;
     }
+    return;
   }
   // Check prefix matches for prefixes not deliminated with '.'
   CheckPrefixMatch(remaining_name, trie_node, &return_context_index, &return_type_index);
@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+#include "property_info_parser/property_info_parser.h"
+#include "property_info_serializer/property_info_serializer.h"
+#include "trie_builder.h"
+#include "trie_serializer.h"
+
+using android::base::ReadFileToString;
+
+namespace android {
+namespace properties {
+
+namespace {
+
+// The property_contexts files that init builds /dev/__properties__/property_info from.
+constexpr const char* kPropertyContextsFiles[] = {
+    "/system/etc/selinux/plat_property_contexts",
+    "/system_ext/etc/selinux/system_ext_property_contexts",
+    "/vendor/etc/selinux/vendor_property_contexts",
+    "/product/etc/selinux/product_property_contexts",
+    "/odm/etc/selinux/odm_property_contexts",
+};
+
+struct Corpus {
+  std::string legacy_trie;
+  std::string fingerprint_trie;
+  // A property name matched by each entry of the property_contexts files.
+  std::vector<std::string> names;
+};
+
+const Corpus* GetCorpus() {
+  static const Corpus* corpus = [] {
+    std::vector<PropertyInfoEntry> property_infos;
+    for (const char* file : kPropertyContextsFiles) {
+      std::string contents;
+      if (!ReadFileToString(file, &contents)) continue;
+      std::vector<std::string> errors;
+      ParsePropertyInfoFile(contents, true, &property_infos, &errors);
+    }
+
+    auto trie_builder = TrieBuilder("u:object_r:default_prop:s0", "string");
+    auto result = new Corpus();
+    for (const auto& [name, context, type, is_exact] : property_infos) {
+      std::string error;
+      if (!trie_builder.AddToTrie(name, context, type, is_exact, &error)) continue;
+      result->names.emplace_back(is_exact ? name : name + "benchmark");
+    }
+    result->legacy_trie = TrieSerializer(false).SerializeTrie(trie_builder);
+    result->fingerprint_trie = TrieSerializer(true).SerializeTrie(trie_builder);
+    return result;
+  }();
+  return corpus;
+}
+
+}  // namespace
+
+// Looks up the context and type of every name of the corpus, with the legacy layout (0) or the
+// child fingerprint layout (1).
+static void BM_GetPropertyInfo(benchmark::State& state) {
+  const Corpus* corpus = GetCorpus();
+  if (corpus->names.empty()) {
+    state.SkipWithError("No property_contexts found");
+    return;
+  }
+  const std::string& trie = state.range(0) ? corpus->fingerprint_trie : corpus->legacy_trie;
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(trie.data());
+
+  for (auto _ : state) {
+    for (const auto& name : corpus->names) {
+      const char* context;
+      const char* type;
+      property_info_area->GetPropertyInfo(name.c_str(), &context, &type);
+      benchmark::DoNotOptimize(context);
+      benchmark::DoNotOptimize(type);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus->names.size());
+}
+BENCHMARK(BM_GetPropertyInfo)->Arg(0)->Arg(1);
+
+}  // namespace properties
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -20,6 +20,9 @@
 
 #include <gtest/gtest.h>
 
+#include "trie_builder.h"
+#include "trie_serializer.h"
+
 namespace android {
 namespace properties {
 
@@ -39,7 +42,7 @@ TEST(propertyinfoserializer, TrieNodeCheck) {
   auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
 
   // Initial checks for property area.
-  EXPECT_EQ(1U, property_info_area->current_version());
+  EXPECT_EQ(kPropertyInfoAreaVersionChildFingerprints, property_info_area->current_version());
   EXPECT_EQ(1U, property_info_area->minimum_supported_version());
 
   // Check the root node
@@ -887,5 +890,62 @@ TEST(propertyinfoserializer, GetPropertyInfo_empty_context_and_type) {
   EXPECT_STREQ("5th", type);
 }
 
+TEST(propertyinfoserializer, ChildFingerprints) {
+  // Children that share their first 8 bytes, are shorter than 8 bytes, or are prefixes of each
+  // other, with property names that differ from them by a single byte.
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"ro.boot.", "boot", "1", false},
+      {"ro.bootimage.", "bootimage", "2", false},
+      {"ro.bootimag.", "bootimag", "3", false},
+      {"ro.bootimagex.", "bootimagex", "4", false},
+      {"ro.bootloader", "bootloader", "5", true},
+      {"ro.bootloader.x", "bootloader_x", "6", true},
+      {"ro.build.", "build", "7", false},
+      {"ro.b.", "b", "8", false},
+      {"ro.\xff.", "xff", "9", false},
+  };
+  auto queries = std::vector<std::string>{
+      "ro.boot.a",     "ro.boot",         "ro.boo.a",       "ro.bootimage.a",  "ro.bootimag.a",
+      "ro.bootimagex.a", "ro.bootimagey.a", "ro.bootimages",  "ro.bootloader",   "ro.bootloader.x",
+      "ro.bootloader.y", "ro.build.a",      "ro.buildx.a",    "ro.b.a",          "ro.a.a",
+      "ro.\xff.a",      "ro.\xfe.a",       "ro.c.a",         "ro.bootimage",    "ro.",
+  };
+
+  auto trie_builder = TrieBuilder("default", "default");
+  std::string error;
+  for (const auto& [name, context, type, is_exact] : property_info) {
+    ASSERT_TRUE(trie_builder.AddToTrie(name, context, type, is_exact, &error)) << error;
+  }
+  auto legacy_trie = TrieSerializer(false).SerializeTrie(trie_builder);
+  auto fingerprint_trie = TrieSerializer(true).SerializeTrie(trie_builder);
+
+  auto legacy_area = reinterpret_cast<const PropertyInfoArea*>(legacy_trie.data());
+  auto fingerprint_area = reinterpret_cast<const PropertyInfoArea*>(fingerprint_trie.data());
+  EXPECT_EQ(1U, legacy_area->current_version());
+  EXPECT_EQ(kPropertyInfoAreaVersionChildFingerprints, fingerprint_area->current_version());
+  EXPECT_EQ(1U, fingerprint_area->minimum_supported_version());
+
+  for (const auto& query : queries) {
+    const char* legacy_context;
+    const char* legacy_type;
+    legacy_area->GetPropertyInfo(query.c_str(), &legacy_context, &legacy_type);
+    const char* context;
+    const char* type;
+    fingerprint_area->GetPropertyInfo(query.c_str(), &context, &type);
+    EXPECT_STREQ(legacy_context, context) << query;
+    EXPECT_STREQ(legacy_type, type) << query;
+  }
+
+  const char* context;
+  fingerprint_area->GetPropertyInfo("ro.bootimagex.a", &context, nullptr);
+  EXPECT_STREQ("bootimagex", context);
+  fingerprint_area->GetPropertyInfo("ro.bootimagey.a", &context, nullptr);
+  EXPECT_STREQ("default", context);
+  fingerprint_area->GetPropertyInfo("ro.b.a", &context, nullptr);
+  EXPECT_STREQ("b", context);
+  fingerprint_area->GetPropertyInfo("ro.\xff.a", &context, nullptr);
+  EXPECT_STREQ("xff", context);
+}
+
 }  // namespace properties
 }  // namespace android
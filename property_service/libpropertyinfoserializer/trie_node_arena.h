@@ -17,6 +17,8 @@
 #ifndef PROPERTY_INFO_SERIALIZER_TRIE_NODE_ARENA_H
 #define PROPERTY_INFO_SERIALIZER_TRIE_NODE_ARENA_H
 
+#include <string.h>
+
 #include <string>
 #include <vector>
 
@@ -61,6 +63,17 @@ class TrieNodeArena {
     return reinterpret_cast<uint32_t*>(data_.data() + offset);
   }
 
+  // Only 4 byte aligned, so elements are written with WriteUint64ArrayElement().
+  uint32_t AllocateUint64Array(int length) {
+    uint32_t offset;
+    AllocateData(sizeof(uint64_t) * length, &offset);
+    return offset;
+  }
+
+  void WriteUint64ArrayElement(uint32_t offset, int n, uint64_t value) {
+    memcpy(data_.data() + offset + n * sizeof(uint64_t), &value, sizeof(value));
+  }
+
   uint32_t AllocateAndWriteString(const std::string& string) {
     uint32_t offset;
     char* data = static_cast<char*>(AllocateData(string.size() + 1, &offset));
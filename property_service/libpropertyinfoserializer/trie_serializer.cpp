@@ -103,19 +103,29 @@ uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
   uint32_t children_offset_array_offset = arena_->AllocateUint32Array(sorted_children.size());
   trie->child_nodes = children_offset_array_offset;
 
+  if (child_fingerprints_) {
+    uint32_t child_fingerprints_offset = arena_->AllocateUint64Array(sorted_children.size());
+    trie->child_fingerprints = child_fingerprints_offset;
+    for (unsigned int i = 0; i < sorted_children.size(); ++i) {
+      const std::string& name = sorted_children[i].name();
+      arena_->WriteUint64ArrayElement(child_fingerprints_offset, i,
+                                      TrieNameFingerprint(name.c_str(), name.size()));
+    }
+  }
+
   for (unsigned int i = 0; i < sorted_children.size(); ++i) {
     arena_->uint32_array(children_offset_array_offset)[i] = WriteTrieNode(sorted_children[i]);
   }
   return trie_offset;
 }
 
-TrieSerializer::TrieSerializer() {}
+TrieSerializer::TrieSerializer(bool child_fingerprints) : child_fingerprints_(child_fingerprints) {}
 
 std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
   arena_.reset(new TrieNodeArena());
 
   auto header = arena_->AllocateObject<PropertyInfoAreaHeader>(nullptr);
-  header->current_version = 1;
+  header->current_version = child_fingerprints_ ? kPropertyInfoAreaVersionChildFingerprints : 1;
   header->minimum_supported_version = 1;
 
   // Store where we're about to write the contexts.
@@ -30,7 +30,9 @@ namespace properties {
 
 class TrieSerializer {
  public:
-  TrieSerializer();
+  // child_fingerprints selects the kPropertyInfoAreaVersionChildFingerprints layout, which
+  // parsers from before that version can still read.
+  explicit TrieSerializer(bool child_fingerprints = true);
 
   std::string SerializeTrie(const TrieBuilder& trie_builder);
 
@@ -47,6 +49,7 @@ class TrieSerializer {
   }
 
   std::unique_ptr<TrieNodeArena> arena_;
+  bool child_fingerprints_;
 };
 
 }  // namespace properties